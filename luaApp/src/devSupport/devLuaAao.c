@@ -0,0 +1,161 @@
+#include "devUtil.h"
+
+#include <string.h>
+
+#include "lua.h"
+#include "larraylib.h"
+
+#include <aaoRecord.h>
+#include <dbCommon.h>
+#include <devSup.h>
+#include <recGbl.h>
+#include <alarm.h>
+#include <errlog.h>
+#include <epicsExport.h>
+
+static void pushRecord(struct aaoRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	luaPushRecordPV(proto, record->name);
+}
+
+/*
+ * Copies the NORD elements in BPTR into a new epics.array, or a table
+ * of strings for FTVL STRING. Run protected, so a failed allocation
+ * doesn't escape into the record.
+ */
+static int l_pushValues(lua_State* state)
+{
+	struct aaoRecord* record = (struct aaoRecord*) lua_touserdata(state, 1);
+	lua_array_type type;
+	lua_array* array;
+	epicsUInt32 index;
+	
+	if (luaArrayTypeForField(record->ftvl, &type))
+	{
+		lua_createtable(state, (int) record->nord, 0);
+		
+		for (index = 0; index < record->nord; index++)
+		{
+			const char* value = (const char*) record->bptr + index * MAX_STRING_SIZE;
+			const char* end = (const char*) memchr(value, '\0', MAX_STRING_SIZE);
+			
+			lua_pushlstring(state, value, end ? (size_t) (end - value) : MAX_STRING_SIZE);
+			lua_rawseti(state, -2, index + 1);
+		}
+		
+		return 1;
+	}
+	
+	array = luaNewArray(state, type, record->nord);
+	memcpy(array->data, record->bptr, record->nord * luaArrayElementSize(type));
+	
+	return 1;
+}
+
+/* Pushes the record's values as the argument after the PV */
+static int pushValues(dbCommon* common)
+{
+	struct aaoRecord* record = (struct aaoRecord*) common;
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	lua_pushcfunction(proto->state, l_pushValues);
+	lua_pushlightuserdata(proto->state, record);
+	
+	if (lua_pcall(proto->state, 1, 1, 0))
+	{
+		errlogPrintf("%s: unable to pass values to %s: %s\n", record->name, proto->function_name, lua_tostring(proto->state, -1));
+		lua_pop(proto->state, 1);
+		return -1;
+	}
+	
+	return 1;
+}
+
+static long writeValue(struct aaoRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	int args;
+	
+	if (!proto)
+	{
+		recGblSetSevr((dbCommon*) record, WRITE_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	lua_getglobal(proto->state, proto->function_name);
+	pushRecord(record);
+	
+	/* A completed async call already had its values on the worker */
+	args = proto->async_done ? 0 : pushValues((dbCommon*) record);
+	
+	if (args < 0)
+	{
+		lua_pop(proto->state, 2);
+		recGblSetSevr((dbCommon*) record, WRITE_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	if (runFunctionArgs(proto, args + 1))
+	{
+		recGblSetSevr((dbCommon*) record, WRITE_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	lua_pop(proto->state, 1);
+	return 0;
+}
+
+static long writeData(struct aaoRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = writeValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
+
+static long initRecord (dbCommon* record)
+{
+	aaoRecord* aao = (aaoRecord*) record;
+	
+	aao->dpvt = parseINPOUT(&aao->out);
+	
+	if (!aao->dpvt)
+	{
+		recGblSetSevr(record, LINK_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	((Protocol*) aao->dpvt)->push_args = pushValues;
+	
+	luaInitAsync(record);
+	
+	return 0;
+}
+
+struct {
+    long number;
+    DEVSUPFUN report;
+    DEVSUPFUN init;
+    DEVSUPFUN init_record;
+    DEVSUPFUN get_ioint_info;
+    DEVSUPFUN write;
+} devLuaAao = {
+    5,
+    NULL,
+    NULL,
+    initRecord,
+    luaGetIoIntInfo,
+    writeData
+};
+
+epicsExportAddress(dset, devLuaAao);
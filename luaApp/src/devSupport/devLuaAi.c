@@ -14,12 +14,11 @@
 static void pushRecord(struct aiRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
-	lua_State* state = proto->state;
 	
-	luaGeneratePV(state, record->name);
+	luaPushRecordPV(proto, record->name);
 }
 
-static long readData(struct aiRecord* record)
+static long readValue(struct aiRecord* record)
 {
 	int type;
 	Protocol* proto = (Protocol*) record->dpvt;
@@ -64,6 +63,21 @@ static long readData(struct aiRecord* record)
 	return 0;
 }
 
+static long readData(struct aiRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = readValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
 
 static long initRecord (dbCommon* record)
 {
@@ -77,6 +91,8 @@ static long initRecord (dbCommon* record)
 		return -1;
 	}
 	
+	luaInitAsync(record);
+	
 	return 0;
 }
 
@@ -93,7 +109,7 @@ struct {
     NULL,
     NULL,
     initRecord,
-    NULL,
+    luaGetIoIntInfo,
     readData,
     NULL
 };
@@ -13,12 +13,11 @@
 static void pushRecord(struct aoRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
-	lua_State* state = proto->state;
 	
-	luaGeneratePV(state, record->name);
+	luaPushRecordPV(proto, record->name);
 }
 
-static long writeData(struct aoRecord* record)
+static long writeValue(struct aoRecord* record)
 {
 	int type;
 	Protocol* proto = (Protocol*) record->dpvt;
@@ -55,6 +54,21 @@ static long writeData(struct aoRecord* record)
 	return 0;
 }
 
+static long writeData(struct aoRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = writeValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
 
 static long initRecord (dbCommon* record)
 {
@@ -68,6 +82,8 @@ static long initRecord (dbCommon* record)
 		return -1;
 	}
 	
+	luaInitAsync(record);
+	
 	return 0;
 }
 
@@ -84,7 +100,7 @@ struct {
     NULL,
     NULL,
     initRecord,
-    NULL,
+    luaGetIoIntInfo,
     writeData,
     NULL
 };
@@ -13,12 +13,11 @@
 static void pushRecord(struct biRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
-	lua_State* state = proto->state;
 	
-	luaGeneratePV(state, record->name);
+	luaPushRecordPV(proto, record->name);
 }
 
-static long readData(struct biRecord* record)
+static long readValue(struct biRecord* record)
 {
 	int type;
 	Protocol* proto = (Protocol*) record->dpvt;
@@ -102,6 +101,21 @@ static long readData(struct biRecord* record)
 	return 0;
 }
 
+static long readData(struct biRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = readValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
 
 static long initRecord (dbCommon* record)
 {
@@ -115,6 +129,8 @@ static long initRecord (dbCommon* record)
 		return -1;
 	}
 	
+	luaInitAsync(record);
+	
 	return 0;
 }
 
@@ -130,7 +146,7 @@ struct {
     NULL,
     NULL,
     initRecord,
-    NULL,
+    luaGetIoIntInfo,
     readData
 };
 
@@ -0,0 +1,124 @@
+#include "devUtil.h"
+
+#include "lua.h"
+
+#include <int64inRecord.h>
+#include <dbCommon.h>
+#include <devSup.h>
+#include <recGbl.h>
+#include <alarm.h>
+#include <epicsExport.h>
+
+static void pushRecord(struct int64inRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	luaPushRecordPV(proto, record->name);
+}
+
+static long readValue(struct int64inRecord* record)
+{
+	int type;
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	if (!proto)
+	{
+		recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	lua_getglobal(proto->state, proto->function_name);
+	pushRecord(record);
+	
+	if (runFunction(proto))
+	{
+		recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	type = lua_type(proto->state, -1);
+	
+	switch (type)
+	{		
+		case LUA_TNUMBER:
+		{
+			if (! lua_isinteger(proto->state, -1))
+			{ 
+				lua_pop(proto->state, 1);
+				recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+				return -1;
+			}
+			else
+			{
+				epicsInt64 val = lua_tointeger(proto->state, -1);
+				record->val = val;
+				record->udf = FALSE;
+			
+				lua_pop(proto->state, 1);
+				return 0;
+			}
+		}
+		
+		case LUA_TNIL:
+			lua_pop(proto->state, 1);
+			return 0;
+		
+		default:
+			lua_pop(proto->state, 1);
+			recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+			return -1;
+	}
+	
+	return 0;
+}
+
+static long readData(struct int64inRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = readValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
+
+static long initRecord (dbCommon* record)
+{
+	int64inRecord* int64in = (int64inRecord*) record;
+	
+	int64in->dpvt = parseINPOUT(&int64in->inp);
+	
+	if (!int64in->dpvt)
+	{
+		recGblSetSevr(record, LINK_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	luaInitAsync(record);
+	
+	return 0;
+}
+
+struct {
+    long number;
+    DEVSUPFUN report;
+    DEVSUPFUN init;
+    DEVSUPFUN init_record;
+    DEVSUPFUN get_ioint_info;
+    DEVSUPFUN read;
+} devLuaInt64in = {
+    5,
+    NULL,
+    NULL,
+    initRecord,
+    luaGetIoIntInfo,
+    readData
+};
+
+epicsExportAddress(dset, devLuaInt64in);
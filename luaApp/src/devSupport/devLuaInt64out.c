@@ -0,0 +1,89 @@
+#include "devUtil.h"
+
+#include <int64outRecord.h>
+#include <dbCommon.h>
+#include <devSup.h>
+#include <recGbl.h>
+#include <alarm.h>
+#include <epicsExport.h>
+
+static void pushRecord(struct int64outRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	luaPushRecordPV(proto, record->name);
+}
+
+static long writeValue(struct int64outRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	if (!proto)
+	{
+		recGblSetSevr((dbCommon*) record, WRITE_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	lua_getglobal(proto->state, proto->function_name);
+	pushRecord(record);
+	
+	if (runFunction(proto))
+	{
+		recGblSetSevr((dbCommon*) record, WRITE_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	lua_pop(proto->state, 1);
+	return 0;
+}
+
+static long writeData(struct int64outRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = writeValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
+
+static long initRecord (dbCommon* record)
+{
+	int64outRecord* int64out = (int64outRecord*) record;
+	
+	int64out->dpvt = parseINPOUT(&int64out->out);
+	
+	if (!int64out->dpvt)
+	{
+		recGblSetSevr(record, LINK_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	luaInitAsync(record);
+	
+	return 0;
+}
+
+struct {
+    long number;
+    DEVSUPFUN report;
+    DEVSUPFUN init;
+    DEVSUPFUN init_record;
+    DEVSUPFUN get_ioint_info;
+    DEVSUPFUN write;
+} devLuaInt64out = {
+    5,
+    NULL,
+    NULL,
+    initRecord,
+    luaGetIoIntInfo,
+    writeData
+};
+
+epicsExportAddress(dset, devLuaInt64out);
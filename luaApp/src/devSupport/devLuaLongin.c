@@ -12,12 +12,11 @@
 static void pushRecord(struct longinRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
-	lua_State* state = proto->state;
 	
-	luaGeneratePV(state, record->name);
+	luaPushRecordPV(proto, record->name);
 }
 
-static long readData(struct longinRecord* record)
+static long readValue(struct longinRecord* record)
 {
 	int type;
 	Protocol* proto = (Protocol*) record->dpvt;
@@ -73,6 +72,21 @@ static long readData(struct longinRecord* record)
 	return 0;
 }
 
+static long readData(struct longinRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = readValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
 
 static long initRecord (dbCommon* record)
 {
@@ -86,6 +100,8 @@ static long initRecord (dbCommon* record)
 		return -1;
 	}
 	
+	luaInitAsync(record);
+	
 	return 0;
 }
 
@@ -101,7 +117,7 @@ struct {
     NULL,
     NULL,
     initRecord,
-    NULL,
+    luaGetIoIntInfo,
     readData
 };
 
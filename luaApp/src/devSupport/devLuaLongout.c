@@ -10,12 +10,11 @@
 static void pushRecord(struct longoutRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
-	lua_State* state = proto->state;
 	
-	luaGeneratePV(state, record->name);
+	luaPushRecordPV(proto, record->name);
 }
 
-static long writeData(struct longoutRecord* record)
+static long writeValue(struct longoutRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
 	
@@ -38,6 +37,21 @@ static long writeData(struct longoutRecord* record)
 	return 0;
 }
 
+static long writeData(struct longoutRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = writeValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
 
 static long initRecord (dbCommon* record)
 {
@@ -51,6 +65,8 @@ static long initRecord (dbCommon* record)
 		return -1;
 	}
 	
+	luaInitAsync(record);
+	
 	return 0;
 }
 
@@ -66,7 +82,7 @@ struct {
     NULL,
     NULL,
     initRecord,
-    NULL,
+    luaGetIoIntInfo,
     writeData
 };
 
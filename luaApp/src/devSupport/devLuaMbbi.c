@@ -13,12 +13,11 @@
 static void pushRecord(struct mbbiRecord* record)
 {
 	Protocol* proto = (Protocol*) record->dpvt;
-	lua_State* state = proto->state;
 	
-	luaGeneratePV(state, record->name);
+	luaPushRecordPV(proto, record->name);
 }
 
-static long readData(struct mbbiRecord* record)
+static long readValue(struct mbbiRecord* record)
 {
 	int type, index;
 	Protocol* proto = (Protocol*) record->dpvt;
@@ -108,6 +107,21 @@ static long readData(struct mbbiRecord* record)
 	return 0;
 }
 
+static long readData(struct mbbiRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = readValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
 
 static long initRecord (dbCommon* record)
 {
@@ -121,6 +135,8 @@ static long initRecord (dbCommon* record)
 		return -1;
 	}
 	
+	luaInitAsync(record);
+	
 	return 0;
 }
 
@@ -136,7 +152,7 @@ struct {
     NULL,
     NULL,
     initRecord,
-    NULL,
+    luaGetIoIntInfo,
     readData
 };
 
@@ -0,0 +1,109 @@
+#include "devUtil.h"
+
+#include "lua.h"
+
+#include <waveformRecord.h>
+#include <dbCommon.h>
+#include <devSup.h>
+#include <recGbl.h>
+#include <alarm.h>
+#include <epicsExport.h>
+
+static void pushRecord(struct waveformRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	luaPushRecordPV(proto, record->name);
+}
+
+static long readValue(struct waveformRecord* record)
+{
+	epicsUInt32 nord;
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	if (!proto)
+	{
+		recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	lua_getglobal(proto->state, proto->function_name);
+	pushRecord(record);
+	
+	if (runFunction(proto))
+	{
+		recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	if (lua_isnil(proto->state, -1))
+	{
+		lua_pop(proto->state, 1);
+		return 0;
+	}
+	
+	/* Elements are converted straight into the record's buffer */
+	if (luaToArray(proto->state, -1, record->bptr, record->ftvl, record->nelm, &nord))
+	{
+		lua_pop(proto->state, 1);
+		recGblSetSevr((dbCommon*) record, READ_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	record->nord = nord;
+	record->udf = FALSE;
+	
+	lua_pop(proto->state, 1);
+	return 0;
+}
+
+static long readData(struct waveformRecord* record)
+{
+	Protocol* proto = (Protocol*) record->dpvt;
+	long status;
+	
+	/* Pass 1 of an async record queues the call to a worker */
+	if (luaQueueAsync(proto, (dbCommon*) record))    { return 0; }
+	
+	luaLockProtocol(proto);
+	status = readValue(record);
+	luaUnlockProtocol(proto);
+	
+	return status;
+}
+
+
+static long initRecord (dbCommon* record)
+{
+	waveformRecord* waveform = (waveformRecord*) record;
+	
+	waveform->dpvt = parseINPOUT(&waveform->inp);
+	
+	if (!waveform->dpvt)
+	{
+		recGblSetSevr(record, LINK_ALARM, INVALID_ALARM);
+		return -1;
+	}
+	
+	luaInitAsync(record);
+	
+	return 0;
+}
+
+struct {
+    long number;
+    DEVSUPFUN report;
+    DEVSUPFUN init;
+    DEVSUPFUN init_record;
+    DEVSUPFUN get_ioint_info;
+    DEVSUPFUN read;
+} devLuaWaveform = {
+    5,
+    NULL,
+    NULL,
+    initRecord,
+    luaGetIoIntInfo,
+    readData
+};
+
+epicsExportAddress(dset, devLuaWaveform);
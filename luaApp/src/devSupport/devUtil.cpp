@@ -1,21 +1,203 @@
 #include "devUtil.h"
 
 #include <string>
+#include <map>
+#include <utility>
 #include <cstdlib>
 #include <cstring>
 
 #include "link.h"
 
 #include <errlog.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsAtomic.h>
+#include <dbStaticLib.h>
+#include <dbAccess.h>
+#include <epicsVersion.h>
 #include <epicsExport.h>
 
 #include "luaEpics.h"
+#include "larraylib.h"
+
+/*
+ * When non-zero, records whose INP/OUT name the same script file and
+ * port share one Lua state instead of each loading their own copy.
+ */
+int luaDeviceSharedStates = 0;
+
+/* Maximum number of worker threads running async record calls */
+int luaDeviceAsyncThreads = 4;
+
+/* Default VM instruction limit for record calls, 0 for no limit */
+int luaDeviceInstructionLimit = 0;
+
+typedef std::pair<std::string, std::string> pool_key;
+
+static epicsMutex poolMutex;
+static std::map<pool_key, lua_State*> state_pool;
+
+/* Records using the same state serialize on one lock per state */
+static std::map<lua_State*, epicsMutexId> state_locks;
+
+static epicsMutexId sharedStateLock(lua_State* state)
+{
+	epicsGuard<epicsMutex> guard(poolMutex);
+	
+	std::map<lua_State*, epicsMutexId>::iterator it = state_locks.find(state);
+	
+	if (it != state_locks.end())    { return it->second; }
+	
+	epicsMutexId lock = epicsMutexMustCreate();
+	state_locks[state] = lock;
+	
+	return lock;
+}
+
+/*
+ * Returns the pooled state for the file and port, loading the script
+ * into a new state on first use. Returns NULL if the script fails to
+ * load.
+ */
+static lua_State* pooledState(const std::string& located, const char* filename, const char* portname)
+{
+	epicsGuard<epicsMutex> guard(poolMutex);
+	
+	pool_key key(located, portname);
+	
+	std::map<pool_key, lua_State*>::iterator it = state_pool.find(key);
+	
+	if (it != state_pool.end())
+	{
+		luaStateRef(it->second);
+		return it->second;
+	}
+	
+	lua_State* state = luaCreateState();
+	
+	if (! state)    { return NULL; }
+	
+	luaSetStateOwner(state, ("device (shared) " + located).c_str());
+	
+	if (luaLoadScript(state, filename))
+	{
+		luaStateUnref(state);
+		return NULL;
+	}
+	
+	lua_pushstring(state, portname);
+	lua_setglobal(state, "PORT");
+	
+	state_pool[key] = state;
+	
+	return state;
+}
+
+/*
+ * I/O Intr scan lists, keyed by the record's "lua:scan" info tag or
+ * by the record name. The pending flag coalesces scan requests made
+ * before the records have run their Lua functions.
+ */
+struct LuaScanList
+{
+	IOSCANPVT ioscan;
+	int       pending;
+};
+
+static epicsMutex scanMutex;
+static std::map<std::string, LuaScanList*> scan_lists;
+
+static LuaScanList* findScanList(const std::string& name, bool create)
+{
+	epicsGuard<epicsMutex> guard(scanMutex);
+	
+	std::map<std::string, LuaScanList*>::iterator it = scan_lists.find(name);
+	
+	if (it != scan_lists.end())    { return it->second; }
+	if (! create)                  { return NULL; }
+	
+	LuaScanList* list = new LuaScanList;
+	scanIoInit(&list->ioscan);
+	list->pending = 0;
+	
+	scan_lists[name] = list;
+	
+	return list;
+}
+
+/* Returns the value of an info tag on the record, or the default */
+static std::string recordInfo(dbCommon* record, const char* tag, const std::string& default_value)
+{
+	std::string output(default_value);
+	DBENTRY entry;
+	
+	dbInitEntry(pdbbase, &entry);
+	
+	if (! dbFindRecord(&entry, record->name) && ! dbFindInfo(&entry, tag))
+	{
+		output = dbGetInfoString(&entry);
+	}
+	
+	dbFinishEntry(&entry);
+	
+	return output;
+}
+
+/*
+ * Worker pool for records with the "lua:async" info tag. The Lua
+ * call runs on a worker, then the record completes on a callback
+ * thread through callbackRequestProcessCallback.
+ */
+static epicsThreadPool* asyncPool = NULL;
+
+static void asyncJob(void* arg, epicsJobMode mode)
+{
+	if (mode == epicsJobModeCleanup)    { return; }
+	
+	dbCommon* record = (dbCommon*) arg;
+	Protocol* proto = (Protocol*) record->dpvt;
+	
+	luaLockProtocol(proto);
+	
+	lua_getglobal(proto->state, proto->function_name);
+	luaPushRecordPV(proto, record->name);
+	
+	/* Output records may pass their value after the PV */
+	int args = proto->push_args ? proto->push_args(record) : 0;
+	
+	if (args < 0)
+	{
+		lua_pop(proto->state, 2);
+		proto->async_status = -1;
+	}
+	else
+	{
+		proto->async_status = runFunctionArgs(proto, args + 1);
+	}
+	
+	/* Keep the result in the registry until the record completes */
+	if (! proto->async_status)    { proto->result_ref = luaL_ref(proto->state, LUA_REGISTRYINDEX); }
+	
+	proto->async_done = 1;
+	
+	luaUnlockProtocol(proto);
+	
+	callbackRequestProcessCallback(&proto->callback, record->prio, record);
+}
 
 extern "C"
 {
 	Protocol* parseINPOUT(const struct link* inpout)
 	{
 		Protocol* output = new Protocol();
+		output->pv_ref = LUA_NOREF;
+		output->lock = NULL;
+		output->scan = NULL;
+		output->job = NULL;
+		output->async_done = 0;
+		output->result_ref = LUA_NOREF;
+		output->budget = 0;
+		output->push_args = NULL;
 		
 		std::string code(inpout->value.instio.string);
 		
@@ -82,13 +264,37 @@ extern "C"
 			if (named)
 			{
 				output->state = named;
+				output->lock = sharedStateLock(named);
 				return output;
 			}
 		}
+		else if (luaDeviceSharedStates)
+		{
+			output->state = pooledState(located, output->filename, output->portname);
+			
+			if (! output->state)
+			{
+				errlogPrintf("Error loading file: %s\n", output->filename);
+				delete output;
+				return NULL;
+			}
+			
+			output->lock = sharedStateLock(output->state);
+			return output;
+		}
 		
 		/* File found (or no named state match) -- create a new state and load */
 		output->state = luaCreateState();
 		
+		if (! output->state)
+		{
+			errlogPrintf("Unable to create a Lua state for %s\n", output->filename);
+			delete output;
+			return NULL;
+		}
+		
+		luaSetStateOwner(output->state, (std::string("device ") + output->filename).c_str());
+		
 		if (luaLoadScript(output->state, output->filename))
 		{
 			errlogPrintf("Error loading file: %s\n", output->filename);
@@ -103,11 +309,265 @@ extern "C"
 		return output;
 	}
 	
+	/*
+	 * Pushes the PV object for the record onto the stack. The object
+	 * is created on the first call and kept in the registry, so that
+	 * the field addresses it resolves are reused on every process.
+	 */
+	void luaPushRecordPV(Protocol* proto, const char* record_name)
+	{
+		if (proto->pv_ref != LUA_NOREF)
+		{
+			lua_rawgeti(proto->state, LUA_REGISTRYINDEX, proto->pv_ref);
+			return;
+		}
+		
+		luaGeneratePV(proto->state, record_name);
+		
+		lua_pushvalue(proto->state, -1);
+		proto->pv_ref = luaL_ref(proto->state, LUA_REGISTRYINDEX);
+	}
+	
+	void luaLockProtocol(Protocol* proto)
+	{
+		if (proto && proto->lock)    { epicsMutexMustLock(proto->lock); }
+	}
+	
+	void luaUnlockProtocol(Protocol* proto)
+	{
+		if (proto && proto->lock)    { epicsMutexUnlock(proto->lock); }
+	}
+	
+	long luaGetIoIntInfo(int cmd, dbCommon* record, IOSCANPVT* ppvt)
+	{
+		Protocol* proto = (Protocol*) record->dpvt;
+		
+		if (! proto)    { return -1; }
+		
+		if (! proto->scan)    { proto->scan = findScanList(recordInfo(record, "lua:scan", record->name), true); }
+		
+		*ppvt = proto->scan->ioscan;
+		return 0;
+	}
+	
+	/*
+	 * Requests I/O Intr processing of the records on the named scan
+	 * list. Requests made while the records haven't run yet are
+	 * merged into the pending scan. Returns 0 if there is no such list.
+	 *
+	 * If nothing was queued (before interruptAccept, or with no record
+	 * on the list) no record will run to clear the pending flag, so it
+	 * is cleared here instead.
+	 */
+	int luaRequestScan(const char* name)
+	{
+		LuaScanList* list = findScanList(name, false);
+		
+		if (! list)    { return 0; }
+		
+		if (epicsAtomicCmpAndSwapIntT(&list->pending, 0, 1) == 0)
+		{
+#if EPICS_VERSION_INT >= VERSION_INT(3, 15, 0, 2)
+			if (! scanIoRequest(list->ioscan))    { epicsAtomicSetIntT(&list->pending, 0); }
+#else
+			if (! interruptAccept)    { epicsAtomicSetIntT(&list->pending, 0); }
+			else                      { scanIoRequest(list->ioscan); }
+#endif
+		}
+		
+		return 1;
+	}
+	
+	/*
+	 * Copies the Lua value at index into an array record's buffer,
+	 * converting each element to the FTVL type in place. Accepts a
+	 * table, an epics.array, a string (for CHAR/UCHAR arrays), or a
+	 * single number.
+	 * Sets nord to the number of elements copied, at most nelm.
+	 */
+	long luaToArray(lua_State* state, int index, void* bptr, short ftvl, epicsUInt32 nelm, epicsUInt32* nord)
+	{
+		epicsUInt32 count;
+		epicsUInt32 i;
+		
+		lua_array* array = luaTestArray(state, index);
+		
+		if (array)
+		{
+			long copied = luaArrayCopyOut(array, bptr, ftvl, nelm);
+			
+			if (copied < 0)    { return -1; }
+			
+			*nord = (epicsUInt32) copied;
+			return 0;
+		}
+		
+		if (lua_type(state, index) == LUA_TSTRING)
+		{
+			size_t length;
+			const char* data = lua_tolstring(state, index, &length);
+			
+			if (ftvl != DBF_CHAR && ftvl != DBF_UCHAR)    { return -1; }
+			
+			count = (length < nelm) ? (epicsUInt32) length : nelm;
+			memcpy(bptr, data, count);
+			
+			*nord = count;
+			return 0;
+		}
+		
+		bool is_table = lua_istable(state, index);
+		
+		if (! is_table && ! lua_isnumber(state, index))    { return -1; }
+		
+		if (is_table)
+		{
+			lua_Unsigned length = lua_rawlen(state, index);
+			count = (length < nelm) ? (epicsUInt32) length : nelm;
+		}
+		else
+		{
+			count = (nelm > 0) ? 1 : 0;
+		}
+		
+		index = lua_absindex(state, index);
+		
+		for (i = 0; i < count; i++)
+		{
+			if (is_table)    { lua_rawgeti(state, index, i + 1); }
+			else             { lua_pushvalue(state, index); }
+			
+			if (ftvl == DBF_STRING)
+			{
+				char* dest = (char*) bptr + i * MAX_STRING_SIZE;
+				const char* text = lua_tostring(state, -1);
+				
+				strncpy(dest, text ? text : "", MAX_STRING_SIZE - 1);
+				dest[MAX_STRING_SIZE - 1] = '\0';
+				lua_pop(state, 1);
+				continue;
+			}
+			
+			/* Integers are copied exactly, floats are truncated for integer FTVLs */
+			lua_Number  fval = lua_tonumber(state, -1);
+			lua_Integer ival = lua_isinteger(state, -1) ? lua_tointeger(state, -1) : (lua_Integer) fval;
+			
+			lua_pop(state, 1);
+			
+			switch (ftvl)
+			{
+				case DBF_CHAR:   ((epicsInt8*)    bptr)[i] = (epicsInt8)    ival; break;
+				case DBF_UCHAR:  ((epicsUInt8*)   bptr)[i] = (epicsUInt8)   ival; break;
+				case DBF_SHORT:  ((epicsInt16*)   bptr)[i] = (epicsInt16)   ival; break;
+				case DBF_USHORT: ((epicsUInt16*)  bptr)[i] = (epicsUInt16)  ival; break;
+				case DBF_ENUM:   ((epicsEnum16*)  bptr)[i] = (epicsEnum16)  ival; break;
+				case DBF_LONG:   ((epicsInt32*)   bptr)[i] = (epicsInt32)   ival; break;
+				case DBF_ULONG:  ((epicsUInt32*)  bptr)[i] = (epicsUInt32)  ival; break;
+#if EPICS_VERSION_INT >= VERSION_INT(3, 16, 1, 0)
+				case DBF_INT64:  ((epicsInt64*)   bptr)[i] = (epicsInt64)   ival; break;
+				case DBF_UINT64: ((epicsUInt64*)  bptr)[i] = (epicsUInt64)  ival; break;
+#endif
+				case DBF_FLOAT:  ((epicsFloat32*) bptr)[i] = (epicsFloat32) fval; break;
+				case DBF_DOUBLE: ((epicsFloat64*) bptr)[i] = (epicsFloat64) fval; break;
+				default:         return -1;
+			}
+		}
+		
+		*nord = count;
+		return 0;
+	}
+	
+	void luaInitAsync(dbCommon* record)
+	{
+		Protocol* proto = (Protocol*) record->dpvt;
+		
+		/* Every record passes through here at init, async or not */
+		proto->budget = atol(recordInfo(record, "lua:budget", "0").c_str());
+		if (proto->budget <= 0)    { proto->budget = luaDeviceInstructionLimit; }
+		
+		if (! atoi(recordInfo(record, "lua:async", "0").c_str()))    { return; }
+		
+		if (! asyncPool)
+		{
+			epicsThreadPoolConfig config;
+			
+			epicsThreadPoolConfigDefaults(&config);
+			config.maxThreads = (luaDeviceAsyncThreads > 0) ? luaDeviceAsyncThreads : 1;
+			
+			asyncPool = epicsThreadPoolCreate(&config);
+			
+			if (! asyncPool)
+			{
+				errlogPrintf("%s: can't create Lua worker pool, processing synchronously\n", record->name);
+				return;
+			}
+		}
+		
+		proto->job = epicsJobCreate(asyncPool, asyncJob, record);
+		
+		if (! proto->job)
+		{
+			errlogPrintf("%s: can't create Lua worker job, processing synchronously\n", record->name);
+			return;
+		}
+		
+		/* Workers run without the record lock, so always serialize on the state */
+		if (! proto->lock)    { proto->lock = sharedStateLock(proto->state); }
+	}
+	
+	/*
+	 * Pass 1 of an async record: sets PACT and queues the Lua call.
+	 * Returns 0 for synchronous records and for pass 2, which reads
+	 * the stored result through runFunction.
+	 */
+	int luaQueueAsync(Protocol* proto, dbCommon* record)
+	{
+		if (! proto || ! proto->job || record->pact)    { return 0; }
+		
+		record->pact = TRUE;
+		
+		if (epicsJobQueue(proto->job))
+		{
+			record->pact = FALSE;
+			return 0;
+		}
+		
+		return 1;
+	}
+	
+	/*
+	 * Calls the function and parameters on the stack, leaving the
+	 * result on top. When an async call has completed, the function
+	 * isn't called again: it's replaced with the worker's result.
+	 */
 	int runFunction(Protocol* proto)
 	{
+		return runFunctionArgs(proto, 1);
+	}
+	
+	/* As runFunction, with args arguments above the function instead of just the PV */
+	int runFunctionArgs(Protocol* proto, int args)
+	{
+		if (proto->async_done)
+		{
+			proto->async_done = 0;
+			lua_pop(proto->state, args + 1);
+			
+			if (proto->async_status)    { return proto->async_status; }
+			
+			lua_rawgeti(proto->state, LUA_REGISTRYINDEX, proto->result_ref);
+			luaL_unref(proto->state, LUA_REGISTRYINDEX, proto->result_ref);
+			proto->result_ref = LUA_NOREF;
+			
+			return 0;
+		}
+		
+		/* Later scan requests need a new pass to be seen */
+		if (proto->scan)    { epicsAtomicSetIntT(&proto->scan->pending, 0); }
+		
 		int params = luaLoadParams(proto->state, proto->param_list);
 		
-		int status = lua_pcall(proto->state, params + 1, 1, 0);
+		int status = luaBudgetCall(proto->state, params + args, 1, 0, proto->budget);
 		
 		if (status)
 		{
@@ -120,3 +580,10 @@ extern "C"
 		return status;
 	}
 }
+
+extern "C"
+{
+	epicsExportAddress(int, luaDeviceSharedStates);
+	epicsExportAddress(int, luaDeviceAsyncThreads);
+	epicsExportAddress(int, luaDeviceInstructionLimit);
+}
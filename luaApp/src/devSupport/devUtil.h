@@ -4,11 +4,18 @@
 #include "lepicslib.h"
 #include <link.h>
 #include <lua.h>
+#include <epicsMutex.h>
+#include <dbCommon.h>
+#include <dbScan.h>
+#include <callback.h>
+#include <epicsThreadPool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct LuaScanList LuaScanList;
+
 typedef struct Protocol
 {
 	lua_State*  state;
@@ -16,11 +23,36 @@ typedef struct Protocol
 	char function_name[256];
 	char portname[256];
 	char param_list[256];
+	int  pv_ref;
+	epicsMutexId lock;
+	LuaScanList* scan;
+	epicsJob*    job;
+	CALLBACK     callback;
+	int          async_done;
+	int          async_status;
+	int          result_ref;
+	long         budget;
+	int        (*push_args)(dbCommon* record);
 } Protocol;
 
 Protocol* parseINPOUT(const struct link* inpout);
 
+void luaPushRecordPV(Protocol* proto, const char* record_name);
+
 int runFunction(Protocol* proto);
+int runFunctionArgs(Protocol* proto, int args);
+
+void luaLockProtocol(Protocol* proto);
+void luaUnlockProtocol(Protocol* proto);
+
+long luaGetIoIntInfo(int cmd, dbCommon* record, IOSCANPVT* ppvt);
+
+int luaRequestScan(const char* name);
+
+long luaToArray(lua_State* state, int index, void* bptr, short ftvl, epicsUInt32 nelm, epicsUInt32* nord);
+
+void luaInitAsync(dbCommon* record);
+int  luaQueueAsync(Protocol* proto, dbCommon* record);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,67 @@
+#ifndef INC_LARRAYLIB_H
+#define INC_LARRAYLIB_H
+
+#include "luaEpics.h"
+#include <stddef.h>
+
+/*
+ * epics.array -- contiguous typed numeric array userdata.
+ *
+ * Elements are stored in a single C buffer, so database and channel
+ * access gets and puts can copy an array in one call instead of
+ * converting element by element through a Lua table. The buffer comes
+ * from the state's allocator, so it counts towards the state's memory
+ * and its limit.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum
+{
+	LUA_ARRAY_INT8,
+	LUA_ARRAY_UINT8,
+	LUA_ARRAY_INT16,
+	LUA_ARRAY_UINT16,
+	LUA_ARRAY_INT32,
+	LUA_ARRAY_UINT32,
+	LUA_ARRAY_INT64,
+	LUA_ARRAY_UINT64,
+	LUA_ARRAY_FLOAT32,
+	LUA_ARRAY_FLOAT64
+} lua_array_type;
+
+typedef struct lua_array
+{
+	lua_array_type type;
+	size_t         count;
+	size_t         capacity;
+	void*          data;
+	lua_Alloc      alloc;       /* the owning state's allocator */
+	void*          alloc_ud;
+} lua_array;
+
+epicsShareFunc lua_array* luaNewArray(lua_State* state, lua_array_type type, size_t count);
+epicsShareFunc lua_array* luaTestArray(lua_State* state, int index);
+epicsShareFunc int        luaArrayResize(lua_array* array, size_t count);
+epicsShareFunc size_t     luaArrayElementSize(lua_array_type type);
+epicsShareFunc double     luaArrayGet(const lua_array* array, size_t index);
+
+/* Database request type (dbFldTypes.h numbering), or -1 if unsupported */
+epicsShareFunc short      luaArrayDbType(lua_array_type type);
+
+/* Array type for a database field type, returns 0 on success */
+epicsShareFunc int        luaArrayTypeForField(short field_type, lua_array_type* type);
+
+/* Copies into a buffer of a database field type, returns the element count or -1 */
+epicsShareFunc long       luaArrayCopyOut(const lua_array* array, void* bptr, short field_type, size_t count);
+
+epicsShareFunc int        luaArrayConstructor(lua_State* state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,28 @@
 #include <string>
 #include <asynPortDriver.h>
 #include <asynPortClient.h>
+#include "larraylib.h"
+
+/* asynInt64 and asynParamInt64 were added in asyn R4-35 */
+#if ASYN_VERSION > 4 || (ASYN_VERSION == 4 && ASYN_REVISION >= 35)
+	#define LUA_ASYN_INT64
+	#define LUA_ASYN_INT64_MASK  asynInt64Mask
+#else
+	#define LUA_ASYN_INT64_MASK  0
+#endif
+
+/* Interfaces served by the Lua port drivers */
+#define LUA_ASYN_INTERFACES  (asynInt32Mask | asynFloat64Mask | asynOctetMask | asynUInt32DigitalMask | \
+                              asynInt8ArrayMask | asynInt16ArrayMask | asynInt32ArrayMask | \
+                              asynFloat64ArrayMask | LUA_ASYN_INT64_MASK)
+
+/*
+ * Array parameters are passed between asyn drivers and Lua as
+ * epics.array values, copied in one block. Pulling also accepts
+ * a table of numbers. Returns the number of elements copied.
+ */
+epicsShareFunc void   luaAsynPushArray(lua_State* state, const void* data, lua_array_type type, size_t count);
+epicsShareFunc size_t luaAsynPullArray(lua_State* state, int index, void* data, lua_array_type type, size_t count);
 
 extern "C" {
 #endif
@@ -0,0 +1,620 @@
+/*
+ * larraylib.cpp -- Typed numeric arrays for Lua EPICS
+ *
+ * An epics.array holds its elements in one contiguous C buffer of a
+ * fixed numeric type. Element access goes through __index/__newindex,
+ * reductions run as plain C loops, and the database, channel access,
+ * device support and luascript code can copy the buffer directly
+ * instead of building or walking a Lua table one element at a time.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <dbFldTypes.h>
+#include <epicsTypes.h>
+#include <epicsVersion.h>
+
+#include "larraylib.h"
+
+#define LUA_ARRAY_META "lua_array"
+#define LUA_ARRAY_MIN_CAPACITY 16
+
+static const char* array_type_names[] = {
+	"int8", "uint8", "int16", "uint16", "int32",
+	"uint32", "int64", "uint64", "float32", "float64", NULL
+};
+
+static const size_t array_type_sizes[] = {
+	sizeof(epicsInt8),   sizeof(epicsUInt8),
+	sizeof(epicsInt16),  sizeof(epicsUInt16),
+	sizeof(epicsInt32),  sizeof(epicsUInt32),
+	sizeof(long long),   sizeof(unsigned long long),
+	sizeof(epicsFloat32), sizeof(epicsFloat64)
+};
+
+static int is_float_type(lua_array_type type)
+{
+	return type == LUA_ARRAY_FLOAT32 || type == LUA_ARRAY_FLOAT64;
+}
+
+
+/*
+ * =========================================================================
+ * Element access
+ * =========================================================================
+ */
+
+static lua_Integer get_integer(const lua_array* array, size_t index)
+{
+	switch (array->type)
+	{
+		case LUA_ARRAY_INT8:    return ((epicsInt8*)  array->data)[index];
+		case LUA_ARRAY_UINT8:   return ((epicsUInt8*) array->data)[index];
+		case LUA_ARRAY_INT16:   return ((epicsInt16*)  array->data)[index];
+		case LUA_ARRAY_UINT16:  return ((epicsUInt16*) array->data)[index];
+		case LUA_ARRAY_INT32:   return ((epicsInt32*)  array->data)[index];
+		case LUA_ARRAY_UINT32:  return ((epicsUInt32*) array->data)[index];
+		case LUA_ARRAY_INT64:   return (lua_Integer) ((long long*) array->data)[index];
+		case LUA_ARRAY_UINT64:  return (lua_Integer) ((unsigned long long*) array->data)[index];
+		case LUA_ARRAY_FLOAT32: return (lua_Integer) ((epicsFloat32*) array->data)[index];
+		case LUA_ARRAY_FLOAT64: return (lua_Integer) ((epicsFloat64*) array->data)[index];
+	}
+
+	return 0;
+}
+
+static void set_integer(lua_array* array, size_t index, lua_Integer value)
+{
+	switch (array->type)
+	{
+		case LUA_ARRAY_INT8:    ((epicsInt8*)   array->data)[index] = (epicsInt8)   value; break;
+		case LUA_ARRAY_UINT8:   ((epicsUInt8*)  array->data)[index] = (epicsUInt8)  value; break;
+		case LUA_ARRAY_INT16:   ((epicsInt16*)  array->data)[index] = (epicsInt16)  value; break;
+		case LUA_ARRAY_UINT16:  ((epicsUInt16*) array->data)[index] = (epicsUInt16) value; break;
+		case LUA_ARRAY_INT32:   ((epicsInt32*)  array->data)[index] = (epicsInt32)  value; break;
+		case LUA_ARRAY_UINT32:  ((epicsUInt32*) array->data)[index] = (epicsUInt32) value; break;
+		case LUA_ARRAY_INT64:   ((long long*)   array->data)[index] = (long long)   value; break;
+		case LUA_ARRAY_UINT64:  ((unsigned long long*) array->data)[index] = (unsigned long long) value; break;
+		case LUA_ARRAY_FLOAT32: ((epicsFloat32*) array->data)[index] = (epicsFloat32) value; break;
+		case LUA_ARRAY_FLOAT64: ((epicsFloat64*) array->data)[index] = (epicsFloat64) value; break;
+	}
+}
+
+static void set_number(lua_array* array, size_t index, lua_Number value)
+{
+	switch (array->type)
+	{
+		case LUA_ARRAY_FLOAT32: ((epicsFloat32*) array->data)[index] = (epicsFloat32) value; break;
+		case LUA_ARRAY_FLOAT64: ((epicsFloat64*) array->data)[index] = (epicsFloat64) value; break;
+
+		/* Floats are truncated for integer arrays */
+		default:                set_integer(array, index, (lua_Integer) value); break;
+	}
+}
+
+/* Stores the Lua number at the given stack index into the array */
+static void set_value(lua_State* state, lua_array* array, size_t index, int value_index)
+{
+	if (lua_isinteger(state, value_index))
+	{
+		set_integer(array, index, lua_tointeger(state, value_index));
+	}
+	else if (lua_isboolean(state, value_index))
+	{
+		set_integer(array, index, lua_toboolean(state, value_index));
+	}
+	else
+	{
+		set_number(array, index, luaL_checknumber(state, value_index));
+	}
+}
+
+static void push_value(lua_State* state, const lua_array* array, size_t index)
+{
+	if (is_float_type(array->type))    { lua_pushnumber(state, luaArrayGet(array, index)); }
+	else                               { lua_pushinteger(state, get_integer(array, index)); }
+}
+
+
+/*
+ * =========================================================================
+ * C API
+ * =========================================================================
+ */
+
+extern "C"
+{
+	size_t luaArrayElementSize(lua_array_type type)
+	{
+		return array_type_sizes[type];
+	}
+
+	double luaArrayGet(const lua_array* array, size_t index)
+	{
+		switch (array->type)
+		{
+			case LUA_ARRAY_FLOAT32: return ((epicsFloat32*) array->data)[index];
+			case LUA_ARRAY_FLOAT64: return ((epicsFloat64*) array->data)[index];
+			case LUA_ARRAY_UINT64:  return (double) ((unsigned long long*) array->data)[index];
+			default:                return (double) get_integer(array, index);
+		}
+	}
+
+	/*
+	 * Changes the element count. Storage only grows, new elements
+	 * are zeroed. Returns 0 on success, -1 if allocation failed.
+	 */
+	int luaArrayResize(lua_array* array, size_t count)
+	{
+		size_t element = luaArrayElementSize(array->type);
+
+		if (count > array->capacity)
+		{
+			size_t capacity = array->capacity ? array->capacity : LUA_ARRAY_MIN_CAPACITY;
+
+			while (capacity < count)    { capacity *= 2; }
+
+			void* data = array->alloc(array->alloc_ud, array->data, array->capacity * element, capacity * element);
+
+			if (! data)    { return -1; }
+
+			array->data = data;
+			array->capacity = capacity;
+		}
+
+		if (count > array->count)
+		{
+			memset((char*) array->data + array->count * element, 0, (count - array->count) * element);
+		}
+
+		array->count = count;
+		return 0;
+	}
+
+	lua_array* luaTestArray(lua_State* state, int index)
+	{
+		return (lua_array*) luaL_testudata(state, index, LUA_ARRAY_META);
+	}
+
+	/*
+	 * Database request type for an array type, using the dbFldTypes.h
+	 * numbering accepted by dbGetField and dbPutField.
+	 */
+	short luaArrayDbType(lua_array_type type)
+	{
+		switch (type)
+		{
+			case LUA_ARRAY_INT8:    return DBR_CHAR;
+			case LUA_ARRAY_UINT8:   return DBR_UCHAR;
+			case LUA_ARRAY_INT16:   return DBR_SHORT;
+			case LUA_ARRAY_UINT16:  return DBR_USHORT;
+			case LUA_ARRAY_INT32:   return DBR_LONG;
+			case LUA_ARRAY_UINT32:  return DBR_ULONG;
+#if EPICS_VERSION_INT >= VERSION_INT(3, 16, 1, 0)
+			case LUA_ARRAY_INT64:   return DBR_INT64;
+			case LUA_ARRAY_UINT64:  return DBR_UINT64;
+#endif
+			case LUA_ARRAY_FLOAT32: return DBR_FLOAT;
+			case LUA_ARRAY_FLOAT64: return DBR_DOUBLE;
+			default:                return -1;
+		}
+	}
+
+	int luaArrayTypeForField(short field_type, lua_array_type* type)
+	{
+		switch (field_type)
+		{
+			case DBF_CHAR:   *type = LUA_ARRAY_INT8;    return 0;
+			case DBF_UCHAR:  *type = LUA_ARRAY_UINT8;   return 0;
+			case DBF_SHORT:  *type = LUA_ARRAY_INT16;   return 0;
+			case DBF_USHORT: *type = LUA_ARRAY_UINT16;  return 0;
+			case DBF_LONG:   *type = LUA_ARRAY_INT32;   return 0;
+			case DBF_ULONG:  *type = LUA_ARRAY_UINT32;  return 0;
+#if EPICS_VERSION_INT >= VERSION_INT(3, 16, 1, 0)
+			case DBF_INT64:  *type = LUA_ARRAY_INT64;   return 0;
+			case DBF_UINT64: *type = LUA_ARRAY_UINT64;  return 0;
+#endif
+			case DBF_FLOAT:  *type = LUA_ARRAY_FLOAT32; return 0;
+			case DBF_DOUBLE: *type = LUA_ARRAY_FLOAT64; return 0;
+			case DBF_ENUM:
+			case DBF_MENU:
+			case DBF_DEVICE: *type = LUA_ARRAY_UINT16;  return 0;
+			default:         return -1;
+		}
+	}
+
+	/*
+	 * Copies up to count elements into a buffer of the given database
+	 * field type, converting if the types differ. Returns the number
+	 * of elements copied, or -1 if the field type isn't numeric.
+	 */
+	long luaArrayCopyOut(const lua_array* array, void* bptr, short field_type, size_t count)
+	{
+		lua_array_type type;
+		size_t index;
+
+		if (luaArrayTypeForField(field_type, &type))    { return -1; }
+
+		if (count > array->count)    { count = array->count; }
+
+		if (type == array->type)
+		{
+			memcpy(bptr, array->data, count * luaArrayElementSize(type));
+			return (long) count;
+		}
+
+		lua_array output = { type, count, count, bptr, NULL, NULL };
+
+		for (index = 0; index < count; index++)
+		{
+			if (is_float_type(array->type))    { set_number(&output, index, luaArrayGet(array, index)); }
+			else                               { set_integer(&output, index, get_integer(array, index)); }
+		}
+
+		return (long) count;
+	}
+}
+
+static void array_metatable(lua_State* state);
+
+extern "C"
+{
+	/* Pushes a new zeroed array of count elements */
+	lua_array* luaNewArray(lua_State* state, lua_array_type type, size_t count)
+	{
+		lua_array* array = (lua_array*) lua_newuserdata(state, sizeof(lua_array));
+
+		array->type = type;
+		array->count = 0;
+		array->capacity = 0;
+		array->data = NULL;
+		array->alloc = lua_getallocf(state, &array->alloc_ud);
+
+		array_metatable(state);
+		lua_setmetatable(state, -2);
+
+		if (luaArrayResize(array, count))
+		{
+			luaL_error(state, "Unable to allocate array of %d elements", (int) count);
+		}
+
+		return array;
+	}
+}
+
+
+/*
+ * =========================================================================
+ * Methods
+ * =========================================================================
+ */
+
+static lua_array* check_array(lua_State* state, int index)
+{
+	return (lua_array*) luaL_checkudata(state, index, LUA_ARRAY_META);
+}
+
+/* array:slice(i [, j]) -- copy of elements i..j as a new array */
+static int l_array_slice(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	lua_Integer first = luaL_checkinteger(state, 2);
+	lua_Integer last = luaL_optinteger(state, 3, (lua_Integer) array->count);
+
+	if (first < 1)                               { first = 1; }
+	if (last > (lua_Integer) array->count)       { last = (lua_Integer) array->count; }
+
+	size_t count = (last >= first) ? (size_t) (last - first + 1) : 0;
+	size_t element = luaArrayElementSize(array->type);
+
+	lua_array* output = luaNewArray(state, array->type, count);
+
+	if (count)    { memcpy(output->data, (char*) array->data + (first - 1) * element, count * element); }
+
+	return 1;
+}
+
+static int l_array_sum(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	size_t index;
+
+	if (is_float_type(array->type))
+	{
+		double total = 0.0;
+		for (index = 0; index < array->count; index++)    { total += luaArrayGet(array, index); }
+		lua_pushnumber(state, total);
+	}
+	else
+	{
+		lua_Integer total = 0;
+		for (index = 0; index < array->count; index++)    { total += get_integer(array, index); }
+		lua_pushinteger(state, total);
+	}
+
+	return 1;
+}
+
+static int reduce_extreme(lua_State* state, int want_max)
+{
+	lua_array* array = check_array(state, 1);
+	size_t index, found = 0;
+
+	if (array->count == 0)    { lua_pushnil(state); return 1; }
+
+	if (is_float_type(array->type))
+	{
+		double best = luaArrayGet(array, 0);
+
+		for (index = 1; index < array->count; index++)
+		{
+			double value = luaArrayGet(array, index);
+			if (want_max ? (value > best) : (value < best))    { best = value; found = index; }
+		}
+	}
+	else
+	{
+		lua_Integer best = get_integer(array, 0);
+
+		for (index = 1; index < array->count; index++)
+		{
+			lua_Integer value = get_integer(array, index);
+			if (want_max ? (value > best) : (value < best))    { best = value; found = index; }
+		}
+	}
+
+	push_value(state, array, found);
+	lua_pushinteger(state, (lua_Integer) found + 1);
+	return 2;
+}
+
+static int l_array_min(lua_State* state)    { return reduce_extreme(state, 0); }
+static int l_array_max(lua_State* state)    { return reduce_extreme(state, 1); }
+
+static int l_array_mean(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	size_t index;
+	double total = 0.0;
+
+	if (array->count == 0)    { lua_pushnil(state); return 1; }
+
+	for (index = 0; index < array->count; index++)    { total += luaArrayGet(array, index); }
+
+	lua_pushnumber(state, total / array->count);
+	return 1;
+}
+
+static int l_array_fill(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	size_t index;
+
+	luaL_checkany(state, 2);
+
+	if (array->count == 0)    { lua_settop(state, 1); return 1; }
+
+	set_value(state, array, 0, 2);
+
+	size_t element = luaArrayElementSize(array->type);
+
+	for (index = 1; index < array->count; index++)
+	{
+		memcpy((char*) array->data + index * element, array->data, element);
+	}
+
+	lua_settop(state, 1);
+	return 1;
+}
+
+static int l_array_totable(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	size_t index;
+
+	lua_createtable(state, (int) array->count, 0);
+
+	for (index = 0; index < array->count; index++)
+	{
+		push_value(state, array, index);
+		lua_rawseti(state, -2, (lua_Integer) index + 1);
+	}
+
+	return 1;
+}
+
+static int l_array_resize(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	lua_Integer count = luaL_checkinteger(state, 2);
+
+	luaL_argcheck(state, count >= 0, 2, "negative array size");
+
+	if (luaArrayResize(array, (size_t) count))
+	{
+		return luaL_error(state, "Unable to allocate array of %d elements", (int) count);
+	}
+
+	lua_settop(state, 1);
+	return 1;
+}
+
+
+/*
+ * =========================================================================
+ * Metamethods
+ * =========================================================================
+ */
+
+static int l_array_index(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+
+	if (lua_isinteger(state, 2))
+	{
+		lua_Integer index = lua_tointeger(state, 2);
+
+		if (index < 1 || index > (lua_Integer) array->count)    { return 0; }
+
+		push_value(state, array, (size_t) index - 1);
+		return 1;
+	}
+
+	const char* key = lua_tostring(state, 2);
+
+	if (! key)    { return 0; }
+
+	if (strcmp(key, "type") == 0)       { lua_pushstring(state, array_type_names[array->type]); return 1; }
+
+	if (strcmp(key, "slice") == 0)      { lua_pushcfunction(state, l_array_slice); return 1; }
+	if (strcmp(key, "sum") == 0)        { lua_pushcfunction(state, l_array_sum); return 1; }
+	if (strcmp(key, "min") == 0)        { lua_pushcfunction(state, l_array_min); return 1; }
+	if (strcmp(key, "max") == 0)        { lua_pushcfunction(state, l_array_max); return 1; }
+	if (strcmp(key, "mean") == 0)       { lua_pushcfunction(state, l_array_mean); return 1; }
+	if (strcmp(key, "fill") == 0)       { lua_pushcfunction(state, l_array_fill); return 1; }
+	if (strcmp(key, "totable") == 0)    { lua_pushcfunction(state, l_array_totable); return 1; }
+	if (strcmp(key, "resize") == 0)     { lua_pushcfunction(state, l_array_resize); return 1; }
+
+	return 0;
+}
+
+static int l_array_newindex(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+	lua_Integer index = luaL_checkinteger(state, 2);
+
+	if (index < 1 || index > (lua_Integer) array->count)
+	{
+		return luaL_error(state, "Array index %d out of range (1-%d)", (int) index, (int) array->count);
+	}
+
+	set_value(state, array, (size_t) index - 1, 3);
+	return 0;
+}
+
+static int l_array_len(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+
+	lua_pushinteger(state, (lua_Integer) array->count);
+	return 1;
+}
+
+static int l_array_tostring(lua_State* state)
+{
+	lua_array* array = check_array(state, 1);
+
+	lua_pushfstring(state, "epics.array(%s, %d)", array_type_names[array->type], (int) array->count);
+	return 1;
+}
+
+static int l_array_gc(lua_State* state)
+{
+	lua_array* array = (lua_array*) lua_touserdata(state, 1);
+
+	if (array && array->data)
+	{
+		array->alloc(array->alloc_ud, array->data, array->capacity * luaArrayElementSize(array->type), 0);
+		array->data = NULL;
+		array->count = 0;
+		array->capacity = 0;
+	}
+
+	return 0;
+}
+
+/* Pushes the array metatable, creating it the first time it's used in a state */
+static void array_metatable(lua_State* state)
+{
+	if (luaL_newmetatable(state, LUA_ARRAY_META))
+	{
+		lua_pushcfunction(state, l_array_index);
+		lua_setfield(state, -2, "__index");
+		lua_pushcfunction(state, l_array_newindex);
+		lua_setfield(state, -2, "__newindex");
+		lua_pushcfunction(state, l_array_len);
+		lua_setfield(state, -2, "__len");
+		lua_pushcfunction(state, l_array_gc);
+		lua_setfield(state, -2, "__gc");
+		lua_pushcfunction(state, l_array_tostring);
+		lua_setfield(state, -2, "__tostring");
+		lua_pushstring(state, "epics.array");
+		lua_setfield(state, -2, "__name");
+
+		/* Documentation for info(array_object) */
+		lua_newtable(state);
+		lua_pushstring(state, "[i], [i] = v     -- element access, 1-based"); lua_rawseti(state, -2, 1);
+		lua_pushstring(state, "#array           -- element count"); lua_rawseti(state, -2, 2);
+		lua_pushstring(state, ".type            -- element type name (property)"); lua_rawseti(state, -2, 3);
+		lua_pushstring(state, ":slice(i [, j])  -- copy of elements i..j"); lua_rawseti(state, -2, 4);
+		lua_pushstring(state, ":sum(), :mean()  -- reductions"); lua_rawseti(state, -2, 5);
+		lua_pushstring(state, ":min(), :max()   -- value and index of the extreme"); lua_rawseti(state, -2, 6);
+		lua_pushstring(state, ":fill(v)         -- set every element"); lua_rawseti(state, -2, 7);
+		lua_pushstring(state, ":resize(n)       -- change the element count"); lua_rawseti(state, -2, 8);
+		lua_pushstring(state, ":totable()       -- convert to a Lua table"); lua_rawseti(state, -2, 9);
+		lua_setfield(state, -2, "_doc");
+	}
+}
+
+
+/*
+ * =========================================================================
+ * Constructor: epics.array([type,] count | table | array)
+ * =========================================================================
+ */
+
+extern "C"
+{
+	int luaArrayConstructor(lua_State* state)
+	{
+		lua_array_type type = LUA_ARRAY_FLOAT64;
+		int source = 1;
+
+		if (lua_type(state, 1) == LUA_TSTRING)
+		{
+			type = (lua_array_type) luaL_checkoption(state, 1, NULL, array_type_names);
+			source = 2;
+		}
+
+		lua_array* other = luaTestArray(state, source);
+
+		if (other)
+		{
+			lua_array* array = luaNewArray(state, type, other->count);
+			size_t index;
+
+			for (index = 0; index < other->count; index++)
+			{
+				if (is_float_type(other->type))    { set_number(array, index, luaArrayGet(other, index)); }
+				else                               { set_integer(array, index, get_integer(other, index)); }
+			}
+
+			return 1;
+		}
+
+		if (lua_istable(state, source))
+		{
+			size_t count = (size_t) lua_rawlen(state, source);
+			size_t index;
+
+			lua_array* array = luaNewArray(state, type, count);
+
+			for (index = 0; index < count; index++)
+			{
+				lua_rawgeti(state, source, (lua_Integer) index + 1);
+				set_value(state, array, index, -1);
+				lua_pop(state, 1);
+			}
+
+			return 1;
+		}
+
+		lua_Integer count = luaL_optinteger(state, source, 0);
+
+		luaL_argcheck(state, count >= 0, source, "negative array size");
+
+		luaNewArray(state, type, (size_t) count);
+		return 1;
+	}
+}
@@ -4,8 +4,12 @@
 #include <errlog.h>
 #include "stdio.h"
 #include <cstring>
+#include <cstdlib>
 #include <string>
 #include <sstream>
+#include <map>
+#include <set>
+#include <vector>
 #include <epicsExport.h>
 #include "lasynlib.h"
 
@@ -29,29 +33,99 @@ static asynPortDriver* find_driver(const char* port_name)
 	return NULL;
 }
 
-static int asyn_read(lua_State* state, asynOctetClient* port)
+/* Longest reply a read or writeread collects, unless a client sets MaxReply */
+int luaAsynMaxReply = 65536;
+
+#define REPLY_INITIAL_SIZE  256
+
+/*
+ * Receive buffer for octet reads. It grows by doubling while replies
+ * keep filling it, up to limit bytes, and is kept between reads by
+ * clients. Replies are pushed with their length, so they may hold NULs.
+ */
+typedef struct {
+	char*  data;
+	size_t size;
+	size_t limit;
+	bool   scratch;    /* freed after the transfer */
+} ReplyBuffer;
+
+static size_t replyLimit(void)
+{
+	return luaAsynMaxReply > 0 ? (size_t) luaAsynMaxReply : REPLY_INITIAL_SIZE;
+}
+
+static bool growReply(ReplyBuffer* reply)
+{
+	size_t size = reply->size ? reply->size * 2 : REPLY_INITIAL_SIZE;
+
+	if (size > reply->limit)    { size = reply->limit; }
+	if (size <= reply->size)    { return false; }
+
+	char* data = (char*) realloc(reply->data, size);
+
+	if (! data)    { return false; }
+
+	reply->data = data;
+	reply->size = size;
+
+	return true;
+}
+
+static void releaseReply(ReplyBuffer* reply)
+{
+	if (! reply->scratch)    { return; }
+
+	free(reply->data);
+	reply->data = NULL;
+	reply->size = 0;
+}
+
+/*
+ * Writes data first if there is any, then reads until the reply ends
+ * with something other than a full buffer (ASYN_EOM_CNT) or reaches
+ * the buffer's limit. Anything past the limit is left for the next read.
+ * Errors after the first read just end the reply; the next call sees them.
+ */
+static int asyn_transfer(lua_State* state, asynOctetClient* client, const char* data, size_t len, ReplyBuffer* reply)
 {
 	char errbuf[256] = { '\0' };
+	size_t received = 0;
 
+	if (! reply->data && ! growReply(reply))
+	{
+		strncpy(errbuf, "Unable to allocate receive buffer", sizeof(errbuf) - 1);
+	}
+	else
 	{
 		try
 		{
-			std::string output;
-			char buffer[128];
+			size_t numwrite, numread = 0;
+			size_t request = reply->size < reply->limit ? reply->size : reply->limit;
+			int eomReason = 0;
+
+			if (data)    { client->writeRead(data, len, reply->data, request, &numwrite, &numread, &eomReason); }
+			else         { client->read(reply->data, request, &numread, &eomReason); }
 
-			size_t numread;
-			int eomReason;
+			received = numread;
 
-			do
+			while ((eomReason & ASYN_EOM_CNT) && received < reply->limit)
 			{
-				port->read(buffer, sizeof(buffer), &numread, &eomReason);
-				output += std::string(buffer, numread);
-			} while (eomReason & ASYN_EOM_CNT);
-
-			if (! output.empty())
-			{ 
-				lua_pushstring(state, output.c_str());
-				return 1;
+				if (received >= reply->size && ! growReply(reply))    { break; }
+
+				request = (reply->size < reply->limit ? reply->size : reply->limit) - received;
+
+				/* A reply that exactly filled the last read ends with a timeout here */
+				try
+				{
+					client->read(reply->data + received, request, &numread, &eomReason);
+				}
+				catch (std::runtime_error&)
+				{
+					break;
+				}
+
+				received += numread;
 			}
 		}
 		catch (std::runtime_error& e)
@@ -60,16 +134,28 @@ static int asyn_read(lua_State* state, asynOctetClient* port)
 		}
 		catch (...)
 		{
-			strncpy(errbuf, "Unexpected exception while reading", sizeof(errbuf) - 1);
+			strncpy(errbuf, data ? "Unexpected exception during writeread" : "Unexpected exception while reading", sizeof(errbuf) - 1);
 		}
 	}
 
+	if (! errbuf[0])
+	{
+		if (received)    { lua_pushlstring(state, reply->data, received); }
+		else             { lua_pushnil(state); }
+	}
+
+	releaseReply(reply);
+
 	if (errbuf[0])    { return luaL_error(state, "%s", errbuf); }
 
-	lua_pushnil(state);
 	return 1;
 }
 
+static int asyn_read(lua_State* state, asynOctetClient* port, ReplyBuffer* reply)
+{
+	return asyn_transfer(state, port, NULL, 0, reply);
+}
+
 static int asyn_write(lua_State* state, asynOctetClient* port, const char* data, size_t len)
 {
 	char errbuf[256] = { '\0' };
@@ -93,47 +179,9 @@ static int asyn_write(lua_State* state, asynOctetClient* port, const char* data,
 	return 0;
 }
 
-static int asyn_writeread(lua_State* state, asynOctetClient* client, const char* data, size_t len)
+static int asyn_writeread(lua_State* state, asynOctetClient* client, const char* data, size_t len, ReplyBuffer* reply)
 {
-	char errbuf[256] = { '\0' };
-
-	{
-		try
-		{
-			std::string output;
-			size_t numwrite, numread;
-			char buffer[256];
-			int eomReason;
-
-			client->writeRead(data, len, buffer, sizeof(buffer), &numwrite, &numread, &eomReason);
-			output += std::string(buffer, numread);
-			
-			while (eomReason & ASYN_EOM_CNT)
-			{
-				client->read(buffer, sizeof(buffer), &numread, &eomReason);
-				output += std::string(buffer, numread);
-			}
-			
-			if (! output.empty())
-			{ 
-				lua_pushstring(state, output.c_str());
-				return 1;
-			}
-		}
-		catch (std::runtime_error& e)
-		{
-			strncpy(errbuf, e.what(), sizeof(errbuf) - 1);
-		}
-		catch (...)
-		{
-			strncpy(errbuf, "Unexpected exception during writeread", sizeof(errbuf) - 1);
-		}
-	}
-
-	if (errbuf[0])    { return luaL_error(state, "%s", errbuf); }
-
-	lua_pushnil(state);
-	return 1;
+	return asyn_transfer(state, client, data, len, reply);
 }
 
 static int l_read(lua_State* state)
@@ -159,14 +207,17 @@ static int l_read(lua_State* state)
 	if (isnum)    { input.setTimeout(timeout); }
 	if (in_term)  { input.setInputEos(in_term, strlen(in_term)); }
 
-	return asyn_read(state, &input);
+	ReplyBuffer reply = { NULL, 0, replyLimit(), true };
+
+	return asyn_read(state, &input, &reply);
 }
 
 static int l_write(lua_State* state)
 {
 	lua_settop(state, 4);
 
-	const char* data = luaL_checkstring(state, 1);
+	size_t len;
+	const char* data = luaL_checklstring(state, 1, &len);
 	const char* port = luaL_checkstring(state, 2);
 	int addr = (int) lua_tonumber(state, 3);
 	const char* param = lua_tostring(state, 4);
@@ -186,14 +237,15 @@ static int l_write(lua_State* state)
 	if (isnum)       { output.setTimeout(timeout); }
 	if (out_term)    { output.setOutputEos(out_term, strlen(out_term)); }
 	
-	return asyn_write(state, &output, data, strlen(data));
+	return asyn_write(state, &output, data, len);
 }
 
 static int l_writeread(lua_State* state)
 {
 	lua_settop(state, 4);
 
-	const char* data = luaL_checkstring(state, 1);
+	size_t len;
+	const char* data = luaL_checklstring(state, 1, &len);
 	const char* port = luaL_checkstring(state, 2);
 	int addr = (int) lua_tonumber(state, 3);
 	const char* param = lua_tostring(state, 4);
@@ -218,7 +270,9 @@ static int l_writeread(lua_State* state)
 	if (out_term)    { client.setOutputEos(out_term, strlen(out_term)); }
 	if (in_term)     { client.setInputEos(in_term, strlen(in_term)); }
 
-	return asyn_writeread(state, &client, data, strlen(data));
+	ReplyBuffer reply = { NULL, 0, replyLimit(), true };
+
+	return asyn_writeread(state, &client, data, len, &reply);
 }
 
 static int l_setOption(lua_State* state)
@@ -334,12 +388,13 @@ static int asyn_writeparam(lua_State* state, asynPortDriver* port, int addr, con
 		
 		case asynParamOctet:
 		{
-			const char* data = lua_tostring(state, val_index);
+			size_t len;
+			const char* data = lua_tolstring(state, val_index, &len);
 			
 			asynOctet* inter = (asynOctet*) interfaces->octet.pinterface;
 			
 			size_t num_trans;
-			inter->write(port, pasynuser, data, strlen(data), &num_trans);
+			inter->write(port, pasynuser, data, len, &num_trans);
 			break;
 		}
 		
@@ -431,6 +486,114 @@ static int asyn_readparam(lua_State* state, asynPortDriver* port, int addr, cons
 	return result;
 }
 
+/* The epics.array element type of an asyn array parameter type */
+static bool arrayTypeFor(asynParamType ptype, lua_array_type* type)
+{
+	switch (ptype)
+	{
+		case asynParamInt8Array:    *type = LUA_ARRAY_INT8;    return true;
+		case asynParamInt16Array:   *type = LUA_ARRAY_INT16;   return true;
+		case asynParamInt32Array:   *type = LUA_ARRAY_INT32;   return true;
+		case asynParamFloat64Array: *type = LUA_ARRAY_FLOAT64; return true;
+		default:                    return false;
+	}
+}
+
+/* Pushes count elements of data as a new epics.array */
+void luaAsynPushArray(lua_State* state, const void* data, lua_array_type type, size_t count)
+{
+	lua_array* array = luaNewArray(state, type, count);
+
+	if (count)    { memcpy(array->data, data, count * luaArrayElementSize(type)); }
+}
+
+/* Copies up to count elements of the epics.array or table at index into data, returns the number copied */
+size_t luaAsynPullArray(lua_State* state, int index, void* data, lua_array_type type, size_t count)
+{
+	index = lua_absindex(state, index);
+
+	lua_array* array = luaTestArray(state, index);
+
+	if (array)
+	{
+		long copied = luaArrayCopyOut(array, data, luaArrayDbType(type), count);
+		return copied > 0 ? (size_t) copied : 0;
+	}
+
+	if (! lua_istable(state, index))    { return 0; }
+
+	size_t length = lua_rawlen(state, index);
+
+	if (length < count)    { count = length; }
+
+	for (size_t i = 0; i < count; i++)
+	{
+		lua_rawgeti(state, index, i + 1);
+		lua_Number value = lua_tonumber(state, -1);
+		lua_pop(state, 1);
+
+		switch (type)
+		{
+			case LUA_ARRAY_INT8:    ((epicsInt8*)    data)[i] = (epicsInt8)    value; break;
+			case LUA_ARRAY_INT16:   ((epicsInt16*)   data)[i] = (epicsInt16)   value; break;
+			case LUA_ARRAY_INT32:   ((epicsInt32*)   data)[i] = (epicsInt32)   value; break;
+			case LUA_ARRAY_FLOAT64: ((epicsFloat64*) data)[i] = (epicsFloat64) value; break;
+			default:                return i;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Sends the array at val_index to the I/O Intr clients of an array
+ * parameter. asynPortDriver doesn't store arrays, so this is all that
+ * setting an array parameter does. An epics.array of the parameter's
+ * own type is passed to asyn without copying.
+ */
+static void asyn_arraycallbacks(lua_State* state, asynPortDriver* driver, int addr, int index, int val_index)
+{
+	asynParamType ptype;
+	lua_array_type type;
+
+	driver->getParamType(addr, index, &ptype);
+
+	if (! arrayTypeFor(ptype, &type))    { luaL_error(state, "Parameter %d is not an array parameter", index); }
+
+	val_index = lua_absindex(state, val_index);
+
+	lua_array* array = luaTestArray(state, val_index);
+
+	luaL_argexpected(state, array || lua_istable(state, val_index), val_index, "epics.array or table");
+
+	void* data;
+	size_t count;
+
+	if (array && array->type == type)
+	{
+		data = array->data;
+		count = array->count;
+		lua_pushnil(state);
+	}
+	else
+	{
+		count = array ? array->count : lua_rawlen(state, val_index);
+		data = lua_newuserdatauv(state, count * luaArrayElementSize(type) + 1, 0);
+		count = luaAsynPullArray(state, val_index, data, type, count);
+	}
+
+	switch (ptype)
+	{
+		case asynParamInt8Array:    driver->doCallbacksInt8Array((epicsInt8*) data, count, index, addr);       break;
+		case asynParamInt16Array:   driver->doCallbacksInt16Array((epicsInt16*) data, count, index, addr);     break;
+		case asynParamInt32Array:   driver->doCallbacksInt32Array((epicsInt32*) data, count, index, addr);     break;
+		case asynParamFloat64Array: driver->doCallbacksFloat64Array((epicsFloat64*) data, count, index, addr); break;
+		default:                    break;
+	}
+
+	lua_pop(state, 1);
+}
+
 /*
  * Core helpers for parameter get/set by index.
  * These are the single source of truth for the Int32/Float64/Octet
@@ -463,9 +626,25 @@ static int asyn_pushparam(lua_State* state, asynPortDriver* driver, int addr, in
 		{
 			std::string val;
 			driver->getStringParam(addr, index, val);
-			lua_pushstring(state, val.c_str());
+			lua_pushlstring(state, val.data(), val.size());
+			return 1;
+		}
+		case asynParamUInt32Digital:
+		{
+			epicsUInt32 val;
+			driver->getUIntDigitalParam(addr, index, &val, 0xFFFFFFFF);
+			lua_pushinteger(state, val);
+			return 1;
+		}
+#ifdef LUA_ASYN_INT64
+		case asynParamInt64:
+		{
+			epicsInt64 val;
+			driver->getInteger64Param(addr, index, &val);
+			lua_pushinteger(state, val);
 			return 1;
 		}
+#endif
 		default:
 			return 0;
 	}
@@ -488,6 +667,20 @@ static void asyn_pullparam(lua_State* state, asynPortDriver* driver, int addr, i
 		case asynParamOctet:
 			driver->setStringParam(addr, index, luaL_checkstring(state, val_index));
 			break;
+		case asynParamUInt32Digital:
+			driver->setUIntDigitalParam(addr, index, (epicsUInt32) luaL_checkinteger(state, val_index), 0xFFFFFFFF);
+			break;
+#ifdef LUA_ASYN_INT64
+		case asynParamInt64:
+			driver->setInteger64Param(addr, index, (epicsInt64) luaL_checkinteger(state, val_index));
+			break;
+#endif
+		case asynParamInt8Array:
+		case asynParamInt16Array:
+		case asynParamInt32Array:
+		case asynParamFloat64Array:
+			asyn_arraycallbacks(state, driver, addr, index, val_index);
+			break;
 		default:
 			break;
 	}
@@ -766,6 +959,7 @@ typedef struct {
 	int addr;
 	double readTimeout;
 	double writeTimeout;
+	ReplyBuffer reply;
 } ClientUD;
 
 static ClientUD* check_clientud(lua_State* state, int idx)
@@ -783,6 +977,12 @@ static int l_client_gc(lua_State* state)
 		delete ud->client;
 		ud->client = NULL;
 	}
+	if (ud)
+	{
+		free(ud->reply.data);
+		ud->reply.data = NULL;
+		ud->reply.size = 0;
+	}
 	return 0;
 }
 
@@ -795,23 +995,25 @@ static int l_client_read(lua_State* state)
 {
 	ClientUD* ud = check_clientud(state, 1);
 	ud->client->setTimeout(ud->readTimeout);
-	return asyn_read(state, ud->client);
+	return asyn_read(state, ud->client, &ud->reply);
 }
 
 static int l_client_write(lua_State* state)
 {
 	ClientUD* ud = check_clientud(state, 1);
-	const char* data = luaL_checkstring(state, 2);
+	size_t len;
+	const char* data = luaL_checklstring(state, 2, &len);
 	ud->client->setTimeout(ud->writeTimeout);
-	return asyn_write(state, ud->client, data, strlen(data));
+	return asyn_write(state, ud->client, data, len);
 }
 
 static int l_client_writeread(lua_State* state)
 {
 	ClientUD* ud = check_clientud(state, 1);
-	const char* data = luaL_checkstring(state, 2);
+	size_t len;
+	const char* data = luaL_checklstring(state, 2, &len);
 	ud->client->setTimeout(ud->readTimeout);
-	return asyn_writeread(state, ud->client, data, strlen(data));
+	return asyn_writeread(state, ud->client, data, len, &ud->reply);
 }
 
 static int l_client_flush(lua_State* state)
@@ -919,6 +1121,7 @@ static int l_client_index(lua_State* state)
 	/* Timeouts */
 	if (strcmp(key, "ReadTimeout") == 0)  { lua_pushnumber(state, ud->readTimeout); return 1; }
 	if (strcmp(key, "WriteTimeout") == 0) { lua_pushnumber(state, ud->writeTimeout); return 1; }
+	if (strcmp(key, "MaxReply") == 0)     { lua_pushinteger(state, ud->reply.limit); return 1; }
 
 	/* Terminators */
 	if (strcmp(key, "InTerminator") == 0)
@@ -965,6 +1168,12 @@ static int l_client_newindex(lua_State* state)
 	{
 		ud->writeTimeout = luaL_checknumber(state, 3);
 	}
+	else if (strcmp(key, "MaxReply") == 0)
+	{
+		lua_Integer limit = luaL_checkinteger(state, 3);
+		luaL_argcheck(state, limit > 0, 3, "MaxReply must be positive");
+		ud->reply.limit = (size_t) limit;
+	}
 
 	return 0;
 }
@@ -979,6 +1188,10 @@ static void push_clientproxy(lua_State* state, const char* portName, int addr, c
 	ud->addr = addr;
 	ud->readTimeout = DEFAULT_TIMEOUT;
 	ud->writeTimeout = DEFAULT_TIMEOUT;
+	ud->reply.data = NULL;
+	ud->reply.size = 0;
+	ud->reply.limit = replyLimit();
+	ud->reply.scratch = false;
 
 	{
 		char errbuf[256] = { '\0' };
@@ -1018,14 +1231,15 @@ static void push_clientproxy(lua_State* state, const char* portName, int addr, c
 		lua_pushstring(state, ".OutTerminator              -- get/set output terminator"); lua_rawseti(state, -2, 4);
 		lua_pushstring(state, ".ReadTimeout                -- get/set read timeout (seconds)"); lua_rawseti(state, -2, 5);
 		lua_pushstring(state, ".WriteTimeout               -- get/set write timeout (seconds)"); lua_rawseti(state, -2, 6);
-		lua_pushstring(state, ":read()"); lua_rawseti(state, -2, 7);
-		lua_pushstring(state, ":write(data)"); lua_rawseti(state, -2, 8);
-		lua_pushstring(state, ":writeread(data)"); lua_rawseti(state, -2, 9);
-		lua_pushstring(state, ":flush()"); lua_rawseti(state, -2, 10);
-		lua_pushstring(state, ":trace(mask) -- error=0x1, device=0x2, filter=0x4, driver=0x8, flow=0x10, warning=0x20"); lua_rawseti(state, -2, 11);
-		lua_pushstring(state, ":traceio(mask) -- nodata=0x0, ascii=0x1, escape=0x2, hex=0x4"); lua_rawseti(state, -2, 12);
-		lua_pushstring(state, ":setOption(key, val)"); lua_rawseti(state, -2, 13);
-		lua_pushstring(state, "[addr]                      -- index by address"); lua_rawseti(state, -2, 14);
+		lua_pushstring(state, ".MaxReply                   -- get/set longest reply read (bytes)"); lua_rawseti(state, -2, 7);
+		lua_pushstring(state, ":read()"); lua_rawseti(state, -2, 8);
+		lua_pushstring(state, ":write(data)"); lua_rawseti(state, -2, 9);
+		lua_pushstring(state, ":writeread(data)"); lua_rawseti(state, -2, 10);
+		lua_pushstring(state, ":flush()"); lua_rawseti(state, -2, 11);
+		lua_pushstring(state, ":trace(mask) -- error=0x1, device=0x2, filter=0x4, driver=0x8, flow=0x10, warning=0x20"); lua_rawseti(state, -2, 12);
+		lua_pushstring(state, ":traceio(mask) -- nodata=0x0, ascii=0x1, escape=0x2, hex=0x4"); lua_rawseti(state, -2, 13);
+		lua_pushstring(state, ":setOption(key, val)"); lua_rawseti(state, -2, 14);
+		lua_pushstring(state, "[addr]                      -- index by address"); lua_rawseti(state, -2, 15);
 		lua_setfield(state, -2, "_doc");
 	}
 	lua_setmetatable(state, -2);
@@ -1064,56 +1278,182 @@ static int l_client_call(lua_State* state)
 
 #include <epicsMutex.h>
 #include <epicsGuard.h>
+#include <epicsThread.h>
+
+/*
+ * Parameter updates made inside drv:batch(), or between drv:begin() and
+ * drv:commit(), only mark their address as dirty. The outermost commit
+ * then issues one callParamCallbacks per dirty address. Batches are kept
+ * per driver and calling thread, so every proxy for the same port shares
+ * them, but sets made by other threads meanwhile are sent right away.
+ */
+typedef struct {
+	int           depth;
+	std::set<int> dirty;
+} ParamBatch;
+
+typedef std::pair<asynPortDriver*, epicsThreadId> BatchKey;
+
+static std::map<BatchKey, ParamBatch> param_batches;
+static epicsMutex paramBatchMutex;
+
+/* Runs the callbacks for addr now, or at commit if this thread has a batch open */
+static void paramChanged(asynPortDriver* driver, int addr)
+{
+	{
+		epicsGuard<epicsMutex> guard(paramBatchMutex);
+
+		std::map<BatchKey, ParamBatch>::iterator it = param_batches.find(BatchKey(driver, epicsThreadGetIdSelf()));
+
+		if (it != param_batches.end())
+		{
+			it->second.dirty.insert(addr);
+			return;
+		}
+	}
+
+	driver->callParamCallbacks(addr);
+}
+
+static void beginBatch(asynPortDriver* driver)
+{
+	epicsGuard<epicsMutex> guard(paramBatchMutex);
+	param_batches[BatchKey(driver, epicsThreadGetIdSelf())].depth++;
+}
+
+/* Returns false if this thread has no batch open on the driver */
+static bool commitBatch(asynPortDriver* driver)
+{
+	std::set<int> dirty;
+
+	{
+		epicsGuard<epicsMutex> guard(paramBatchMutex);
+
+		std::map<BatchKey, ParamBatch>::iterator it = param_batches.find(BatchKey(driver, epicsThreadGetIdSelf()));
+
+		if (it == param_batches.end())    { return false; }
+		if (--it->second.depth > 0)       { return true; }
+
+		dirty.swap(it->second.dirty);
+		param_batches.erase(it);
+	}
+
+	for (std::set<int>::iterator it = dirty.begin(); it != dirty.end(); it++)
+	{
+		driver->callParamCallbacks(*it);
+	}
+
+	return true;
+}
 
 /*
  * luaAsynPortDriver: a self-contained asynPortDriver subclass for the
- * asyn.driver.new() API. Read/write callbacks are stored as Lua function
- * references in the registry, keyed by parameter index.
+ * asyn.driver.new() API. Read/write callbacks are stored as registry
+ * references in one array per direction, indexed by parameter, so a
+ * callback is found with a single lua_rawgeti.
  *
  * This is independent of the luaPortDriver class used by the old
  * param DSL / luaPortDriver() iocsh command.
  */
+
+/*
+ * Every luaAsynPortDriver created in the same Lua state runs its code
+ * under one lock, so drivers with threads of their own can't use the
+ * state at once. Drivers are never destroyed, so neither are the locks.
+ */
+static std::map<lua_State*, epicsMutex*> state_locks;
+static epicsMutex stateLocksMutex;
+
+/* The state's main thread, which outlives any coroutine that calls in */
+static lua_State* mainThread(lua_State* state)
+{
+	lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	lua_State* main = lua_tothread(state, -1);
+	lua_pop(state, 1);
+
+	return main;
+}
+
+static epicsMutex& stateLock(lua_State* state)
+{
+	epicsGuard<epicsMutex> guard(stateLocksMutex);
+
+	/* Coroutines of a state share its lock */
+	epicsMutex*& lock = state_locks[mainThread(state)];
+
+	if (! lock)    { lock = new epicsMutex(); }
+
+	return *lock;
+}
+
 class luaAsynPortDriver : public asynPortDriver
 {
 public:
 	lua_State* state;
-	epicsMutex stateMutex;
-	int funcTableRef;
+	epicsMutex& stateMutex;
 	int selfRef;
 
-	luaAsynPortDriver(const char* portName, lua_State* luaState)
-		: asynPortDriver(portName, 1,
-			asynInt32Mask | asynFloat64Mask | asynOctetMask | asynDrvUserMask,
-			asynInt32Mask | asynFloat64Mask | asynOctetMask,
-			0, 1, 0, 0),
+	/* Registry references of the bound callbacks, LUA_NOREF if unbound */
+	std::vector<int> readRefs;
+	std::vector<int> writeRefs;
+
+	luaAsynPortDriver(const char* portName, lua_State* luaState, int maxAddr, int asynFlags, int priority, int stackSize)
+		: asynPortDriver(portName, maxAddr,
+			LUA_ASYN_INTERFACES | asynDrvUserMask,
+			LUA_ASYN_INTERFACES,
+			asynFlags, 1, priority, stackSize),
 		  state(luaState),
-		  funcTableRef(LUA_NOREF),
+		  stateMutex(stateLock(luaState)),
 		  selfRef(LUA_NOREF)
 	{
-		lua_newtable(state);
-		funcTableRef = luaL_ref(state, LUA_REGISTRYINDEX);
 	}
 
 	~luaAsynPortDriver() {}
 
-private:
-	void getFunction(int index, const char* direction)
+	/*
+	 * Pushes the callback bound to a parameter onto the
+	 * driver's state, or nil if there isn't one.
+	 */
+	void pushFunction(const std::vector<int>& refs, int index)
 	{
-		lua_rawgeti(this->state, LUA_REGISTRYINDEX, this->funcTableRef);
-		lua_geti(this->state, -1, index);
-		lua_remove(this->state, -2);
-		if (!lua_isnil(this->state, -1))
+		if (index < 0 || index >= (int) refs.size() || refs[index] == LUA_NOREF)
 		{
-			lua_getfield(this->state, -1, direction);
-			lua_remove(this->state, -2);
+			lua_pushnil(this->state);
+			return;
 		}
+
+		lua_rawgeti(this->state, LUA_REGISTRYINDEX, refs[index]);
+	}
+
+	/*
+	 * Pops the function on top of the driver's state and
+	 * binds it to a parameter, releasing any earlier one.
+	 */
+	void bindFunction(std::vector<int>& refs, int index)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+
+		if (index >= (int) refs.size())    { refs.resize(index + 1, LUA_NOREF); }
+
+		luaL_unref(this->state, LUA_REGISTRYINDEX, refs[index]);
+		refs[index] = luaL_ref(this->state, LUA_REGISTRYINDEX);
+	}
+
+private:
+
+	int address(asynUser* pasynUser)
+	{
+		int addr = 0;
+		this->getAddress(pasynUser, &addr);
+		return addr;
 	}
 
-	int callRead()
+	int callRead(int addr)
 	{
-		/* Push self (driver proxy) */
+		/* Push self (driver proxy) and the address */
 		lua_rawgeti(this->state, LUA_REGISTRYINDEX, this->selfRef);
-		int status = lua_pcall(this->state, 1, 1, 0);
+		lua_pushinteger(this->state, addr);
+		int status = luaTimedCall(this->state, 2, 1, 0);
 		if (status)
 		{
 			errlogPrintf("%s\n", lua_tostring(this->state, -1));
@@ -1122,11 +1462,13 @@ private:
 		return status;
 	}
 
-	int callWrite()
+	int callWrite(int addr, int extra = 0)
 	{
-		/* value is already on stack, push self */
+		/* value (and any extra arguments) are already on the stack, insert self and addr after value */
 		lua_rawgeti(this->state, LUA_REGISTRYINDEX, this->selfRef);
-		int status = lua_pcall(this->state, 2, 0, 0);
+		lua_pushinteger(this->state, addr);
+		lua_rotate(this->state, -(extra + 2), 2);
+		int status = luaTimedCall(this->state, 3 + extra, 0, 0);
 		if (status)
 		{
 			errlogPrintf("%s\n", lua_tostring(this->state, -1));
@@ -1135,17 +1477,52 @@ private:
 		return status;
 	}
 
+	/*
+	 * Runs the read callback of an array parameter and copies its
+	 * result into value. Returns false if there is no callback.
+	 */
+	bool readArray(asynUser* pasynUser, void* value, lua_array_type type, size_t nElements, size_t* nIn, asynStatus* status)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+		this->pushFunction(this->readRefs, pasynUser->reason);
+		if (lua_isnil(this->state, -1))
+		{
+			lua_pop(this->state, 1);
+			return false;
+		}
+		*nIn = 0;
+		*status = asynSuccess;
+		if (this->callRead(this->address(pasynUser)))    { *status = asynError; return true; }
+		*nIn = luaAsynPullArray(this->state, -1, value, type, nElements);
+		lua_pop(this->state, 1);
+		return true;
+	}
+
+	bool writeArray(asynUser* pasynUser, const void* value, lua_array_type type, size_t nElements, asynStatus* status)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+		this->pushFunction(this->writeRefs, pasynUser->reason);
+		if (lua_isnil(this->state, -1))
+		{
+			lua_pop(this->state, 1);
+			return false;
+		}
+		luaAsynPushArray(this->state, value, type, nElements);
+		*status = this->callWrite(this->address(pasynUser)) ? asynError : asynSuccess;
+		return true;
+	}
+
 public:
 	asynStatus readInt32(asynUser* pasynUser, epicsInt32* value)
 	{
 		epicsGuard<epicsMutex> guard(this->stateMutex);
-		this->getFunction(pasynUser->reason, "read");
+		this->pushFunction(this->readRefs, pasynUser->reason);
 		if (lua_isnil(this->state, -1))
 		{
 			lua_pop(this->state, 1);
 			return asynPortDriver::readInt32(pasynUser, value);
 		}
-		if (this->callRead()) return asynError;
+		if (this->callRead(this->address(pasynUser))) return asynError;
 		if (!lua_isnil(this->state, -1))
 		{
 			*value = lua_tointeger(this->state, -1);
@@ -1157,27 +1534,94 @@ public:
 	asynStatus writeInt32(asynUser* pasynUser, epicsInt32 value)
 	{
 		epicsGuard<epicsMutex> guard(this->stateMutex);
-		this->getFunction(pasynUser->reason, "write");
+		this->pushFunction(this->writeRefs, pasynUser->reason);
 		if (lua_isnil(this->state, -1))
 		{
 			lua_pop(this->state, 1);
 			return asynPortDriver::writeInt32(pasynUser, value);
 		}
 		lua_pushinteger(this->state, value);
-		if (this->callWrite()) return asynError;
+		if (this->callWrite(this->address(pasynUser))) return asynError;
+		return asynSuccess;
+	}
+
+#ifdef LUA_ASYN_INT64
+	asynStatus readInt64(asynUser* pasynUser, epicsInt64* value)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+		this->pushFunction(this->readRefs, pasynUser->reason);
+		if (lua_isnil(this->state, -1))
+		{
+			lua_pop(this->state, 1);
+			return asynPortDriver::readInt64(pasynUser, value);
+		}
+		if (this->callRead(this->address(pasynUser))) return asynError;
+		if (!lua_isnil(this->state, -1))
+		{
+			*value = lua_tointeger(this->state, -1);
+		}
+		lua_pop(this->state, 1);
+		return asynSuccess;
+	}
+
+	asynStatus writeInt64(asynUser* pasynUser, epicsInt64 value)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+		this->pushFunction(this->writeRefs, pasynUser->reason);
+		if (lua_isnil(this->state, -1))
+		{
+			lua_pop(this->state, 1);
+			return asynPortDriver::writeInt64(pasynUser, value);
+		}
+		lua_pushinteger(this->state, value);
+		if (this->callWrite(this->address(pasynUser))) return asynError;
+		return asynSuccess;
+	}
+#endif
+
+	asynStatus readUInt32Digital(asynUser* pasynUser, epicsUInt32* value, epicsUInt32 mask)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+		this->pushFunction(this->readRefs, pasynUser->reason);
+		if (lua_isnil(this->state, -1))
+		{
+			lua_pop(this->state, 1);
+			return asynPortDriver::readUInt32Digital(pasynUser, value, mask);
+		}
+		if (this->callRead(this->address(pasynUser))) return asynError;
+		if (!lua_isnil(this->state, -1))
+		{
+			*value = ((epicsUInt32) lua_tointeger(this->state, -1)) & mask;
+		}
+		lua_pop(this->state, 1);
+		return asynSuccess;
+	}
+
+	asynStatus writeUInt32Digital(asynUser* pasynUser, epicsUInt32 value, epicsUInt32 mask)
+	{
+		epicsGuard<epicsMutex> guard(this->stateMutex);
+		this->pushFunction(this->writeRefs, pasynUser->reason);
+		if (lua_isnil(this->state, -1))
+		{
+			lua_pop(this->state, 1);
+			return asynPortDriver::writeUInt32Digital(pasynUser, value, mask);
+		}
+		lua_pushinteger(this->state, value & mask);
+		lua_pushinteger(this->state, mask);
+		if (this->callWrite(this->address(pasynUser), 1)) return asynError;
 		return asynSuccess;
 	}
 
 	asynStatus readFloat64(asynUser* pasynUser, epicsFloat64* value)
 	{
 		epicsGuard<epicsMutex> guard(this->stateMutex);
-		this->getFunction(pasynUser->reason, "read");
+		this->pushFunction(this->readRefs, pasynUser->reason);
 		if (lua_isnil(this->state, -1))
 		{
 			lua_pop(this->state, 1);
 			return asynPortDriver::readFloat64(pasynUser, value);
 		}
-		if (this->callRead()) return asynError;
+		if (this->callRead(this->address(pasynUser))) return asynError;
 		if (!lua_isnil(this->state, -1))
 		{
 			*value = lua_tonumber(this->state, -1);
@@ -1189,27 +1633,27 @@ public:
 	asynStatus writeFloat64(asynUser* pasynUser, epicsFloat64 value)
 	{
 		epicsGuard<epicsMutex> guard(this->stateMutex);
-		this->getFunction(pasynUser->reason, "write");
+		this->pushFunction(this->writeRefs, pasynUser->reason);
 		if (lua_isnil(this->state, -1))
 		{
 			lua_pop(this->state, 1);
 			return asynPortDriver::writeFloat64(pasynUser, value);
 		}
 		lua_pushnumber(this->state, value);
-		if (this->callWrite()) return asynError;
+		if (this->callWrite(this->address(pasynUser))) return asynError;
 		return asynSuccess;
 	}
 
 	asynStatus readOctet(asynUser* pasynUser, char* value, size_t maxChars, size_t* actual, int* eomReason)
 	{
 		epicsGuard<epicsMutex> guard(this->stateMutex);
-		this->getFunction(pasynUser->reason, "read");
+		this->pushFunction(this->readRefs, pasynUser->reason);
 		if (lua_isnil(this->state, -1))
 		{
 			lua_pop(this->state, 1);
 			return asynPortDriver::readOctet(pasynUser, value, maxChars, actual, eomReason);
 		}
-		if (this->callRead()) return asynError;
+		if (this->callRead(this->address(pasynUser))) return asynError;
 		if (!lua_isnil(this->state, -1))
 		{
 			const char* retval = lua_tolstring(this->state, -1, actual);
@@ -1225,16 +1669,72 @@ public:
 	asynStatus writeOctet(asynUser* pasynUser, const char* value, size_t maxChars, size_t* actual)
 	{
 		epicsGuard<epicsMutex> guard(this->stateMutex);
-		this->getFunction(pasynUser->reason, "write");
+		this->pushFunction(this->writeRefs, pasynUser->reason);
 		if (lua_isnil(this->state, -1))
 		{
 			lua_pop(this->state, 1);
 			return asynPortDriver::writeOctet(pasynUser, value, maxChars, actual);
 		}
 		lua_pushstring(this->state, value);
-		if (this->callWrite()) return asynError;
+		if (this->callWrite(this->address(pasynUser))) return asynError;
 		return asynSuccess;
 	}
+
+	asynStatus readInt8Array(asynUser* pasynUser, epicsInt8* value, size_t nElements, size_t* nIn)
+	{
+		asynStatus status;
+		if (this->readArray(pasynUser, value, LUA_ARRAY_INT8, nElements, nIn, &status))    { return status; }
+		return asynPortDriver::readInt8Array(pasynUser, value, nElements, nIn);
+	}
+
+	asynStatus writeInt8Array(asynUser* pasynUser, epicsInt8* value, size_t nElements)
+	{
+		asynStatus status;
+		if (this->writeArray(pasynUser, value, LUA_ARRAY_INT8, nElements, &status))    { return status; }
+		return asynPortDriver::writeInt8Array(pasynUser, value, nElements);
+	}
+
+	asynStatus readInt16Array(asynUser* pasynUser, epicsInt16* value, size_t nElements, size_t* nIn)
+	{
+		asynStatus status;
+		if (this->readArray(pasynUser, value, LUA_ARRAY_INT16, nElements, nIn, &status))    { return status; }
+		return asynPortDriver::readInt16Array(pasynUser, value, nElements, nIn);
+	}
+
+	asynStatus writeInt16Array(asynUser* pasynUser, epicsInt16* value, size_t nElements)
+	{
+		asynStatus status;
+		if (this->writeArray(pasynUser, value, LUA_ARRAY_INT16, nElements, &status))    { return status; }
+		return asynPortDriver::writeInt16Array(pasynUser, value, nElements);
+	}
+
+	asynStatus readInt32Array(asynUser* pasynUser, epicsInt32* value, size_t nElements, size_t* nIn)
+	{
+		asynStatus status;
+		if (this->readArray(pasynUser, value, LUA_ARRAY_INT32, nElements, nIn, &status))    { return status; }
+		return asynPortDriver::readInt32Array(pasynUser, value, nElements, nIn);
+	}
+
+	asynStatus writeInt32Array(asynUser* pasynUser, epicsInt32* value, size_t nElements)
+	{
+		asynStatus status;
+		if (this->writeArray(pasynUser, value, LUA_ARRAY_INT32, nElements, &status))    { return status; }
+		return asynPortDriver::writeInt32Array(pasynUser, value, nElements);
+	}
+
+	asynStatus readFloat64Array(asynUser* pasynUser, epicsFloat64* value, size_t nElements, size_t* nIn)
+	{
+		asynStatus status;
+		if (this->readArray(pasynUser, value, LUA_ARRAY_FLOAT64, nElements, nIn, &status))    { return status; }
+		return asynPortDriver::readFloat64Array(pasynUser, value, nElements, nIn);
+	}
+
+	asynStatus writeFloat64Array(asynUser* pasynUser, epicsFloat64* value, size_t nElements)
+	{
+		asynStatus status;
+		if (this->writeArray(pasynUser, value, LUA_ARRAY_FLOAT64, nElements, &status))    { return status; }
+		return asynPortDriver::writeFloat64Array(pasynUser, value, nElements);
+	}
 };
 
 /*
@@ -1296,12 +1796,38 @@ static int l_type_constructor(lua_State* state)
  *   proxy.write = function(value, self) ... end  -- bind write callback
  *   proxy.value                             -- read param value
  *   proxy.value = x                         -- write param value + callParamCallbacks
+ *                                              (deferred to commit inside a batch)
  *   proxy.name                              -- parameter name string
+ *   proxy[addr]                             -- the parameter at another address
  */
 
+static void push_paramproxy(lua_State* state, asynPortDriver* driver, lua_State* drvState,
+                            int addr, int paramIndex, const char* paramName);
+
 /* __index on param proxy */
 static int l_paramproxy_index(lua_State* state)
 {
+	/* drv.PARAM[addr] -- the same parameter at another address */
+	if (lua_type(state, 2) == LUA_TNUMBER)
+	{
+		int addr = (int) luaL_checkinteger(state, 2);
+
+		lua_getfield(state, 1, "_driver");
+		asynPortDriver* driver = (asynPortDriver*) lua_touserdata(state, -1);
+		lua_getfield(state, 1, "_state");
+		lua_State* drvState = (lua_State*) lua_touserdata(state, -1);
+		lua_getfield(state, 1, "_index");
+		int paramIndex = lua_tointeger(state, -1);
+		lua_getfield(state, 1, "_name");
+		std::string name(lua_tostring(state, -1) ? lua_tostring(state, -1) : "");
+		lua_pop(state, 4);
+
+		if (!driver || addr < 0 || addr >= driver->maxAddr)    { lua_pushnil(state); return 1; }
+
+		push_paramproxy(state, driver, drvState, addr, paramIndex, name.c_str());
+		return 1;
+	}
+
 	const char* key = luaL_checkstring(state, 2);
 
 	/* Get the driver pointer and param index from the proxy */
@@ -1337,19 +1863,9 @@ static int l_paramproxy_index(lua_State* state)
 
 		luaAsynPortDriver* luaDrv = (luaAsynPortDriver*) driver;
 
-		lua_rawgeti(drvState, LUA_REGISTRYINDEX, luaDrv->funcTableRef);
-		lua_geti(drvState, -1, paramIndex);
-		if (!lua_isnil(drvState, -1))
-		{
-			lua_getfield(drvState, -1, key);
-			lua_xmove(drvState, state, 1);
-			lua_pop(drvState, 2);
-		}
-		else
-		{
-			lua_pop(drvState, 2);
-			lua_pushnil(state);
-		}
+		epicsGuard<epicsMutex> guard(luaDrv->stateMutex);
+		luaDrv->pushFunction(key[0] == 'r' ? luaDrv->readRefs : luaDrv->writeRefs, paramIndex);
+		if (state != drvState)    { lua_xmove(drvState, state, 1); }
 		return 1;
 	}
 
@@ -1381,7 +1897,7 @@ static int l_paramproxy_newindex(lua_State* state)
 	if (strcmp(key, "value") == 0)
 	{
 		asyn_pullparam(state, driver, addr, paramIndex, 3);
-		driver->callParamCallbacks(addr);
+		paramChanged(driver, addr);
 		return 0;
 	}
 	else if (strcmp(key, "read") == 0 || strcmp(key, "write") == 0)
@@ -1392,35 +1908,17 @@ static int l_paramproxy_newindex(lua_State* state)
 			return luaL_error(state, "Cannot bind callbacks on a client driver (use asyn.driver.new to create a server driver)");
 		}
 
-		/* Store the callback in the driver's function table */
 		luaL_checktype(state, 3, LUA_TFUNCTION);
 
 		luaAsynPortDriver* luaDrv = (luaAsynPortDriver*) driver;
 
-		/* Move the function to the driver's Lua state if they differ */
-		lua_rawgeti(drvState, LUA_REGISTRYINDEX, luaDrv->funcTableRef);
-		lua_geti(drvState, -1, paramIndex);
-
-		if (lua_isnil(drvState, -1))
-		{
-			lua_pop(drvState, 1);
-			lua_newtable(drvState);
-		}
+		epicsGuard<epicsMutex> guard(luaDrv->stateMutex);
 
-		/* Copy the function to the driver state */
-		if (state == drvState)
-		{
-			lua_pushvalue(state, 3);
-		}
-		else
-		{
-			lua_pushvalue(state, 3);
-			lua_xmove(state, drvState, 1);
-		}
+		/* Move the function to the driver's Lua state if they differ */
+		lua_pushvalue(state, 3);
+		if (state != drvState)    { lua_xmove(state, drvState, 1); }
 
-		lua_setfield(drvState, -2, key);
-		lua_seti(drvState, -2, paramIndex);
-		lua_pop(drvState, 1);
+		luaDrv->bindFunction(key[0] == 'r' ? luaDrv->readRefs : luaDrv->writeRefs, paramIndex);
 		return 0;
 	}
 
@@ -1431,11 +1929,8 @@ static int l_paramproxy_newindex(lua_State* state)
 static void push_paramproxy(lua_State* state, asynPortDriver* driver, lua_State* drvState,
                             int addr, int paramIndex, const char* paramName)
 {
-	static int meta_registered = 0;
-
-	if (!meta_registered)
+	if (luaL_newmetatable(state, "lua_paramproxy"))
 	{
-		luaL_newmetatable(state, "lua_paramproxy");
 		lua_pushcfunction(state, l_paramproxy_index);
 		lua_setfield(state, -2, "__index");
 		lua_pushcfunction(state, l_paramproxy_newindex);
@@ -1446,12 +1941,12 @@ static void push_paramproxy(lua_State* state, asynPortDriver* driver, lua_State*
 		lua_pushstring(state, ".name                       -- parameter name (property)"); lua_rawseti(state, -2, 2);
 		lua_pushstring(state, ".read = func(self)          -- bind read callback"); lua_rawseti(state, -2, 3);
 		lua_pushstring(state, ".write = func(self, value)  -- bind write callback"); lua_rawseti(state, -2, 4);
+		lua_pushstring(state, "[addr]                      -- the parameter at another address"); lua_rawseti(state, -2, 5);
 		lua_setfield(state, -2, "_doc");
-
-		lua_pop(state, 1);
-		meta_registered = 1;
 	}
 
+	lua_pop(state, 1);
+
 	lua_newtable(state);
 	lua_pushlightuserdata(state, driver);
 	lua_setfield(state, -2, "_driver");
@@ -1478,7 +1973,7 @@ static void push_paramproxy(lua_State* state, asynPortDriver* driver, lua_State*
 
 /*
  * Lua-callable callParamCallbacks for the driver proxy.
- * Usage: drv:callParamCallbacks()
+ * Usage: drv:callParamCallbacks([addr])
  */
 static int l_driverproxy_callParamCallbacks(lua_State* state)
 {
@@ -1486,14 +1981,73 @@ static int l_driverproxy_callParamCallbacks(lua_State* state)
 	asynPortDriver* driver = (asynPortDriver*) lua_touserdata(state, -1);
 	lua_pop(state, 1);
 
-	if (driver)    { driver->callParamCallbacks(); }
+	int addr = (int) luaL_optinteger(state, 2, 0);
+
+	if (driver)    { paramChanged(driver, addr); }
+
+	return 0;
+}
+
+/*
+ * Usage: drv:begin() ... drv:commit()
+ *
+ * Batches may nest, only the outermost commit runs the callbacks. A
+ * begin without a commit holds back this thread's callbacks for good,
+ * so drv:batch() is the safe form.
+ */
+static int l_driverproxy_begin(lua_State* state)
+{
+	lua_getfield(state, 1, "_driver");
+	asynPortDriver* driver = (asynPortDriver*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	if (driver)    { beginBatch(driver); }
+
+	return 0;
+}
+
+static int l_driverproxy_commit(lua_State* state)
+{
+	lua_getfield(state, 1, "_driver");
+	asynPortDriver* driver = (asynPortDriver*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	if (driver && ! commitBatch(driver))    { return luaL_error(state, "commit without a matching begin"); }
+
+	return 0;
+}
+
+/*
+ * Usage: drv:batch(function(drv) ... end)
+ *
+ * Commits even if the function raises an error, then passes the error on.
+ */
+static int l_driverproxy_batch(lua_State* state)
+{
+	luaL_checktype(state, 2, LUA_TFUNCTION);
+
+	lua_getfield(state, 1, "_driver");
+	asynPortDriver* driver = (asynPortDriver*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	if (!driver)    { return 0; }
+
+	beginBatch(driver);
+
+	lua_pushvalue(state, 2);
+	lua_pushvalue(state, 1);
+	int status = lua_pcall(state, 1, 0, 0);
+
+	commitBatch(driver);
+
+	if (status != LUA_OK)    { return lua_error(state); }
 
 	return 0;
 }
 
 /*
  * Lua-callable writeParam for the driver proxy.
- * Usage: drv:writeParam("PARAM_NAME", value)
+ * Usage: drv:writeParam("PARAM_NAME", value [, addr])
  */
 static int l_driverproxy_writeParam(lua_State* state)
 {
@@ -1504,12 +2058,13 @@ static int l_driverproxy_writeParam(lua_State* state)
 	if (!driver)    { return 0; }
 
 	const char* param = luaL_checkstring(state, 2);
-	return asyn_setparam(state, driver, 0, param, 3);
+	int addr = (int) luaL_optinteger(state, 4, 0);
+	return asyn_setparam(state, driver, addr, param, 3);
 }
 
 /*
  * Lua-callable readParam for the driver proxy.
- * Usage: local val = drv:readParam("PARAM_NAME")
+ * Usage: local val = drv:readParam("PARAM_NAME" [, addr])
  */
 static int l_driverproxy_readParam(lua_State* state)
 {
@@ -1520,7 +2075,59 @@ static int l_driverproxy_readParam(lua_State* state)
 	if (!driver)    { return 0; }
 
 	const char* param = luaL_checkstring(state, 2);
-	return asyn_getparam(state, driver, 0, param);
+	int addr = (int) luaL_optinteger(state, 3, 0);
+	return asyn_getparam(state, driver, addr, param);
+}
+
+/* The doCallbacks*Array methods, each limited to one parameter type */
+static const struct
+{
+	const char*   method;
+	const char*   type_name;
+	asynParamType type;
+} array_callbacks[] = {
+	{"doCallbacksInt8Array",    "Int8Array",    asynParamInt8Array},
+	{"doCallbacksInt16Array",   "Int16Array",   asynParamInt16Array},
+	{"doCallbacksInt32Array",   "Int32Array",   asynParamInt32Array},
+	{"doCallbacksFloat64Array", "Float64Array", asynParamFloat64Array},
+};
+
+/*
+ * Sends an array to the I/O Intr clients of an array parameter.
+ * Usage: drv:doCallbacksFloat64Array("PARAM_NAME", array [, addr])
+ *
+ * The entry of array_callbacks for the method called is upvalue 1,
+ * a parameter of any other type raises an error.
+ */
+static int l_driverproxy_doCallbacksArray(lua_State* state)
+{
+	lua_getfield(state, 1, "_driver");
+	asynPortDriver* driver = (asynPortDriver*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	if (!driver)    { return 0; }
+
+	const char* param = luaL_checkstring(state, 2);
+	int addr = (int) luaL_optinteger(state, 4, 0);
+
+	int index;
+	if (driver->findParam(addr, param, &index) != asynSuccess)
+	{
+		return luaL_error(state, "No parameter %s on port %s", param, driver->portName);
+	}
+
+	int method = (int) lua_tointeger(state, lua_upvalueindex(1));
+	asynParamType ptype;
+
+	driver->getParamType(addr, index, &ptype);
+
+	if (ptype != array_callbacks[method].type)
+	{
+		return luaL_error(state, "Parameter %s is not of type %s", param, array_callbacks[method].type_name);
+	}
+
+	asyn_arraycallbacks(state, driver, addr, index, 3);
+	return 0;
 }
 
 /* __index on driver proxy */
@@ -1555,12 +2162,40 @@ static int l_driverproxy_index(lua_State* state)
 		return 1;
 	}
 
+	if (strcmp(key, "batch") == 0)
+	{
+		lua_pushcfunction(state, l_driverproxy_batch);
+		return 1;
+	}
+
+	if (strcmp(key, "begin") == 0)
+	{
+		lua_pushcfunction(state, l_driverproxy_begin);
+		return 1;
+	}
+
+	if (strcmp(key, "commit") == 0)
+	{
+		lua_pushcfunction(state, l_driverproxy_commit);
+		return 1;
+	}
+
 	if (strcmp(key, "writeParam") == 0)
 	{
 		lua_pushcfunction(state, l_driverproxy_writeParam);
 		return 1;
 	}
 
+	for (size_t method = 0; method < sizeof(array_callbacks) / sizeof(array_callbacks[0]); method++)
+	{
+		if (strcmp(key, array_callbacks[method].method) == 0)
+		{
+			lua_pushinteger(state, method);
+			lua_pushcclosure(state, l_driverproxy_doCallbacksArray, 1);
+			return 1;
+		}
+	}
+
 	if (strcmp(key, "readParam") == 0)
 	{
 		lua_pushcfunction(state, l_driverproxy_readParam);
@@ -1680,8 +2315,11 @@ static void push_driverproxy(lua_State* state, asynPortDriver* driver, lua_State
 		lua_pushstring(state, ".maxAddr                    -- max address (property)"); lua_rawseti(state, -2, 2);
 		lua_pushstring(state, ".PARAM                      -- access param proxy by name"); lua_rawseti(state, -2, 3);
 		lua_pushstring(state, ":callParamCallbacks()"); lua_rawseti(state, -2, 4);
-		lua_pushstring(state, ":writeParam(name, value)"); lua_rawseti(state, -2, 5);
-		lua_pushstring(state, ":readParam(name)"); lua_rawseti(state, -2, 6);
+		lua_pushstring(state, ":writeParam(name, value [, addr])"); lua_rawseti(state, -2, 5);
+		lua_pushstring(state, ":readParam(name [, addr])"); lua_rawseti(state, -2, 6);
+		lua_pushstring(state, ":batch(func)                -- one callback pass for all sets in func"); lua_rawseti(state, -2, 7);
+		lua_pushstring(state, ":begin() / :commit()        -- same as batch, as separate calls"); lua_rawseti(state, -2, 8);
+		lua_pushstring(state, ":doCallbacksFloat64Array(name, array [, addr]) -- also Int32, Int16, Int8"); lua_rawseti(state, -2, 9);
 		lua_setfield(state, -2, "_doc");
 	}
 	lua_setmetatable(state, -2);
@@ -1689,20 +2327,61 @@ static void push_driverproxy(lua_State* state, asynPortDriver* driver, lua_State
 
 
 /*
- * asyn.driver.new(portName, paramTable [, initFunc])
+ * asyn.driver.new(portName, paramTable [, initFunc [, maxAddr | options]])
+ *
+ * Creates a new luaAsynPortDriver with the given parameters. Every
+ * parameter exists at each address from 0 to maxAddr - 1.
  *
- * Creates a new luaAsynPortDriver with the given parameters.
+ * options is a table with the fields maxAddr, thread, priority, and
+ * stackSize. With thread = true the port is created with ASYN_CANBLOCK,
+ * so asyn gives it a thread and request queue of its own and the Lua
+ * callbacks run there instead of in the callers' threads. Drivers in
+ * the same state still take turns, see stateLock.
  */
 static int l_driver_new(lua_State* state)
 {
 	const char* portName = luaL_checkstring(state, 1);
 	luaL_checktype(state, 2, LUA_TTABLE);
 
+	int maxAddr = 1;
+	int asynFlags = 0;
+	int priority = 0;
+	int stackSize = 0;
+
+	if (lua_istable(state, 4))
+	{
+		lua_getfield(state, 4, "maxAddr");
+		maxAddr = (int) luaL_optinteger(state, -1, 1);
+		lua_getfield(state, 4, "thread");
+		if (lua_toboolean(state, -1))    { asynFlags |= ASYN_CANBLOCK; }
+		lua_getfield(state, 4, "priority");
+		priority = (int) luaL_optinteger(state, -1, 0);
+		lua_getfield(state, 4, "stackSize");
+		stackSize = (int) luaL_optinteger(state, -1, 0);
+		lua_pop(state, 4);
+	}
+	else
+	{
+		maxAddr = (int) luaL_optinteger(state, 4, 1);
+	}
+
+	luaL_argcheck(state, maxAddr >= 1, 4, "maxAddr must be at least 1");
+
+	if (maxAddr > 1)    { asynFlags |= ASYN_MULTIDEVICE; }
+
 	/* Create the driver using the calling Lua state */
-	luaAsynPortDriver* cppDriver = new luaAsynPortDriver(portName, state);
+	/*
+	 * Callbacks run in the main thread of the calling state, which the
+	 * driver keeps open from here on, since drivers are never destroyed.
+	 * Otherwise a state from luaSpawn would close when its script ends.
+	 */
+	lua_State* main = mainThread(state);
+	luaStateRef(main);
+
+	luaAsynPortDriver* cppDriver = new luaAsynPortDriver(portName, main, maxAddr, asynFlags, priority, stackSize);
 
 	/* Create the driver proxy */
-	push_driverproxy(state, cppDriver, state);
+	push_driverproxy(state, cppDriver, main);
 
 	int proxyIndex = lua_gettop(state);
 
@@ -1740,7 +2419,10 @@ static int l_driver_new(lua_State* state)
 		lua_getfield(state, -1, "default");
 		if (!lua_isnil(state, -1))
 		{
-			asyn_pullparam(state, cppDriver, 0, index, lua_gettop(state));
+			for (int addr = 0; addr < maxAddr; addr++)
+			{
+				asyn_pullparam(state, cppDriver, addr, index, lua_gettop(state));
+			}
 		}
 		lua_pop(state, 1);
 
@@ -1753,7 +2435,7 @@ static int l_driver_new(lua_State* state)
 		lua_pop(state, 1);  /* param spec table */
 	}
 
-	cppDriver->callParamCallbacks();
+	for (int addr = 0; addr < maxAddr; addr++)    { cppDriver->callParamCallbacks(addr); }
 
 	/* Call init function if provided */
 	if (lua_isfunction(state, 3))
@@ -1872,6 +2554,32 @@ int luaopen_asyn (lua_State *L)
 	lua_pushcclosure(L, l_type_constructor, 1);
 	lua_setfield(L, -2, "Octet");
 
+	lua_pushinteger(L, asynParamUInt32Digital);
+	lua_pushcclosure(L, l_type_constructor, 1);
+	lua_setfield(L, -2, "UInt32Digital");
+
+#ifdef LUA_ASYN_INT64
+	lua_pushinteger(L, asynParamInt64);
+	lua_pushcclosure(L, l_type_constructor, 1);
+	lua_setfield(L, -2, "Int64");
+#endif
+
+	lua_pushinteger(L, asynParamInt8Array);
+	lua_pushcclosure(L, l_type_constructor, 1);
+	lua_setfield(L, -2, "Int8Array");
+
+	lua_pushinteger(L, asynParamInt16Array);
+	lua_pushcclosure(L, l_type_constructor, 1);
+	lua_setfield(L, -2, "Int16Array");
+
+	lua_pushinteger(L, asynParamInt32Array);
+	lua_pushcclosure(L, l_type_constructor, 1);
+	lua_setfield(L, -2, "Int32Array");
+
+	lua_pushinteger(L, asynParamFloat64Array);
+	lua_pushcclosure(L, l_type_constructor, 1);
+	lua_setfield(L, -2, "Float64Array");
+
 	/* Create asyn.driver table with .new, .find, and __call -> find */
 	lua_newtable(L);
 
@@ -1922,11 +2630,12 @@ int luaopen_asyn (lua_State *L)
 	lua_pushstring(L, ".callParamCallbacks(port [, addr])"); lua_rawseti(L, -2, 13);
 	lua_pushstring(L, ".setTrace(port, mask) -- error=0x1, device=0x2, filter=0x4, driver=0x8, flow=0x10, warning=0x20"); lua_rawseti(L, -2, 14);
 	lua_pushstring(L, ".setTraceIO(port, mask) -- nodata=0x0, ascii=0x1, escape=0x2, hex=0x4"); lua_rawseti(L, -2, 15);
-	lua_pushstring(L, ".driver.new(port, params [, initFunc]) -- create asynPortDriver"); lua_rawseti(L, -2, 16);
+	lua_pushstring(L, ".driver.new(port, params [, initFunc [, maxAddr | options]]) -- create asynPortDriver"); lua_rawseti(L, -2, 16);
 	lua_pushstring(L, ".driver.find(port) -- find existing asynPortDriver"); lua_rawseti(L, -2, 17);
 	lua_pushstring(L, ".client(port [, addr [, param]]) -- create asynOctetClient"); lua_rawseti(L, -2, 18);
 	lua_pushstring(L, ".client.find(port [, addr [, param]]) -- find/create client"); lua_rawseti(L, -2, 19);
 	lua_pushstring(L, ".Int32(name [, default]) / .Float64(name [, default]) / .Octet(name [, default])"); lua_rawseti(L, -2, 20);
+	lua_pushstring(L, ".Int64 / .UInt32Digital / .Int8Array / .Int16Array / .Int32Array / .Float64Array"); lua_rawseti(L, -2, 21);
 	lua_setfield(L, -2, "_doc");
 
 	return 1;
@@ -1941,4 +2650,5 @@ static void libasynRegister(void)
 extern "C"
 {
 	epicsExportRegistrar(libasynRegister);
+	epicsExportAddress(int, luaAsynMaxReply);
 }
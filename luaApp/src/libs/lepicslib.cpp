@@ -2,47 +2,467 @@
 #include <dbAddr.h>
 #include <iocsh.h>
 #include <cadef.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <errlog.h>
 #include <string>
+#include <map>
+#include <set>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <epicsExport.h>
 #include "lepicslib.h"
+#include "devUtil.h"
+#include "larraylib.h"
 
 
 /*
- * CA context management -- cached per Lua state.
+ * CA context and channel cache -- cached per Lua state.
  *
- * A sentinel userdata is stored in the Lua registry. Its __gc
- * destroys the CA context when the Lua state is closed. The
- * context is created once on first use and reused for all
- * subsequent epics.get/put/pv calls in that state.
+ * A sentinel userdata is stored in the Lua registry. It holds the
+ * CA context used by the state and a cache of channels keyed by PV
+ * name, so that repeat epics.get/put calls on a remote PV reuse the
+ * connected channel instead of doing a search and connect each time.
+ * Channels that haven't been used for luaCaChannelIdleTimeout seconds
+ * are cleared. Its __gc clears all cached channels when the Lua state
+ * is closed. Channels are shared by every PV object and epics.get/put
+ * call in the state, so collecting a PV object leaves them to the idle
+ * sweep.
+ *
+ * Every cache uses one shared, preemptive CA context. It is created
+ * by the first cache and destroyed when the last cache is released,
+ * so closing one state never pulls the context out from under another
+ * state's channels.
  */
 #define LEPICS_CA_CONTEXT_KEY "LEPICS_CA_CONTEXT"
 
+/* Seconds an unused channel stays cached, <= 0 disables the cache */
+double luaCaChannelIdleTimeout = 60.0;
+
+typedef struct lepics_channel
+{
+	chid           id;
+	epicsEvent     connect_event;
+	volatile int   connected;
+	epicsTimeStamp last_used;
+} lepics_channel;
+
+typedef std::map<std::string, lepics_channel*> channel_map;
+
+/*
+ * Monitor events queued by CA callbacks and delivered to Lua by
+ * epics.poll. CA serializes the callbacks of a context, so the event
+ * ring of a state has one producer at a time and one consumer (the
+ * thread running the state) and needs no lock.
+ */
+#define LEPICS_EVENT_QUEUE_SIZE 1024
+
+struct lepics_ca_cache;
+
+typedef struct lepics_monitor
+{
+	char                    pv_name[128];
+	chid                    id;
+	evid                    event_id;
+	struct lepics_ca_cache* cache;
+	long                    mask;
+	int                     max_count;
+	int                     as_string;
+	int                     max_queue;
+	int                     pending;
+	int                     overflows;
+	volatile int            connected;
+	int                     subscribed;
+	int                     cancelled;
+	int                     callback_ref;
+	int                     self_ref;
+} lepics_monitor;
+
+typedef struct lepics_event
+{
+	lepics_monitor* monitor;
+	void*           data;
+	long            type;
+	long            count;
+	short           status;
+	short           severity;
+	epicsTimeStamp  stamp;
+} lepics_event;
+
+typedef struct lepics_event_queue
+{
+	lepics_event events[LEPICS_EVENT_QUEUE_SIZE];
+	size_t       head;
+	size_t       tail;
+} lepics_event_queue;
+
+typedef struct lepics_ca_cache
+{
+	struct ca_client_context* context;
+	epicsTimeStamp            last_sweep;
+	channel_map               channels;
+	std::set<lepics_monitor*> monitors;
+	lepics_event_queue*       queue;
+	epicsEvent                queue_event;
+} lepics_ca_cache;
+
+typedef struct {
+	lepics_ca_cache* cache;
+} lepics_ca_sentinel;
+
+static void lepics_connection_handler(struct connection_handler_args args)
+{
+	lepics_channel* chan = (lepics_channel*) ca_puser(args.chid);
+
+	chan->connected = (args.op == CA_OP_CONN_UP);
+
+	if (chan->connected)    { chan->connect_event.signal(); }
+}
+
+static void clear_cached_channel(lepics_channel* chan)
+{
+	/* No further connection callbacks are delivered once this returns */
+	ca_clear_channel(chan->id);
+	delete chan;
+}
+
+/*
+ * Clear every cached channel whose name begins with the given prefix.
+ * An empty prefix clears the whole cache.
+ */
+static void clear_cached_channels(lepics_ca_cache* cache, const std::string& prefix)
+{
+	channel_map::iterator it = cache->channels.lower_bound(prefix);
+
+	while (it != cache->channels.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+	{
+		clear_cached_channel(it->second);
+		cache->channels.erase(it++);
+	}
+}
+
+static void sweep_idle_channels(lepics_ca_cache* cache, const epicsTimeStamp* now)
+{
+	/* Sweeping is cheap, but there is no need to do it on every call */
+	if (epicsTimeDiffInSeconds(now, &cache->last_sweep) < 1.0)    { return; }
+
+	cache->last_sweep = *now;
+
+	channel_map::iterator it = cache->channels.begin();
+
+	while (it != cache->channels.end())
+	{
+		if (epicsTimeDiffInSeconds(now, &it->second->last_used) > luaCaChannelIdleTimeout)
+		{
+			clear_cached_channel(it->second);
+			cache->channels.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+/* Called from CA callbacks, the only writer of head */
+static bool queue_push(lepics_event_queue* queue, const lepics_event* event)
+{
+	size_t head = queue->head;
+
+	if (head - epicsAtomicGetSizeT(&queue->tail) >= LEPICS_EVENT_QUEUE_SIZE)    { return false; }
+
+	queue->events[head % LEPICS_EVENT_QUEUE_SIZE] = *event;
+	epicsAtomicSetSizeT(&queue->head, head + 1);
+
+	return true;
+}
+
+/* Called from the thread running the state, the only writer of tail */
+static bool queue_pop(lepics_event_queue* queue, lepics_event* event)
+{
+	size_t tail = queue->tail;
+
+	if (tail == epicsAtomicGetSizeT(&queue->head))    { return false; }
+
+	*event = queue->events[tail % LEPICS_EVENT_QUEUE_SIZE];
+	epicsAtomicSetSizeT(&queue->tail, tail + 1);
+
+	return true;
+}
+
+static epicsMutex sharedContextMutex;
+static struct ca_client_context* shared_context = NULL;
+static int shared_context_users = 0;
+
+/* The shared context this thread was attached to by ensure_ca_context */
+static epicsThreadPrivate<struct ca_client_context> attached_context;
+
+/*
+ * A thread attached to the shared context keeps pointing at it after
+ * the context is destroyed. Detach such a thread before it is used
+ * again. ca_detach_context only clears the thread's pointer.
+ */
+static void drop_stale_context(void)
+{
+	struct ca_client_context* attached = attached_context.get();
+
+	if (! attached)    { return; }
+
+	epicsGuard<epicsMutex> guard(sharedContextMutex);
+
+	if (attached == shared_context)    { return; }
+
+	if (ca_current_context() == attached)    { ca_detach_context(); }
+
+	attached_context.set(NULL);
+}
+
+/* Attaches the calling thread to the shared context if it has none */
+static void attach_shared_context(struct ca_client_context* context)
+{
+	drop_stale_context();
+
+	if (ca_current_context())    { return; }
+
+	ca_attach_context(context);
+	attached_context.set(context);
+}
+
+/* Makes context current on this thread, returns the one to restore */
+static struct ca_client_context* switch_context(struct ca_client_context* context)
+{
+	drop_stale_context();
+
+	struct ca_client_context* previous = ca_current_context();
+
+	if (previous == context)    { return previous; }
+
+	if (previous)    { ca_detach_context(); }
+	if (context)     { ca_attach_context(context); }
+
+	return previous;
+}
+
+static void restore_context(struct ca_client_context* context, struct ca_client_context* previous)
+{
+	if (previous == context)    { return; }
+
+	if (ca_current_context())    { ca_detach_context(); }
+	if (previous)                { ca_attach_context(previous); }
+}
+
+/* Returns the shared context, creating it for the first user */
+static struct ca_client_context* acquire_shared_context(void)
+{
+	epicsGuard<epicsMutex> guard(sharedContextMutex);
+
+	if (! shared_context)
+	{
+		struct ca_client_context* previous = switch_context(NULL);
+
+		if (ca_context_create(ca_enable_preemptive_callback) == ECA_NORMAL)
+		{
+			shared_context = ca_current_context();
+		}
+
+		restore_context(shared_context, previous);
+
+		if (! shared_context)    { return NULL; }
+	}
+
+	shared_context_users++;
+	return shared_context;
+}
+
+/* Destroys the shared context once its last user has released it */
+static void release_shared_context(void)
+{
+	epicsGuard<epicsMutex> guard(sharedContextMutex);
+
+	if (--shared_context_users > 0)    { return; }
+
+	struct ca_client_context* context = shared_context;
+	struct ca_client_context* previous = switch_context(context);
+
+	ca_context_destroy();
+	shared_context = NULL;
+
+	if (attached_context.get() == context)    { attached_context.set(NULL); }
+
+	if (previous != context)    { restore_context(NULL, previous); }
+}
+
 static int l_ca_context_gc(lua_State* L)
 {
-	if (ca_current_context())    { ca_context_destroy(); }
+	lepics_ca_sentinel* sentinel = (lepics_ca_sentinel*) lua_touserdata(L, 1);
+	lepics_ca_cache* cache = sentinel->cache;
+
+	if (! cache)    { return 0; }
+
+	sentinel->cache = NULL;
+
+	/* Channels remember their context, so these work from any thread */
+	std::set<lepics_monitor*>::iterator it;
+
+	for (it = cache->monitors.begin(); it != cache->monitors.end(); ++it)    { ca_clear_channel((*it)->id); }
+
+	if (cache->queue)
+	{
+		lepics_event event;
+
+		while (queue_pop(cache->queue, &event))    { free(event.data); }
+
+		delete cache->queue;
+	}
+
+	clear_cached_channels(cache, "");
+
+	delete cache;
+
+	release_shared_context();
 	return 0;
 }
 
-static void ensure_ca_context(lua_State* L)
+/*
+ * Returns the channel cache for this state, taking a reference to the
+ * shared CA context on first use. Threads without a CA context are
+ * attached to the shared one. Returns NULL if the calling thread
+ * already uses a different CA context, in which case channels can't
+ * be shared.
+ */
+static lepics_ca_cache* ensure_ca_context(lua_State* L)
 {
-	if (ca_current_context())    { return; }
+	lua_getfield(L, LUA_REGISTRYINDEX, LEPICS_CA_CONTEXT_KEY);
+	lepics_ca_sentinel* sentinel = (lepics_ca_sentinel*) lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if (! sentinel)
+	{
+		/* Create a sentinel userdata with __gc to release the cache */
+		sentinel = (lepics_ca_sentinel*) lua_newuserdata(L, sizeof(lepics_ca_sentinel));
+		sentinel->cache = NULL;
+
+		if (luaL_newmetatable(L, "lepics_ca_gc"))
+		{
+			lua_pushcfunction(L, l_ca_context_gc);
+			lua_setfield(L, -2, "__gc");
+		}
+		lua_setmetatable(L, -2);
 
-	ca_context_create(ca_enable_preemptive_callback);
+		lua_setfield(L, LUA_REGISTRYINDEX, LEPICS_CA_CONTEXT_KEY);
+	}
+
+	if (! sentinel->cache)
+	{
+		struct ca_client_context* context = acquire_shared_context();
+
+		if (! context)    { return NULL; }
+
+		lepics_ca_cache* cache = new lepics_ca_cache;
+
+		cache->context = context;
+		cache->queue = NULL;
+		epicsTimeGetCurrent(&cache->last_sweep);
+
+		sentinel->cache = cache;
+	}
+
+	lepics_ca_cache* cache = sentinel->cache;
+
+	attach_shared_context(cache->context);
+
+	return (ca_current_context() == cache->context) ? cache : NULL;
+}
+
+#define CHANNEL_OK             0
+#define CHANNEL_CREATE_FAILED  1
+#define CHANNEL_TIMEOUT        2
+
+/*
+ * Gets a connected channel for the given PV. Uses the state's
+ * channel cache when possible, otherwise creates a transient channel
+ * that must be released with release_channel afterwards.
+ */
+static int acquire_channel(lua_State* L, const char* pv_name, double timeout, chid* id, int* transient)
+{
+	lepics_ca_cache* cache = ensure_ca_context(L);
+
+	if (! cache || luaCaChannelIdleTimeout <= 0.0)
+	{
+		*transient = 1;
+
+		if (ca_create_channel(pv_name, NULL, NULL, 0, id) != ECA_NORMAL)    { return CHANNEL_CREATE_FAILED; }
+
+		if (ca_pend_io(timeout) != ECA_NORMAL)
+		{
+			ca_clear_channel(*id);
+			return CHANNEL_TIMEOUT;
+		}
+
+		return CHANNEL_OK;
+	}
+
+	*transient = 0;
+
+	epicsTimeStamp now;
+	epicsTimeGetCurrent(&now);
+
+	sweep_idle_channels(cache, &now);
+
+	lepics_channel* chan;
+	channel_map::iterator it = cache->channels.find(pv_name);
+
+	if (it != cache->channels.end())
+	{
+		chan = it->second;
+	}
+	else
+	{
+		chan = new lepics_channel;
+		chan->connected = 0;
+
+		if (ca_create_channel(pv_name, lepics_connection_handler, chan, 0, &chan->id) != ECA_NORMAL)
+		{
+			delete chan;
+			return CHANNEL_CREATE_FAILED;
+		}
+
+		cache->channels[pv_name] = chan;
+	}
 
-	/* Create a sentinel userdata with __gc to destroy the context */
-	lua_newuserdata(L, 1);
+	chan->last_used = now;
 
-	if (luaL_newmetatable(L, "lepics_ca_gc"))
+	if (! chan->connected)
 	{
-		lua_pushcfunction(L, l_ca_context_gc);
-		lua_setfield(L, -2, "__gc");
+		ca_flush_io();
+
+		/* The event may hold a stale signal from an earlier connection */
+		double remaining = timeout;
+
+		while (! chan->connected && remaining > 0.0)
+		{
+			chan->connect_event.wait(remaining);
+
+			epicsTimeStamp waited;
+			epicsTimeGetCurrent(&waited);
+			remaining = timeout - epicsTimeDiffInSeconds(&waited, &now);
+		}
+
+		if (! chan->connected)    { return CHANNEL_TIMEOUT; }
 	}
-	lua_setmetatable(L, -2);
 
-	lua_setfield(L, LUA_REGISTRYINDEX, LEPICS_CA_CONTEXT_KEY);
+	*id = chan->id;
+	return CHANNEL_OK;
+}
+
+static void release_channel(chid id, int transient)
+{
+	if (transient)    { ca_clear_channel(id); }
 }
 
 
@@ -396,6 +816,25 @@ static int db_put(lua_State* L, DBADDR* paddr, int val_index)
 			break;
 		}
 
+		case LUA_TUSERDATA:
+		{
+			/* epics.array -- written straight from its buffer */
+			lua_array* array = luaTestArray(L, val_index);
+			short dbr = array ? luaArrayDbType(array->type) : -1;
+
+			if (dbr < 0)
+			{
+				lua_pushstring(L, "Unsupported value type for put");
+				return 1;
+			}
+
+			long count = (long) array->count;
+			if (count > paddr->no_elements)    { count = paddr->no_elements; }
+
+			status = count ? dbPutField(paddr, dbr, array->data, count) : 0;
+			break;
+		}
+
 		default:
 		{
 			lua_pushstring(L, "Unsupported value type for put");
@@ -414,55 +853,78 @@ static int db_put(lua_State* L, DBADDR* paddr, int val_index)
 
 
 /*
- * epics_get -- core get function.
- *
- * Tries direct database access first (local PV). If the PV is not
- * found locally, falls through to Channel Access.
- *
- * max_count: 0 = fetch all elements, >0 = limit to this many
- * as_string: -1 = type-dependent default, 0 = force numeric, 1 = force string
- *   - DBF_ENUM scalar: default=numeric, string=1 returns label
- *   - DBF_CHAR array:  default=string, string=0 returns table of ints
- *   - DBF_CHAR scalar: string parameter ignored
+ * db_get_array -- read a local PV into an epics.array with a single
+ * dbGetField. Fills the array at array_index, or a new array of the
+ * field's native type if array_index is 0.
+ * Returns: number of Lua values pushed (1 on success, 2 on error).
  */
-static int epics_get(lua_State* state, const char* pv_name,
-                     double timeout, int max_count, int as_string)
+static int db_get_array(lua_State* L, DBADDR* paddr, int max_count, int array_index)
 {
-	if (pv_name == NULL)
+	lua_array* array = array_index ? luaTestArray(L, array_index) : NULL;
+	lua_array_type type;
+	long count = paddr->no_elements;
+	long options = 0;
+
+	if (max_count > 0 && max_count < count)
+		count = max_count;
+
+	if (array)
 	{
-		lua_pushnil(state);
-		lua_pushstring(state, "PV name is nil");
+		type = array->type;
+	}
+	else if (luaArrayTypeForField(paddr->field_type, &type))
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "Field type can't be read into an array");
 		return 2;
 	}
 
-	/* Try direct database access first (local PV) */
+	short dbr = luaArrayDbType(type);
+
+	if (dbr < 0)
 	{
-		DBADDR addr;
-		if (iocshPpdbbase && *iocshPpdbbase && dbNameToAddr(pv_name, &addr) == 0)
-		{
-			return db_get(state, &addr, max_count, as_string);
-		}
+		lua_pushnil(L);
+		lua_pushstring(L, "Array type isn't supported by this EPICS base");
+		return 2;
 	}
 
-	/* Remote PV -- use Channel Access */
-	ensure_ca_context(state);
+	if (array)    { lua_pushvalue(L, array_index); }
+	else          { array = luaNewArray(L, type, 0); }
+
+	if (luaArrayResize(array, count) == 0 &&
+	    dbGetField(paddr, dbr, array->data, &options, &count, NULL) == 0)
+	{
+		luaArrayResize(array, count);
+		return 1;
+	}
+
+	lua_pop(L, 1);
+	lua_pushnil(L);
+	lua_pushstring(L, "Failed to read local PV into array");
+	return 2;
+}
 
+
+/*
+ * ca_get_value -- read a remote PV over Channel Access.
+ * Returns: number of Lua values pushed (1 on success, 2 on error).
+ */
+static int ca_get_value(lua_State* state, const char* pv_name,
+                        double timeout, int max_count, int as_string)
+{
 	chid id;
+	int transient;
 
-	int status = ca_create_channel(pv_name, NULL, NULL, 0, &id);
+	int status = acquire_channel(state, pv_name, timeout, &id, &transient);
 
-	if (status != ECA_NORMAL)
+	if (status == CHANNEL_CREATE_FAILED)
 	{
 		lua_pushnil(state);
 		lua_pushfstring(state, "Failed to create channel for '%s'", pv_name);
 		return 2;
 	}
-
-	status = ca_pend_io(timeout);
-
-	if (status != ECA_NORMAL)
+	else if (status == CHANNEL_TIMEOUT)
 	{
-		ca_clear_channel(id);
 		lua_pushnil(state);
 		lua_pushfstring(state, "Timeout connecting to '%s'", pv_name);
 		return 2;
@@ -719,7 +1181,7 @@ static int epics_get(lua_State* state, const char* pv_name,
 		}
 	}
 
-	ca_clear_channel(id);
+	release_channel(id, transient);
 
 	if (result == 0)
 	{
@@ -731,41 +1193,194 @@ static int epics_get(lua_State* state, const char* pv_name,
 	return result;
 }
 
-static int epics_put(lua_State* state, const char* pv_name, int offset, double timeout)
+/*
+ * Channel Access request types for epics.array element types. CA has
+ * no unsigned 32-bit or 64-bit requests, those return -1.
+ */
+static long ca_array_dbr(lua_array_type type)
 {
-	if (pv_name == NULL)
+	switch (type)
 	{
-		lua_pushstring(state, "PV name is nil");
-		return 1;
+		case LUA_ARRAY_INT8:
+		case LUA_ARRAY_UINT8:   return DBR_CHAR;
+		case LUA_ARRAY_INT16:   return DBR_SHORT;
+		case LUA_ARRAY_UINT16:  return DBR_ENUM;
+		case LUA_ARRAY_INT32:   return DBR_LONG;
+		case LUA_ARRAY_FLOAT32: return DBR_FLOAT;
+		case LUA_ARRAY_FLOAT64: return DBR_DOUBLE;
+		default:                return -1;
 	}
+}
 
-	/* Try direct database access first (local PV) */
+static int ca_array_type(short field_type, lua_array_type* type)
+{
+	switch (field_type)
 	{
-		DBADDR addr;
-		if (iocshPpdbbase && *iocshPpdbbase && dbNameToAddr(pv_name, &addr) == 0)
-		{
-			return db_put(state, &addr, offset);
-		}
+		case DBF_CHAR:   *type = LUA_ARRAY_UINT8;   return 0;
+		case DBF_SHORT:  *type = LUA_ARRAY_INT16;   return 0;
+		case DBF_ENUM:   *type = LUA_ARRAY_UINT16;  return 0;
+		case DBF_LONG:   *type = LUA_ARRAY_INT32;   return 0;
+		case DBF_FLOAT:  *type = LUA_ARRAY_FLOAT32; return 0;
+		case DBF_DOUBLE: *type = LUA_ARRAY_FLOAT64; return 0;
+		default:         return -1;
 	}
+}
 
-	/* Remote PV -- use Channel Access */
-	ensure_ca_context(state);
-
+/*
+ * ca_get_array -- read a remote PV into an epics.array with a single
+ * ca_array_get, see db_get_array.
+ * Returns: number of Lua values pushed (1 on success, 2 on error).
+ */
+static int ca_get_array(lua_State* state, const char* pv_name,
+                        double timeout, int max_count, int array_index)
+{
 	chid id;
+	int transient;
 
-	int status = ca_create_channel(pv_name, NULL, NULL, 0, &id);
+	int status = acquire_channel(state, pv_name, timeout, &id, &transient);
 
-	if (status != ECA_NORMAL)
+	if (status == CHANNEL_CREATE_FAILED)
 	{
+		lua_pushnil(state);
 		lua_pushfstring(state, "Failed to create channel for '%s'", pv_name);
-		return 1;
+		return 2;
+	}
+	else if (status == CHANNEL_TIMEOUT)
+	{
+		lua_pushnil(state);
+		lua_pushfstring(state, "Timeout connecting to '%s'", pv_name);
+		return 2;
+	}
+
+	lua_array* array = array_index ? luaTestArray(state, array_index) : NULL;
+	lua_array_type type;
+	unsigned long count = ca_element_count(id);
+
+	if (max_count > 0 && (unsigned long) max_count < count)
+		count = (unsigned long) max_count;
+
+	if (array)
+	{
+		type = array->type;
+	}
+	else if (ca_array_type(ca_field_type(id), &type))
+	{
+		release_channel(id, transient);
+		lua_pushnil(state);
+		lua_pushfstring(state, "'%s' can't be read into an array", pv_name);
+		return 2;
 	}
 
-	status = ca_pend_io(timeout);
+	long dbr = ca_array_dbr(type);
+
+	if (dbr < 0)
+	{
+		release_channel(id, transient);
+		lua_pushnil(state);
+		lua_pushfstring(state, "Array type isn't supported by Channel Access for '%s'", pv_name);
+		return 2;
+	}
+
+	if (array)    { lua_pushvalue(state, array_index); }
+	else          { array = luaNewArray(state, type, 0); }
+
+	status = ECA_ALLOCMEM;
+
+	if (luaArrayResize(array, count) == 0)
+	{
+		status = ca_array_get(dbr, count, id, array->data);
+		status = ca_pend_io(timeout);
+	}
+
+	release_channel(id, transient);
 
 	if (status != ECA_NORMAL)
 	{
-		ca_clear_channel(id);
+		lua_pop(state, 1);
+		lua_pushnil(state);
+		lua_pushfstring(state, "Failed to read '%s'", pv_name);
+		return 2;
+	}
+
+	return 1;
+}
+
+/*
+ * Reads the array option of a get. Returns 0 for a normal get, -1 to
+ * read into a new epics.array, or the stack index of an existing
+ * array to fill, which is left on the stack.
+ */
+static int array_option(lua_State* state, int options)
+{
+	lua_getfield(state, options, "array");
+
+	if (luaTestArray(state, -1))    { return lua_gettop(state); }
+
+	int want_array = lua_toboolean(state, -1);
+	lua_pop(state, 1);
+
+	return want_array ? -1 : 0;
+}
+
+/*
+ * epics_get -- core get function.
+ *
+ * Tries direct database access first (local PV). If the PV is not
+ * found locally, falls through to Channel Access.
+ *
+ * max_count: 0 = fetch all elements, >0 = limit to this many
+ * as_string: -1 = type-dependent default, 0 = force numeric, 1 = force string
+ *   - DBF_ENUM scalar: default=numeric, string=1 returns label
+ *   - DBF_CHAR array:  default=string, string=0 returns table of ints
+ *   - DBF_CHAR scalar: string parameter ignored
+ * array_index: 0 = Lua values, -1 = new epics.array, >0 = array to fill
+ */
+static int epics_get(lua_State* state, const char* pv_name,
+                     double timeout, int max_count, int as_string, int array_index)
+{
+	if (pv_name == NULL)
+	{
+		lua_pushnil(state);
+		lua_pushstring(state, "PV name is nil");
+		return 2;
+	}
+
+	/* Try direct database access first (local PV) */
+	{
+		DBADDR addr;
+		if (iocshPpdbbase && *iocshPpdbbase && dbNameToAddr(pv_name, &addr) == 0)
+		{
+			if (array_index)    { return db_get_array(state, &addr, max_count, array_index > 0 ? array_index : 0); }
+
+			return db_get(state, &addr, max_count, as_string);
+		}
+	}
+
+	/* Remote PV -- use Channel Access */
+	if (array_index)    { return ca_get_array(state, pv_name, timeout, max_count, array_index > 0 ? array_index : 0); }
+
+	return ca_get_value(state, pv_name, timeout, max_count, as_string);
+}
+
+/*
+ * ca_put_value -- write the value at the given stack offset to a
+ * remote PV over Channel Access.
+ * Returns: number of Lua values pushed (0 on success, 1 on error).
+ */
+static int ca_put_value(lua_State* state, const char* pv_name, int offset, double timeout)
+{
+	chid id;
+	int transient;
+
+	int status = acquire_channel(state, pv_name, timeout, &id, &transient);
+
+	if (status == CHANNEL_CREATE_FAILED)
+	{
+		lua_pushfstring(state, "Failed to create channel for '%s'", pv_name);
+		return 1;
+	}
+	else if (status == CHANNEL_TIMEOUT)
+	{
 		lua_pushfstring(state, "Timeout connecting to '%s'", pv_name);
 		return 1;
 	}
@@ -868,16 +1483,36 @@ static int epics_put(lua_State* state, const char* pv_name, int offset, double t
 			}
 			else
 			{
-				ca_clear_channel(id);
+				release_channel(id, transient);
 				lua_pushfstring(state, "Unsupported table element type for put to '%s'", pv_name);
 				return 1;
 			}
 			break;
 		}
 
+		case LUA_TUSERDATA:
+		{
+			/* epics.array -- written straight from its buffer */
+			lua_array* array = luaTestArray(state, offset);
+			long dbr = array ? ca_array_dbr(array->type) : -1;
+
+			if (dbr < 0)
+			{
+				release_channel(id, transient);
+				lua_pushfstring(state, "Unsupported value type for put to '%s'", pv_name);
+				return 1;
+			}
+
+			unsigned long count = (unsigned long) array->count;
+			if (count > ca_element_count(id))    { count = ca_element_count(id); }
+
+			status = count ? ca_array_put(dbr, count, id, array->data) : ECA_NORMAL;
+			break;
+		}
+
 		default:
 		{
-			ca_clear_channel(id);
+			release_channel(id, transient);
 			lua_pushfstring(state, "Unsupported value type for put to '%s'", pv_name);
 			return 1;
 		}
@@ -885,24 +1520,46 @@ static int epics_put(lua_State* state, const char* pv_name, int offset, double t
 
 	if (status != ECA_NORMAL)
 	{
-		ca_clear_channel(id);
+		release_channel(id, transient);
 		lua_pushfstring(state, "Failed to put value to '%s'", pv_name);
 		return 1;
 	}
 
 	ca_pend_io(timeout);
-	ca_clear_channel(id);
+	release_channel(id, transient);
 
 	return 0;
 }
 
 
+static int epics_put(lua_State* state, const char* pv_name, int offset, double timeout)
+{
+	if (pv_name == NULL)
+	{
+		lua_pushstring(state, "PV name is nil");
+		return 1;
+	}
+
+	/* Try direct database access first (local PV) */
+	{
+		DBADDR addr;
+		if (iocshPpdbbase && *iocshPpdbbase && dbNameToAddr(pv_name, &addr) == 0)
+		{
+			return db_put(state, &addr, offset);
+		}
+	}
+
+	/* Remote PV -- use Channel Access */
+	return ca_put_value(state, pv_name, offset, timeout);
+}
+
 static int l_caget(lua_State* state)
 {
 	const char* pv_name = luaL_checkstring(state, 1);
 	double timeout = 1.0;
 	int max_count = 0;
 	int as_string = -1;
+	int array_index = 0;
 
 	if (lua_isnumber(state, 2))
 	{
@@ -923,9 +1580,11 @@ static int l_caget(lua_State* state)
 		lua_getfield(state, 2, "string");
 		if (!lua_isnil(state, -1))    { as_string = lua_toboolean(state, -1); }
 		lua_pop(state, 1);
+
+		array_index = array_option(state, 2);
 	}
 
-	return epics_get(state, pv_name, timeout, max_count, as_string);
+	return epics_get(state, pv_name, timeout, max_count, as_string, array_index);
 }
 
 static int l_caput(lua_State* state)
@@ -949,21 +1608,485 @@ static int l_caput(lua_State* state)
 	return epics_put(state, pv_name, 2, timeout);
 }
 
+/*
+ * epics.monitor -- CA subscriptions delivered to Lua callbacks.
+ *
+ * The monitor userdata is anchored in the registry until cancelled,
+ * so a monitor keeps running even if the script drops the returned
+ * object. CA callbacks copy each update into the state's event ring,
+ * and epics.poll runs the callbacks on the thread that owns the state.
+ */
+#define LEPICS_MONITOR_DEFAULT_QUEUE 16
+
+static void lepics_monitor_event(struct event_handler_args args)
+{
+	lepics_monitor* mon = (lepics_monitor*) args.usr;
+
+	if (args.status != ECA_NORMAL || ! args.dbr)    { return; }
+
+	/* Count the event before it can be seen by the consumer */
+	if (epicsAtomicIncrIntT(&mon->pending) > mon->max_queue)
+	{
+		epicsAtomicDecrIntT(&mon->pending);
+		epicsAtomicIncrIntT(&mon->overflows);
+		return;
+	}
+
+	/* All DBR_TIME_* structures begin with status, severity and stamp */
+	const struct dbr_time_double* header = (const struct dbr_time_double*) args.dbr;
+	size_t bytes = dbr_value_size[args.type] * args.count;
+
+	lepics_event event;
+
+	event.monitor = mon;
+	event.type = args.type;
+	event.count = args.count;
+	event.status = header->status;
+	event.severity = header->severity;
+	event.stamp = header->stamp;
+	event.data = malloc(bytes);
+
+	if (event.data)    { memcpy(event.data, dbr_value_ptr(args.dbr, args.type), bytes); }
+
+	if (! event.data || ! queue_push(mon->cache->queue, &event))
+	{
+		free(event.data);
+		epicsAtomicDecrIntT(&mon->pending);
+		epicsAtomicIncrIntT(&mon->overflows);
+		return;
+	}
+
+	mon->cache->queue_event.signal();
+}
+
+static void lepics_monitor_connection(struct connection_handler_args args)
+{
+	lepics_monitor* mon = (lepics_monitor*) ca_puser(args.chid);
+
+	mon->connected = (args.op == CA_OP_CONN_UP);
+
+	/* Subscriptions survive reconnects, so only subscribe once */
+	if (! mon->connected || mon->subscribed)    { return; }
+
+	unsigned long count = ca_element_count(args.chid);
+
+	if (mon->max_count > 0 && count > (unsigned long) mon->max_count)    { count = mon->max_count; }
+
+	chtype type;
+
+	switch (ca_field_type(args.chid))
+	{
+		case DBF_STRING: type = DBR_TIME_STRING; break;
+		case DBF_ENUM:   type = (mon->as_string == 1) ? DBR_TIME_STRING : DBR_TIME_ENUM; break;
+		case DBF_CHAR:   type = DBR_TIME_CHAR; break;
+		case DBF_SHORT:  type = DBR_TIME_SHORT; break;
+		case DBF_LONG:   type = DBR_TIME_LONG; break;
+		default:         type = DBR_TIME_DOUBLE; break;
+	}
+
+	int status = ca_create_subscription(type, count, args.chid, mon->mask,
+	                                    lepics_monitor_event, mon, &mon->event_id);
+
+	if (status != ECA_NORMAL)
+	{
+		errlogPrintf("epics.monitor: can't subscribe to '%s': %s\n", mon->pv_name, ca_message(status));
+		return;
+	}
+
+	mon->subscribed = 1;
+	ca_flush_io();
+}
+
+/* Pushes the value of a monitor event, following epics.get conventions */
+static void push_event_value(lua_State* state, const lepics_event* event, int as_string)
+{
+	long count = event->count;
+	long i;
+
+	if (event->type == DBR_TIME_CHAR && count > 1 && as_string != 0)
+	{
+		const char* chars = (const char*) event->data;
+		long length = 0;
+
+		while (length < count && chars[length])    { length++; }
+
+		lua_pushlstring(state, chars, length);
+		return;
+	}
+
+	if (count > 1)    { lua_createtable(state, count, 0); }
+
+	for (i = 0; i < count; i++)
+	{
+		switch (event->type)
+		{
+			case DBR_TIME_STRING: lua_pushstring(state, ((const dbr_string_t*) event->data)[i]); break;
+			case DBR_TIME_ENUM:   lua_pushinteger(state, ((const dbr_enum_t*) event->data)[i]); break;
+			case DBR_TIME_CHAR:   lua_pushinteger(state, ((const dbr_char_t*) event->data)[i]); break;
+			case DBR_TIME_SHORT:  lua_pushinteger(state, ((const dbr_short_t*) event->data)[i]); break;
+			case DBR_TIME_LONG:   lua_pushinteger(state, ((const dbr_long_t*) event->data)[i]); break;
+			default:              lua_pushnumber(state, ((const dbr_double_t*) event->data)[i]); break;
+		}
+
+		if (count > 1)    { lua_rawseti(state, -2, i + 1); }
+	}
+
+	if (count == 0)    { lua_pushnil(state); }
+}
+
+/* Drops the registry anchor once a cancelled monitor has no queued events */
+static void release_monitor(lua_State* state, lepics_monitor* mon)
+{
+	if (mon->cancelled && mon->self_ref != LUA_NOREF && epicsAtomicGetIntT(&mon->pending) == 0)
+	{
+		luaL_unref(state, LUA_REGISTRYINDEX, mon->self_ref);
+		mon->self_ref = LUA_NOREF;
+	}
+}
+
+static int l_monitor(lua_State* state)
+{
+	const char* pv_name = luaL_checkstring(state, 1);
+	luaL_checktype(state, 2, LUA_TFUNCTION);
+
+	long mask = DBE_VALUE | DBE_ALARM;
+	int max_queue = LEPICS_MONITOR_DEFAULT_QUEUE;
+	int max_count = 0;
+	int as_string = -1;
+
+	if (lua_istable(state, 3))
+	{
+		lua_getfield(state, 3, "mask");
+		if (!lua_isnil(state, -1))    { mask = (long) luaL_checkinteger(state, -1); }
+		lua_pop(state, 1);
+
+		lua_getfield(state, 3, "queue");
+		if (!lua_isnil(state, -1))    { max_queue = (int) luaL_checkinteger(state, -1); }
+		lua_pop(state, 1);
+
+		lua_getfield(state, 3, "count");
+		if (!lua_isnil(state, -1))    { max_count = (int) lua_tointeger(state, -1); }
+		lua_pop(state, 1);
+
+		lua_getfield(state, 3, "string");
+		if (!lua_isnil(state, -1))    { as_string = lua_toboolean(state, -1); }
+		lua_pop(state, 1);
+	}
+
+	if (max_queue < 1)    { max_queue = 1; }
+
+	lepics_ca_cache* cache = ensure_ca_context(state);
+
+	if (! cache)    { return luaL_error(state, "epics.monitor: thread is attached to a different CA context"); }
+
+	if (! cache->queue)
+	{
+		cache->queue = new lepics_event_queue;
+		cache->queue->head = 0;
+		cache->queue->tail = 0;
+	}
+
+	lepics_monitor* mon = (lepics_monitor*) lua_newuserdata(state, sizeof(lepics_monitor));
+
+	strncpy(mon->pv_name, pv_name, sizeof(mon->pv_name) - 1);
+	mon->pv_name[sizeof(mon->pv_name) - 1] = '\0';
+	mon->cache = cache;
+	mon->mask = mask;
+	mon->max_count = max_count;
+	mon->as_string = as_string;
+	mon->max_queue = max_queue;
+	mon->pending = 0;
+	mon->overflows = 0;
+	mon->connected = 0;
+	mon->subscribed = 0;
+	mon->cancelled = 0;
+	luaL_setmetatable(state, "lua_monitor");
+
+	lua_pushvalue(state, 2);
+	mon->callback_ref = luaL_ref(state, LUA_REGISTRYINDEX);
+
+	lua_pushvalue(state, -1);
+	mon->self_ref = luaL_ref(state, LUA_REGISTRYINDEX);
+
+	int status = ca_create_channel(mon->pv_name, lepics_monitor_connection, mon, 0, &mon->id);
+
+	if (status != ECA_NORMAL)
+	{
+		mon->cancelled = 1;
+		luaL_unref(state, LUA_REGISTRYINDEX, mon->callback_ref);
+		release_monitor(state, mon);
+		return luaL_error(state, "epics.monitor: failed to create channel for '%s'", pv_name);
+	}
+
+	cache->monitors.insert(mon);
+	ca_flush_io();
+
+	return 1;
+}
+
+static int l_monitor_cancel(lua_State* state)
+{
+	lepics_monitor* mon = (lepics_monitor*) luaL_checkudata(state, 1, "lua_monitor");
+
+	if (mon->cancelled)    { return 0; }
+
+	/* No callbacks for this channel run after ca_clear_channel returns */
+	ca_clear_channel(mon->id);
+	mon->cache->monitors.erase(mon);
+	mon->cancelled = 1;
+
+	luaL_unref(state, LUA_REGISTRYINDEX, mon->callback_ref);
+	mon->callback_ref = LUA_NOREF;
+
+	release_monitor(state, mon);
+
+	return 0;
+}
+
+static int l_monitor_index(lua_State* state)
+{
+	lepics_monitor* mon = (lepics_monitor*) luaL_checkudata(state, 1, "lua_monitor");
+	const char* key = luaL_checkstring(state, 2);
+
+	if      (! strcmp(key, "name"))         { lua_pushstring(state, mon->pv_name); }
+	else if (! strcmp(key, "connected"))    { lua_pushboolean(state, mon->connected && ! mon->cancelled); }
+	else if (! strcmp(key, "pending"))      { lua_pushinteger(state, epicsAtomicGetIntT(&mon->pending)); }
+	else if (! strcmp(key, "overflows"))    { lua_pushinteger(state, epicsAtomicGetIntT(&mon->overflows)); }
+	else if (! strcmp(key, "cancel"))       { lua_pushcfunction(state, l_monitor_cancel); }
+	else                                    { lua_pushnil(state); }
+
+	return 1;
+}
+
+static int l_monitor_tostring(lua_State* state)
+{
+	lepics_monitor* mon = (lepics_monitor*) luaL_checkudata(state, 1, "lua_monitor");
+	lua_pushfstring(state, "epics.monitor(%s)", mon->pv_name);
+	return 1;
+}
+
+/*
+ * epics.channels() -- returns a table of the channels cached by this
+ * state, mapping each PV name to whether its channel is connected.
+ */
+static int l_channels(lua_State* state)
+{
+	lua_getfield(state, LUA_REGISTRYINDEX, LEPICS_CA_CONTEXT_KEY);
+	lepics_ca_sentinel* sentinel = (lepics_ca_sentinel*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	lua_newtable(state);
+
+	if (! sentinel || ! sentinel->cache)    { return 1; }
+
+	channel_map::iterator it;
+
+	for (it = sentinel->cache->channels.begin(); it != sentinel->cache->channels.end(); ++it)
+	{
+		lua_pushboolean(state, it->second->connected);
+		lua_setfield(state, -2, it->first.c_str());
+	}
+
+	return 1;
+}
+
+/*
+ * epics.poll([timeout]) -- runs the callbacks of queued monitor
+ * events. If no events are queued, waits up to timeout seconds for
+ * one to arrive. Returns the number of callbacks run.
+ */
+static int l_poll(lua_State* state)
+{
+	double timeout = luaL_optnumber(state, 1, 0.0);
+
+	luaProfileSync(state);
+
+	lua_getfield(state, LUA_REGISTRYINDEX, LEPICS_CA_CONTEXT_KEY);
+	lepics_ca_sentinel* sentinel = (lepics_ca_sentinel*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	lepics_ca_cache* cache = sentinel ? sentinel->cache : NULL;
+
+	if (! cache || ! cache->queue)
+	{
+		if (timeout > 0.0)    { epicsThreadSleep(timeout); }
+
+		lua_pushinteger(state, 0);
+		return 1;
+	}
+
+	lepics_event_queue* queue = cache->queue;
+
+	if (timeout > 0.0 && queue->tail == epicsAtomicGetSizeT(&queue->head))
+	{
+		cache->queue_event.wait(timeout);
+	}
+
+	int delivered = 0;
+	lepics_event event;
+
+	while (queue_pop(queue, &event))
+	{
+		lepics_monitor* mon = event.monitor;
+
+		epicsAtomicDecrIntT(&mon->pending);
+
+		if (! mon->cancelled)
+		{
+			lua_rawgeti(state, LUA_REGISTRYINDEX, mon->callback_ref);
+			push_event_value(state, &event, mon->as_string);
+			lua_pushinteger(state, event.severity);
+			lua_pushinteger(state, event.status);
+			lua_pushnumber(state, event.stamp.secPastEpoch + event.stamp.nsec / 1e9);
+
+			if (lua_pcall(state, 4, 0, 0))
+			{
+				errlogPrintf("epics.monitor callback for '%s': %s\n", mon->pv_name, lua_tostring(state, -1));
+				lua_pop(state, 1);
+			}
+
+			delivered += 1;
+		}
+
+		free(event.data);
+		release_monitor(state, mon);
+	}
+
+	lua_pushinteger(state, delivered);
+	return 1;
+}
+
+/*
+ * epics.scan(name) -- requests I/O Intr processing of the DTYP "lua"
+ * records on the named scan list. Returns false if no record uses
+ * that list.
+ */
+static int l_scan(lua_State* state)
+{
+	const char* name = luaL_checkstring(state, 1);
+
+	lua_pushboolean(state, luaRequestScan(name));
+	return 1;
+}
+
 /*
  * lua_pv -- userdata representing an EPICS PV.
- * Field access via __index/__newindex dispatches to epics_get/epics_put,
- * which automatically use direct database access for local PVs or
- * Channel Access for remote PVs.
+ * Field access via __index/__newindex uses direct database access for
+ * local PVs or Channel Access for remote PVs. Whether a field is local,
+ * and its DBADDR if it is, is resolved on first access and kept in a
+ * small per-object cache, so repeat accesses skip building "name.FIELD"
+ * and the dbNameToAddr lookup.
  */
+#define LUA_PV_CACHED_FIELDS 8
+
+typedef struct {
+	char   field[16];
+	int    local;     /* 0 if the field isn't in this IOC's database */
+	DBADDR addr;
+} lua_pv_field;
+
 typedef struct {
-	char pv_name[128];
+	char         pv_name[128];
+	int          num_fields;
+	int          next_field;
+	lua_pv_field fields[LUA_PV_CACHED_FIELDS];
 } lua_pv;
 
+/* Takes a cache slot for field, replacing the oldest entry once the cache is full */
+static lua_pv_field* pv_cache_field(lua_pv* pv, const char* field)
+{
+	lua_pv_field* slot = &pv->fields[pv->next_field];
+
+	pv->next_field = (pv->next_field + 1) % LUA_PV_CACHED_FIELDS;
+	if (pv->num_fields < LUA_PV_CACHED_FIELDS)    { pv->num_fields++; }
+
+	strcpy(slot->field, field);
+
+	return slot;
+}
+
+/*
+ * Returns the DBADDR of a local field, resolving and caching it on
+ * first use. Field names too long for the cache are resolved into
+ * the scratch address. Returns NULL if the field isn't a local PV.
+ * Misses are only cached once iocInit has run, as records can still
+ * be loaded before then.
+ */
+static DBADDR* pv_field_addr(lua_pv* pv, const char* field, DBADDR* scratch)
+{
+	int index;
+
+	for (index = 0; index < pv->num_fields; index++)
+	{
+		lua_pv_field* cached = &pv->fields[index];
+
+		if (strcmp(cached->field, field) == 0)    { return cached->local ? &cached->addr : NULL; }
+	}
+
+	if (! iocshPpdbbase || ! *iocshPpdbbase)    { return NULL; }
+
+	std::string full_name(pv->pv_name);
+	full_name.append(".");
+	full_name.append(field);
+
+	bool cacheable = strlen(field) < sizeof(pv->fields[0].field);
+
+	if (dbNameToAddr(full_name.c_str(), scratch))
+	{
+		if (cacheable && interruptAccept)    { pv_cache_field(pv, field)->local = 0; }
+
+		return NULL;
+	}
+
+	if (! cacheable)    { return scratch; }
+
+	lua_pv_field* slot = pv_cache_field(pv, field);
+
+	slot->local = 1;
+	slot->addr = *scratch;
+
+	return &slot->addr;
+}
+
+static int pv_get_field(lua_State* state, lua_pv* pv, const char* field,
+                        double timeout, int max_count, int as_string, int array_index)
+{
+	DBADDR scratch;
+	DBADDR* paddr = pv_field_addr(pv, field, &scratch);
+	int fill_index = (array_index > 0) ? array_index : 0;
+
+	if (paddr && array_index)    { return db_get_array(state, paddr, max_count, fill_index); }
+	if (paddr)                   { return db_get(state, paddr, max_count, as_string); }
+
+	std::string full_name(pv->pv_name);
+	full_name.append(".");
+	full_name.append(field);
+
+	if (array_index)    { return ca_get_array(state, full_name.c_str(), timeout, max_count, fill_index); }
+
+	return ca_get_value(state, full_name.c_str(), timeout, max_count, as_string);
+}
+
+static int pv_put_field(lua_State* state, lua_pv* pv, const char* field, int offset, double timeout)
+{
+	DBADDR scratch;
+	DBADDR* paddr = pv_field_addr(pv, field, &scratch);
+
+	if (paddr)    { return db_put(state, paddr, offset); }
+
+	std::string full_name(pv->pv_name);
+	full_name.append(".");
+	full_name.append(field);
+
+	return ca_put_value(state, full_name.c_str(), offset, timeout);
+}
+
 /*
  * pv:get(field [, options])
  *
  *   pv:get("VAL")
  *   pv:get("VAL", {timeout=5.0, string=true, count=100})
+ *   pv:get("VAL", {array=true})
  */
 static int l_pv_get(lua_State* state)
 {
@@ -973,6 +2096,7 @@ static int l_pv_get(lua_State* state)
 	double timeout = 1.0;
 	int max_count = 0;
 	int as_string = -1;
+	int array_index = 0;
 
 	if (lua_istable(state, 3))
 	{
@@ -987,17 +2111,15 @@ static int l_pv_get(lua_State* state)
 		lua_getfield(state, 3, "string");
 		if (!lua_isnil(state, -1))    { as_string = lua_toboolean(state, -1); }
 		lua_pop(state, 1);
+
+		array_index = array_option(state, 3);
 	}
 	else if (lua_isnumber(state, 3))
 	{
 		timeout = lua_tonumber(state, 3);
 	}
 
-	std::string full_name(pv->pv_name);
-	full_name.append(".");
-	full_name.append(field);
-
-	return epics_get(state, full_name.c_str(), timeout, max_count, as_string);
+	return pv_get_field(state, pv, field, timeout, max_count, as_string, array_index);
 }
 
 /*
@@ -1024,11 +2146,7 @@ static int l_pv_put(lua_State* state)
 		timeout = lua_tonumber(state, 4);
 	}
 
-	std::string full_name(pv->pv_name);
-	full_name.append(".");
-	full_name.append(field);
-
-	return epics_put(state, full_name.c_str(), 3, timeout);
+	return pv_put_field(state, pv, field, 3, timeout);
 }
 
 static int l_pv_index(lua_State* state)
@@ -1047,12 +2165,8 @@ static int l_pv_index(lua_State* state)
 	if (strcmp(key, "get") == 0)    { lua_pushcfunction(state, l_pv_get); return 1; }
 	if (strcmp(key, "put") == 0)    { lua_pushcfunction(state, l_pv_put); return 1; }
 
-	/* Field access -- build pv_name.field and read */
-	std::string full_name(pv->pv_name);
-	full_name.append(".");
-	full_name.append(key);
-
-	return epics_get(state, full_name.c_str(), 1.0, 0, -1);
+	/* Field access */
+	return pv_get_field(state, pv, key, 1.0, 0, -1, 0);
 }
 
 static int l_pv_newindex(lua_State* state)
@@ -1060,18 +2174,7 @@ static int l_pv_newindex(lua_State* state)
 	lua_pv* pv = (lua_pv*) luaL_checkudata(state, 1, "lua_pv");
 	const char* key = luaL_checkstring(state, 2);
 
-	std::string full_name(pv->pv_name);
-	full_name.append(".");
-	full_name.append(key);
-
-	return epics_put(state, full_name.c_str(), 3, 1.0);
-}
-
-static int l_pv_gc(lua_State* state)
-{
-	/* No resources to free currently.
-	 * Future: close cached CA channels here. */
-	return 0;
+	return pv_put_field(state, pv, key, 3, 1.0);
 }
 
 static int l_pv_tostring(lua_State* state)
@@ -1110,6 +2213,8 @@ extern "C"
 		lua_pv* pv = (lua_pv*) lua_newuserdata(state, sizeof(lua_pv));
 		strncpy(pv->pv_name, pv_name, sizeof(pv->pv_name) - 1);
 		pv->pv_name[sizeof(pv->pv_name) - 1] = '\0';
+		pv->num_fields = 0;
+		pv->next_field = 0;
 		luaL_setmetatable(state, "lua_pv");
 	}
 }
@@ -1135,8 +2240,6 @@ int luaopen_epics (lua_State *L)
 		lua_setfield(L, -2, "__index");
 		lua_pushcfunction(L, l_pv_newindex);
 		lua_setfield(L, -2, "__newindex");
-		lua_pushcfunction(L, l_pv_gc);
-		lua_setfield(L, -2, "__gc");
 		lua_pushcfunction(L, l_pv_tostring);
 		lua_setfield(L, -2, "__tostring");
 		lua_pushstring(L, "epics.pv");
@@ -1147,26 +2250,61 @@ int luaopen_epics (lua_State *L)
 		lua_pushstring(L, ".name                       -- PV name (property)"); lua_rawseti(L, -2, 1);
 		lua_pushstring(L, ".FIELD                      -- read field value"); lua_rawseti(L, -2, 2);
 		lua_pushstring(L, ".FIELD = value              -- write field value"); lua_rawseti(L, -2, 3);
-		lua_pushstring(L, ":get(field [, {timeout, count, string}])"); lua_rawseti(L, -2, 4);
+		lua_pushstring(L, ":get(field [, {timeout, count, string, array}])"); lua_rawseti(L, -2, 4);
 		lua_pushstring(L, ":put(field, value [, {timeout}])"); lua_rawseti(L, -2, 5);
 		lua_setfield(L, -2, "_doc");
 	}
 	lua_pop(L, 1);
 
+	/* Register the lua_monitor metatable */
+	if (luaL_newmetatable(L, "lua_monitor"))
+	{
+		lua_pushcfunction(L, l_monitor_index);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, l_monitor_tostring);
+		lua_setfield(L, -2, "__tostring");
+		lua_pushstring(L, "epics.monitor");
+		lua_setfield(L, -2, "__name");
+
+		/* Documentation for info(monitor_object) */
+		lua_newtable(L);
+		lua_pushstring(L, ".name        -- PV name (property)"); lua_rawseti(L, -2, 1);
+		lua_pushstring(L, ".connected   -- channel connection state"); lua_rawseti(L, -2, 2);
+		lua_pushstring(L, ".pending     -- events waiting for epics.poll"); lua_rawseti(L, -2, 3);
+		lua_pushstring(L, ".overflows   -- events dropped on a full queue"); lua_rawseti(L, -2, 4);
+		lua_pushstring(L, ":cancel()    -- stop the subscription"); lua_rawseti(L, -2, 5);
+		lua_setfield(L, -2, "_doc");
+	}
+	lua_pop(L, 1);
+
 	static const luaL_Reg mylib[] = {
-		{"get",   l_caget},
-		{"put",   l_caput},
-		{"pv",    l_createpv},
+		{"get",     l_caget},
+		{"put",     l_caput},
+		{"pv",      l_createpv},
+		{"monitor", l_monitor},
+		{"poll",    l_poll},
+		{"channels", l_channels},
+		{"scan",    l_scan},
+		{"array",   luaArrayConstructor},
 		{NULL, NULL}
 	};
 
 	luaL_newlib(L, mylib);
 
+	lua_pushinteger(L, DBE_VALUE); lua_setfield(L, -2, "DBE_VALUE");
+	lua_pushinteger(L, DBE_LOG);   lua_setfield(L, -2, "DBE_LOG");
+	lua_pushinteger(L, DBE_ALARM); lua_setfield(L, -2, "DBE_ALARM");
+
 	/* Documentation for info(epics) */
 	lua_newtable(L);
-	lua_pushstring(L, ".get(PV [, timeout | {timeout, count, string}])"); lua_rawseti(L, -2, 1);
+	lua_pushstring(L, ".get(PV [, timeout | {timeout, count, string, array}])"); lua_rawseti(L, -2, 1);
 	lua_pushstring(L, ".put(PV, value [, timeout | {timeout}])"); lua_rawseti(L, -2, 2);
 	lua_pushstring(L, ".pv(PV) -- create PV proxy object"); lua_rawseti(L, -2, 3);
+	lua_pushstring(L, ".monitor(PV, callback [, {mask, queue, count, string}])"); lua_rawseti(L, -2, 4);
+	lua_pushstring(L, ".poll([timeout]) -- run queued monitor callbacks"); lua_rawseti(L, -2, 5);
+	lua_pushstring(L, ".scan(name) -- process I/O Intr records on a scan list"); lua_rawseti(L, -2, 6);
+	lua_pushstring(L, ".array([type,] count | table) -- typed numeric array"); lua_rawseti(L, -2, 7);
+	lua_pushstring(L, ".channels() -- cached CA channels and their connection state"); lua_rawseti(L, -2, 8);
 	lua_setfield(L, -2, "_doc");
 
 	return 1;
@@ -1177,4 +2315,5 @@ static void libepicsRegister(void)    { luaRegisterLibrary("epics", luaopen_epic
 extern "C"
 {
 	epicsExportRegistrar(libepicsRegister);
+	epicsExportAddress(double, luaCaChannelIdleTimeout);
 }
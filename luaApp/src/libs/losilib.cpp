@@ -68,6 +68,10 @@ static int l_resetStdout(lua_State* state)
 static int l_osisleep(lua_State* state)
 {
 	double seconds = lua_tonumber(state, 1);
+
+	/* Long-running scripts loop around sleeps, not fresh calls */
+	luaProfileSync(state);
+
 	epicsThreadSleep(seconds);
 	return 0;
 }
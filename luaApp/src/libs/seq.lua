@@ -10,6 +10,7 @@
 --
 
 local osi = require("osi")
+local epics = require("epics")
 local seq_support = require("seq_support")
 
 local seq = {}
@@ -234,8 +235,10 @@ function seq._scheduler()
 			end
 		end
 
-		if #coroutines > 0 and not any_fired then
-			osi.sleep(min_poll)
+		-- Run callbacks of epics.monitor subscriptions. When idle,
+		-- wait up to one poll period, waking early on a monitor event.
+		if #coroutines > 0 then
+			epics.poll(any_fired and 0 or min_poll)
 		end
 	end
 end
@@ -0,0 +1,632 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsTime.h>
+#include <epicsExport.h>
+
+#define epicsExportSharedSymbols
+#include "luaEpics.h"
+
+/*
+ * Per-state memory allocator
+ *
+ * States created by luaCreateState allocate through a memory_pool
+ * instead of the default realloc based allocator. Every pool keeps
+ * its own accounting, so the memory held by each state can be
+ * reported, and can be given a limit past which allocations fail
+ * the same way they would if the system ran out of memory.
+ *
+ * When luaPooledAllocator is set, blocks up to POOL_MAX_BLOCK bytes
+ * (strings, table nodes, closures, upvalues) are carved out of
+ * per-state slabs, grouped into size classes POOL_GRANULE bytes
+ * apart. A state only ever runs on one thread at a time, so the
+ * slabs need no lock, and freed blocks are reused without going back
+ * through malloc. Slabs are released when the state is closed.
+ *
+ * The pool also holds the state's other statistics: the owner set with
+ * luaSetStateOwner, the number of garbage collection cycles, the
+ * calls made through luaTimedCall, and the budget of the luaBudgetCall
+ * currently running.
+ */
+
+#define POOL_GRANULE     16
+#define POOL_CLASSES     16
+#define POOL_MAX_BLOCK   (POOL_GRANULE * POOL_CLASSES)
+#define POOL_SLAB_BYTES  4096
+
+/* Set to 1 to serve small allocations from per-state slabs */
+int luaPooledAllocator = 0;
+
+/*
+ * Default memory limit in bytes for new states, 0 for no limit. Applied
+ * by luaCreateState once the state's libraries are loaded.
+ */
+int luaStateMemoryLimit = 0;
+
+typedef struct free_block
+{
+	struct free_block* next;
+} free_block;
+
+typedef struct call_budget
+{
+	long     limit;
+	long     remaining;
+	int      step;
+	lua_Hook hook;
+	int      mask;
+	int      count;
+	struct call_budget* outer;
+} call_budget;
+
+typedef struct memory_pool
+{
+	lua_State*    state;
+	bool          pooled;
+	size_t        limit;
+	size_t        bytes;
+	size_t        peak;
+	size_t        blocks;
+	size_t        slab_bytes;
+	unsigned long failures;
+
+	free_block*   free_lists[POOL_CLASSES];
+	std::vector<void*> slabs;
+
+	std::string   owner;
+	unsigned long gc_cycles;
+	unsigned long calls;
+	double        call_seconds;
+	call_budget*  budget;
+} memory_pool;
+
+static std::set<memory_pool*> memory_pools;
+static epicsMutex memoryPoolsMutex;
+
+
+static bool inSlab(const memory_pool* pool, size_t size)
+{
+	return pool->pooled && size <= POOL_MAX_BLOCK;
+}
+
+static size_t sizeClass(size_t size)
+{
+	return (size - 1) / POOL_GRANULE;
+}
+
+static void* slabTake(memory_pool* pool, size_t size)
+{
+	size_t index = sizeClass(size);
+
+	if (! pool->free_lists[index])
+	{
+		size_t block_size = (index + 1) * POOL_GRANULE;
+		char* slab = (char*) malloc(POOL_SLAB_BYTES);
+
+		if (! slab)    { return NULL; }
+
+		try
+		{
+			pool->slabs.push_back(slab);
+		}
+		catch (std::bad_alloc&)
+		{
+			free(slab);
+			return NULL;
+		}
+
+		pool->slab_bytes += POOL_SLAB_BYTES;
+
+		for (size_t offset = 0; offset + block_size <= POOL_SLAB_BYTES; offset += block_size)
+		{
+			free_block* block = (free_block*) (slab + offset);
+
+			block->next = pool->free_lists[index];
+			pool->free_lists[index] = block;
+		}
+	}
+
+	free_block* output = pool->free_lists[index];
+	pool->free_lists[index] = output->next;
+
+	return output;
+}
+
+static void slabGive(memory_pool* pool, void* ptr, size_t size)
+{
+	size_t index = sizeClass(size);
+	free_block* block = (free_block*) ptr;
+
+	block->next = pool->free_lists[index];
+	pool->free_lists[index] = block;
+}
+
+static void unlistPool(memory_pool* pool)
+{
+	epicsGuard<epicsMutex> guard(memoryPoolsMutex);
+	memory_pools.erase(pool);
+}
+
+static void destroyPool(memory_pool* pool)
+{
+	unlistPool(pool);
+
+	for (size_t i = 0; i < pool->slabs.size(); i++)    { free(pool->slabs[i]); }
+
+	delete pool;
+}
+
+/*
+ * lua_Alloc implementation. Lua passes the size of the existing block
+ * in osize whenever ptr is not NULL, so blocks carry no header.
+ * Following the lua_Alloc contract, the limit is only applied when
+ * a block grows.
+ */
+static void* poolAlloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	memory_pool* pool = (memory_pool*) ud;
+
+	if (! ptr)    { osize = 0; }
+
+	if (nsize == 0)
+	{
+		if (! ptr)    { return NULL; }
+
+		/*
+		 * The last block is the state itself, freed by lua_close. The
+		 * pool leaves the list first, so luaForEachState never sees a
+		 * freed state.
+		 */
+		bool last = (pool->blocks == 1 && pool->state);
+
+		if (last)    { unlistPool(pool); }
+
+		if (inSlab(pool, osize))    { slabGive(pool, ptr, osize); }
+		else                        { free(ptr); }
+
+		pool->bytes -= osize;
+		pool->blocks--;
+
+		if (last)    { destroyPool(pool); }
+
+		return NULL;
+	}
+
+	if (nsize > osize && pool->limit && pool->bytes - osize + nsize > pool->limit)
+	{
+		pool->failures++;
+		return NULL;
+	}
+
+	bool old_slab = ptr && inSlab(pool, osize);
+	bool new_slab = inSlab(pool, nsize);
+
+	void* output;
+
+	if (old_slab && new_slab && sizeClass(osize) == sizeClass(nsize))
+	{
+		output = ptr;
+	}
+	else if (! old_slab && ! new_slab)
+	{
+		output = realloc(ptr, nsize);
+	}
+	else
+	{
+		output = new_slab ? slabTake(pool, nsize) : malloc(nsize);
+
+		if (output && ptr)
+		{
+			memcpy(output, ptr, (osize < nsize) ? osize : nsize);
+
+			if (old_slab)    { slabGive(pool, ptr, osize); }
+			else             { free(ptr); }
+		}
+	}
+
+	if (! output)
+	{
+		pool->failures++;
+		return NULL;
+	}
+
+	pool->bytes = pool->bytes - osize + nsize;
+	if (! ptr)    { pool->blocks++; }
+
+	if (pool->bytes > pool->peak)    { pool->peak = pool->bytes; }
+
+	return output;
+}
+
+static memory_pool* statePool(lua_State* state)
+{
+	void* ud = NULL;
+
+	if (! state || lua_getallocf(state, &ud) != poolAlloc)    { return NULL; }
+
+	return (memory_pool*) ud;
+}
+
+/*
+ * Lua doesn't count its collection cycles, so each state holds an
+ * unreferenced table whose finalizer runs once the collector has
+ * been around, counts the cycle, and leaves a new table behind.
+ */
+static void newSentinel(lua_State* state);
+
+static int gcSentinel(lua_State* state)
+{
+	memory_pool* pool = statePool(state);
+
+	if (pool)    { pool->gc_cycles++; }
+
+	newSentinel(state);
+	return 0;
+}
+
+static void newSentinel(lua_State* state)
+{
+	lua_newtable(state);
+
+	if (luaL_newmetatable(state, "lua_gc_sentinel"))
+	{
+		lua_pushcfunction(state, gcSentinel);
+		lua_setfield(state, -2, "__gc");
+	}
+
+	lua_setmetatable(state, -2);
+	lua_pop(state, 1);
+}
+
+static int l_newSentinel(lua_State* state)
+{
+	newSentinel(state);
+	return 0;
+}
+
+static int statePanic(lua_State* state)
+{
+	const char* message = lua_tostring(state, -1);
+
+	if (! message)    { message = "error object is not a string"; }
+
+	errlogPrintf("PANIC: unprotected error in call to Lua API (%s)\n", message);
+	return 0;
+}
+
+/* Warnings start disabled, "@on" and "@off" switch them, as with luaL_newstate */
+static void warnOff(void* ud, const char* message, int tocont);
+static void warnOn(void* ud, const char* message, int tocont);
+
+static void warnContinue(void* ud, const char* message, int tocont)
+{
+	lua_State* state = (lua_State*) ud;
+
+	fputs(message, stderr);
+
+	if (tocont)    { lua_setwarnf(state, warnContinue, state); }
+	else
+	{
+		fputs("\n", stderr);
+		lua_setwarnf(state, warnOn, state);
+	}
+}
+
+static bool warnControl(lua_State* state, const char* message, int tocont)
+{
+	if (tocont || *message != '@')    { return false; }
+
+	if      (strcmp(message, "@off") == 0)    { lua_setwarnf(state, warnOff, state); }
+	else if (strcmp(message, "@on") == 0)     { lua_setwarnf(state, warnOn, state); }
+
+	return true;
+}
+
+static void warnOff(void* ud, const char* message, int tocont)
+{
+	warnControl((lua_State*) ud, message, tocont);
+}
+
+static void warnOn(void* ud, const char* message, int tocont)
+{
+	if (warnControl((lua_State*) ud, message, tocont))    { return; }
+
+	fputs("Lua warning: ", stderr);
+	warnContinue(ud, message, tocont);
+}
+
+
+/*
+ * Replacement for luaL_newstate that allocates through a
+ * memory_pool owned by the new state.
+ */
+epicsShareFunc lua_State* luaNewState()
+{
+	memory_pool* pool = new (std::nothrow) memory_pool();
+
+	if (! pool)    { return NULL; }
+
+	pool->state = NULL;
+	pool->pooled = (luaPooledAllocator != 0);
+	pool->limit = 0;
+	pool->bytes = 0;
+	pool->peak = 0;
+	pool->blocks = 0;
+	pool->slab_bytes = 0;
+	pool->failures = 0;
+	pool->gc_cycles = 0;
+	pool->calls = 0;
+	pool->call_seconds = 0.0;
+	pool->budget = NULL;
+
+	for (int i = 0; i < POOL_CLASSES; i++)    { pool->free_lists[i] = NULL; }
+
+	lua_State* output = lua_newstate(poolAlloc, pool);
+
+	/* Until pool->state is set, poolAlloc leaves the pool alone */
+	if (! output)
+	{
+		destroyPool(pool);
+		return NULL;
+	}
+
+	pool->state = output;
+
+	lua_atpanic(output, statePanic);
+	lua_setwarnf(output, warnOff, output);
+
+	{
+		epicsGuard<epicsMutex> guard(memoryPoolsMutex);
+		memory_pools.insert(pool);
+	}
+
+	/* Protected, running out of memory here must not panic */
+	lua_pushcfunction(output, l_newSentinel);
+
+	if (lua_pcall(output, 0, 0, 0) != LUA_OK)
+	{
+		lua_close(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+static void copyStats(const memory_pool* pool, lua_state_stats* stats)
+{
+	stats->bytes = pool->bytes;
+	stats->peak = pool->peak;
+	stats->blocks = pool->blocks;
+	stats->slab_bytes = pool->slab_bytes;
+	stats->limit = pool->limit;
+	stats->failures = pool->failures;
+	stats->gc_cycles = pool->gc_cycles;
+	stats->calls = pool->calls;
+	stats->call_seconds = pool->call_seconds;
+}
+
+epicsShareFunc int luaStateStats(lua_State* state, lua_state_stats* stats)
+{
+	memory_pool* pool = statePool(state);
+
+	if (! pool || ! stats)    { return -1; }
+
+	copyStats(pool, stats);
+	return 0;
+}
+
+epicsShareFunc int luaSetMemoryLimit(lua_State* state, size_t bytes)
+{
+	memory_pool* pool = statePool(state);
+
+	if (! pool)    { return -1; }
+
+	pool->limit = bytes;
+	return 0;
+}
+
+/* Gives a state that is fully set up the limit from luaStateMemoryLimit */
+epicsShareFunc void luaApplyMemoryLimit(lua_State* state)
+{
+	if (luaStateMemoryLimit > 0)    { luaSetMemoryLimit(state, (size_t) luaStateMemoryLimit); }
+}
+
+/* Describes what the state is used for, shown by luaStateReport */
+epicsShareFunc void luaSetStateOwner(lua_State* state, const char* owner)
+{
+	memory_pool* pool = statePool(state);
+
+	if (! pool)    { return; }
+
+	epicsGuard<epicsMutex> guard(memoryPoolsMutex);
+	pool->owner = owner ? owner : "";
+}
+
+/*
+ * lua_pcall, with the time spent added to the state's statistics.
+ * Used where records, device support, and port drivers call into
+ * their scripts.
+ */
+epicsShareFunc int luaTimedCall(lua_State* state, int nargs, int nresults, int msgh)
+{
+	memory_pool* pool = statePool(state);
+
+	luaProfileSync(state);
+
+	if (! pool)    { return lua_pcall(state, nargs, nresults, msgh); }
+
+	epicsTimeStamp start, end;
+
+	epicsTimeGetCurrent(&start);
+	int status = lua_pcall(state, nargs, nresults, msgh);
+	epicsTimeGetCurrent(&end);
+
+	pool->calls++;
+	pool->call_seconds += epicsTimeDiffInSeconds(&end, &start);
+
+	return status;
+}
+
+/*
+ * Count hook for luaBudgetCall. Runs the hook it replaced (usually the
+ * profiler) and raises an error once the instructions run out. From
+ * then on it fires on every instruction, so a pcall in the script
+ * can't catch the error and carry on.
+ */
+static void budgetHook(lua_State* state, lua_Debug* ar)
+{
+	memory_pool* pool = statePool(state);
+	call_budget* budget = pool ? pool->budget : NULL;
+
+	/* A coroutine created during a limited call, resumed after it returned */
+	if (! budget)
+	{
+		lua_sethook(state, NULL, 0, 0);
+		luaProfileSync(state);
+		return;
+	}
+
+	if (budget->hook && (budget->mask & LUA_MASKCOUNT))    { budget->hook(state, ar); }
+
+	budget->remaining -= budget->step;
+
+	if (budget->remaining <= 0)
+	{
+		budget->step = 1;
+		lua_sethook(state, budgetHook, LUA_MASKCOUNT, 1);
+
+		/* Level 0, a hook has no frame of its own */
+		luaL_where(state, 0);
+		lua_pushfstring(state, "instruction budget of %I exceeded", (lua_Integer) budget->limit);
+		lua_concat(state, 2);
+		lua_error(state);
+	}
+}
+
+/*
+ * luaTimedCall, aborted with an error if the call runs more than the
+ * given number of VM instructions. A limit of 0 or less is no limit.
+ * Calls nested in a limited call count against both budgets.
+ */
+epicsShareFunc int luaBudgetCall(lua_State* state, int nargs, int nresults, int msgh, long instructions)
+{
+	memory_pool* pool = statePool(state);
+
+	if (instructions <= 0 || ! pool)    { return luaTimedCall(state, nargs, nresults, msgh); }
+
+	/* So the budget hook chains to the profiler if it just started */
+	luaProfileSync(state);
+
+	call_budget budget;
+
+	budget.limit = instructions;
+	budget.remaining = instructions;
+	budget.hook = lua_gethook(state);
+	budget.mask = lua_gethookmask(state);
+	budget.count = lua_gethookcount(state);
+	budget.outer = pool->budget;
+
+	if (budget.hook == budgetHook)    { budget.hook = NULL; }
+
+	budget.step = (instructions < INT_MAX) ? (int) instructions : INT_MAX;
+
+	if (budget.hook && (budget.mask & LUA_MASKCOUNT) && budget.count < budget.step)
+	{
+		budget.step = budget.count;
+	}
+
+	pool->budget = &budget;
+	lua_sethook(state, budgetHook, LUA_MASKCOUNT, budget.step);
+
+	int status = luaTimedCall(state, nargs, nresults, msgh);
+
+	pool->budget = budget.outer;
+
+	/* Leave alone a hook set during the call, like the shell's interrupt */
+	if (lua_gethook(state) == budgetHook)
+	{
+		if (budget.outer)
+		{
+			budget.outer->remaining -= budget.limit - budget.remaining;
+			lua_sethook(state, budgetHook, LUA_MASKCOUNT, budget.outer->step);
+		}
+		else if (budget.hook)
+		{
+			lua_sethook(state, budget.hook, budget.mask, budget.count);
+		}
+		else
+		{
+			lua_sethook(state, NULL, 0, 0);
+			luaProfileSync(state);
+		}
+	}
+
+	return status;
+}
+
+/* Calls visit for every open state while holding the pool lock */
+epicsShareFunc void luaForEachState(LUA_STATE_VISITOR visit, void* arg)
+{
+	epicsGuard<epicsMutex> guard(memoryPoolsMutex);
+
+	for (std::set<memory_pool*>::iterator it = memory_pools.begin(); it != memory_pools.end(); it++)
+	{
+		lua_state_stats stats;
+
+		copyStats(*it, &stats);
+		visit((*it)->state, &stats, (*it)->owner.c_str(), arg);
+	}
+}
+
+/*
+ * Prints the memory held by every open state. Counters are read
+ * without stopping the states, so busy states may be a few
+ * allocations out of date.
+ */
+epicsShareFunc void luaMemoryReport(void)
+{
+	epicsGuard<epicsMutex> guard(memoryPoolsMutex);
+
+	size_t total = 0;
+
+	printf("%-18s %12s %12s %10s %12s %12s %8s\n",
+	       "State", "Bytes", "Peak", "Blocks", "Slab bytes", "Limit", "Failed");
+
+	for (std::set<memory_pool*>::iterator it = memory_pools.begin(); it != memory_pools.end(); it++)
+	{
+		memory_pool* pool = *it;
+
+		char limit[32] = "-";
+		if (pool->limit)    { epicsSnprintf(limit, sizeof(limit), "%lu", (unsigned long) pool->limit); }
+
+		printf("%-18p %12lu %12lu %10lu %12lu %12s %8lu\n",
+		       (void*) pool->state,
+		       (unsigned long) pool->bytes,
+		       (unsigned long) pool->peak,
+		       (unsigned long) pool->blocks,
+		       (unsigned long) pool->slab_bytes,
+		       limit,
+		       pool->failures);
+
+		total += pool->bytes;
+	}
+
+	printf("%lu states, %lu bytes\n", (unsigned long) memory_pools.size(), (unsigned long) total);
+}
+
+
+extern "C"
+{
+	epicsExportAddress(int, luaPooledAllocator);
+	epicsExportAddress(int, luaStateMemoryLimit);
+}
@@ -3,8 +3,10 @@
 #include <sstream>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <map>
+#include <sys/stat.h>
 
 #if defined(__vxworks) || defined(vxWorks)
 	#include <symLib.h>
@@ -15,9 +17,12 @@
 #include <iocsh.h>
 #include <errlog.h>
 #include <epicsStdio.h>
+#include <epicsString.h>
+#include <epicsStdlib.h>
 #include <epicsFindSymbol.h>
 #include <epicsMutex.h>
 #include <epicsGuard.h>
+#include <epicsTime.h>
 #include <epicsExport.h>
 
 #define epicsExportSharedSymbols
@@ -41,23 +46,117 @@ static epicsMutex refcountMutex;
 /* Forward declaration: defined in path management section below */
 static void rebuildPaths(lua_State* state);
 
-static FILE* temp_help = tmpfile();
+/* Counters for the unknown names resolved by the iocsh library */
+static unsigned long iocsh_lookups = 0;
+static unsigned long iocsh_env_hits = 0;
+static unsigned long iocsh_command_hits = 0;
+static double iocsh_lookup_seconds = 0.0;
+static epicsMutex iocshStatsMutex;
+
+/*
+ * Compiled chunk cache. Scripts loaded by luaLoadScript are compiled
+ * once per process and kept as lua_dump output, keyed by the resolved
+ * path. Entries are reused while the file's modification time and size
+ * are unchanged. If LUA_BYTECODE_CACHE names a directory, compiled
+ * chunks are also written there so that restarts skip parsing.
+ */
+typedef struct
+{
+	time_t      mtime;
+	off_t       size;
+	std::string bytecode;
+} compiled_chunk;
+
+static std::map<std::string, compiled_chunk> chunk_cache;
+static epicsMutex chunkCacheMutex;
+
+/* Set to 0 to always compile scripts from source */
+int luaBytecodeCache = 1;
+
+/*
+ * Resolved script locations, keyed by file name. Entries are tagged
+ * with the search path generation, which luaAddPath bumps. A change
+ * of LUA_SCRIPT_PATH clears the map.
+ */
+typedef struct
+{
+	unsigned long generation;
+	std::string   path;          /* empty if the file wasn't found */
+} located_file;
+
+static std::map<std::string, located_file> located_files;
+static std::string located_env_path;
+static unsigned long path_generation = 0;
+static unsigned long locate_hits = 0;
+static unsigned long locate_misses = 0;
+static epicsMutex locateMutex;
 
 /* Hook Routines */
 
 epicsShareDef LUA_LIBRARY_LOAD_HOOK_ROUTINE luaLoadLibraryHook = NULL;
 epicsShareDef LUA_FUNCTION_LOAD_HOOK_ROUTINE luaLoadFunctionHook = NULL;
 
+static bool fileExists(const std::string& path)
+{
+	struct stat info;
+
+	return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) != S_IFDIR;
+}
+
+/*
+ * Searches LUA_SCRIPT_PATH, the directories registered with
+ * luaAddPath, and the current directory, in that order.
+ */
+static std::string searchScriptPath(const std::string& filename, const char* env_path)
+{
+	/* Search LUA_SCRIPT_PATH directories */
+	if (env_path)
+	{
+		std::stringstream path;
+		path << env_path;
+
+		std::string segment;
+		while (std::getline(path, segment, ':'))
+		{
+			std::string fullpath = segment + "/" + filename;
+			if (fileExists(fullpath))    { return fullpath; }
+		}
+	}
+
+	/* Search directories registered via luaAddPath */
+	{
+		epicsGuard<epicsMutex> guard(registryMutex);
+
+		for (size_t i = 0; i < registered_paths.size(); i++)
+		{
+			std::string fullpath = registered_paths[i] + "/" + filename;
+			if (fileExists(fullpath))    { return fullpath; }
+		}
+	}
+
+	/* Search current directory */
+	{
+		std::string fullpath = std::string("./") + filename;
+		if (fileExists(fullpath))    { return fullpath; }
+	}
+
+	return "";
+}
+
 /*
  * Attempts to find a given filename within the folders listed
- * in the environment variable "LUA_SCRIPT_PATH"
+ * in the environment variable "LUA_SCRIPT_PATH", then in the
+ * paths added with luaAddPath. Results, including files that
+ * weren't found, are cached until the search path changes. Named
+ * luascript states are looked up here on every reload, so a miss
+ * has to be as cheap as a hit.
  */
 epicsShareFunc std::string luaLocateFile(std::string filename)
 {
 	if (filename.empty())    { return std::string(""); }
 
 	/* Check if the filename is an absolute path */
-	if (filename.at(0) == '/' && std::ifstream(filename.c_str()).good())    { return filename; }
+	if (filename.at(0) == '/' && fileExists(filename))    { return filename; }
 
 	/* Otherwise, see if the file exists in the script path */
 	char* env_path = std::getenv("LUA_SCRIPT_PATH");
@@ -76,38 +175,205 @@ epicsShareFunc std::string luaLocateFile(std::string filename)
 	}
 	#endif
 
-	/* Search LUA_SCRIPT_PATH directories */
-	if (env_path)
+	unsigned long generation;
+
 	{
-		std::stringstream path;
-		path << env_path;
+		epicsGuard<epicsMutex> guard(registryMutex);
+		generation = path_generation;
+	}
 
-		std::string segment;
-		while (std::getline(path, segment, ':'))
+	{
+		epicsGuard<epicsMutex> guard(locateMutex);
+
+		std::string env_value = env_path ? env_path : "";
+
+		if (env_value != located_env_path)
 		{
-			std::string fullpath = segment + "/" + filename;
-			if (std::ifstream(fullpath.c_str()).good())    { return fullpath; }
+			located_env_path = env_value;
+			located_files.clear();
 		}
+
+		std::map<std::string, located_file>::iterator cached = located_files.find(filename);
+
+		/*
+		 * No stat at all, a file moved or deleted since is reported
+		 * when it's opened, like any other unreadable script.
+		 */
+		if (cached != located_files.end() && cached->second.generation == generation)
+		{
+			locate_hits++;
+			return cached->second.path;
+		}
+
+		locate_misses++;
 	}
 
-	/* Search directories registered via luaAddPath */
+	std::string found = searchScriptPath(filename, env_path);
+
 	{
-		epicsGuard<epicsMutex> guard(registryMutex);
+		epicsGuard<epicsMutex> guard(locateMutex);
 
-		for (size_t i = 0; i < registered_paths.size(); i++)
+		located_files[filename].generation = generation;
+		located_files[filename].path = found;
+	}
+
+	return found;
+}
+
+
+/*
+ * Reports the cached script locations and the number of lookups
+ * served from the cache.
+ */
+epicsShareFunc void luaLocateFileStats(unsigned long* entries, unsigned long* hits, unsigned long* misses)
+{
+	epicsGuard<epicsMutex> guard(locateMutex);
+
+	if (entries)    { *entries = (unsigned long) located_files.size(); }
+	if (hits)       { *hits = locate_hits; }
+	if (misses)     { *misses = locate_misses; }
+}
+
+epicsShareFunc void luaBytecodeCacheStats(unsigned long* entries, unsigned long* bytes)
+{
+	epicsGuard<epicsMutex> guard(chunkCacheMutex);
+
+	unsigned long total = 0;
+
+	for (std::map<std::string, compiled_chunk>::iterator it = chunk_cache.begin(); it != chunk_cache.end(); it++)
+	{
+		total += (unsigned long) it->second.bytecode.size();
+	}
+
+	if (entries)    { *entries = (unsigned long) chunk_cache.size(); }
+	if (bytes)      { *bytes = total; }
+}
+
+
+static int chunkWriter(lua_State* state, const void* data, size_t size, void* output)
+{
+	((std::string*) output)->append((const char*) data, size);
+	return 0;
+}
+
+/*
+ * Name of the on-disk cache file for a script, or an empty string
+ * if no cache directory is set.
+ */
+static std::string diskCachePath(const std::string& path)
+{
+	const char* cache_dir = std::getenv("LUA_BYTECODE_CACHE");
+
+	if (! cache_dir || ! cache_dir[0])    { return ""; }
+
+	std::string name = path;
+
+	for (size_t index = 0; index < name.size(); index++)
+	{
+		if (name[index] == '/' || name[index] == '\\' || name[index] == ':')    { name[index] = '_'; }
+	}
+
+	return std::string(cache_dir) + "/" + name + "c";
+}
+
+/*
+ * Cache files start with a line holding the source's modification
+ * time and size, followed by the lua_dump output.
+ */
+static bool readDiskCache(const std::string& cache_file, const compiled_chunk& source, std::string* bytecode)
+{
+	std::ifstream input(cache_file.c_str(), std::ios::binary);
+
+	if (! input.good())    { return false; }
+
+	long long mtime = 0, size = -1;
+	std::string header;
+
+	std::getline(input, header);
+
+	if (sscanf(header.c_str(), "LUAC %lld %lld", &mtime, &size) != 2)    { return false; }
+	if (mtime != (long long) source.mtime || size != (long long) source.size)    { return false; }
+
+	std::stringstream contents;
+	contents << input.rdbuf();
+	*bytecode = contents.str();
+
+	return ! bytecode->empty();
+}
+
+static void writeDiskCache(const std::string& cache_file, const compiled_chunk& chunk)
+{
+	std::string temp_file = cache_file + ".tmp";
+	FILE* output = fopen(temp_file.c_str(), "wb");
+
+	if (! output)    { return; }
+
+	int written = fprintf(output, "LUAC %lld %lld\n", (long long) chunk.mtime, (long long) chunk.size);
+	bool good = written > 0 && fwrite(chunk.bytecode.data(), 1, chunk.bytecode.size(), output) == chunk.bytecode.size();
+
+	if (fclose(output) != 0)    { good = false; }
+
+	/* Renamed into place so that readers never see a partial file */
+	if (! good || rename(temp_file.c_str(), cache_file.c_str()) != 0)    { remove(temp_file.c_str()); }
+}
+
+/*
+ * Loads a script file as a function on top of the stack, like
+ * luaL_loadfile, reusing the compiled chunk when it's cached.
+ */
+static int loadCompiled(lua_State* state, const std::string& path)
+{
+	struct stat info;
+
+	if (! luaBytecodeCache || stat(path.c_str(), &info) != 0)    { return luaL_loadfile(state, path.c_str()); }
+
+	compiled_chunk chunk;
+	chunk.mtime = info.st_mtime;
+	chunk.size = info.st_size;
+
+	std::string chunkname = "@" + path;
+
+	{
+		epicsGuard<epicsMutex> guard(chunkCacheMutex);
+
+		std::map<std::string, compiled_chunk>::iterator cached = chunk_cache.find(path);
+
+		if (cached != chunk_cache.end() && cached->second.mtime == chunk.mtime && cached->second.size == chunk.size)
 		{
-			std::string fullpath = registered_paths[i] + "/" + filename;
-			if (std::ifstream(fullpath.c_str()).good())    { return fullpath; }
+			const std::string& bytecode = cached->second.bytecode;
+			return luaL_loadbufferx(state, bytecode.data(), bytecode.size(), chunkname.c_str(), "b");
 		}
 	}
 
-	/* Search current directory */
+	std::string cache_file = diskCachePath(path);
+
+	if (! cache_file.empty() && readDiskCache(cache_file, chunk, &chunk.bytecode))
 	{
-		std::string fullpath = std::string("./") + filename;
-		if (std::ifstream(fullpath.c_str()).good())    { return fullpath; }
+		if (luaL_loadbufferx(state, chunk.bytecode.data(), chunk.bytecode.size(), chunkname.c_str(), "b") == LUA_OK)
+		{
+			epicsGuard<epicsMutex> guard(chunkCacheMutex);
+			chunk_cache[path] = chunk;
+			return LUA_OK;
+		}
+
+		/* Bytecode from another Lua build doesn't load, compile the source instead */
+		lua_pop(state, 1);
+		chunk.bytecode.clear();
 	}
 
-	return "";
+	int status = luaL_loadfile(state, path.c_str());
+
+	if (status)    { return status; }
+
+	/* Keep debug information, so errors still report file and line */
+	lua_dump(state, chunkWriter, &chunk.bytecode, 0);
+
+	if (! cache_file.empty())    { writeDiskCache(cache_file, chunk); }
+
+	epicsGuard<epicsMutex> guard(chunkCacheMutex);
+	chunk_cache[path] = chunk;
+
+	return LUA_OK;
 }
 
 
@@ -121,7 +387,7 @@ epicsShareFunc int luaLoadScript(lua_State* state, const char* script_file)
 
 	if (found.empty())    { return -1; }
 
-	int status = luaL_loadfile(state, found.c_str());
+	int status = loadCompiled(state, found);
 
 	if (status)    { return status; }
 
@@ -441,11 +707,175 @@ epicsShareFunc void luaLoadRegistered(lua_State* state)
 }
 
 
+/*
+ * Converts the Lua argument at index to the text iocsh would have
+ * parsed. Sets *valid to false for values that have no text form.
+ */
+static const char* argString(lua_State* state, int index, bool* valid)
+{
+	switch (lua_type(state, index))
+	{
+		case LUA_TNONE:
+		case LUA_TNIL:
+			return NULL;
+
+		case LUA_TNUMBER:
+		case LUA_TSTRING:
+			return lua_tostring(state, index);
+
+		case LUA_TBOOLEAN:
+			return lua_toboolean(state, index) ? "1" : "0";
+
+		default:
+			*valid = false;
+			return NULL;
+	}
+}
+
+/*
+ * Calls a registered iocsh function directly, filling the
+ * iocshArgBuf array from the Lua arguments instead of writing
+ * and re-parsing a command line. Returns -1 without calling the
+ * function if any argument needs the iocsh parser: a string with
+ * a macro to expand, a value iocsh would reject, or an argument
+ * type this doesn't know.
+ */
+static int callDirect(lua_State* state, const iocshCmdDef* command)
+{
+	const iocshFuncDef* def = command->pFuncDef;
+	int given_args = lua_gettop(state) - 1;
+
+	std::vector<iocshArgBuf> args(def->nargs > 0 ? def->nargs : 1);
+	std::vector<const char*> argv;
+	std::vector<int> persistent;
+
+	for (int index = 0; index < def->nargs; index += 1)
+	{
+		int stack_index = index + 2;
+		bool valid = true;
+		iocshArgBuf* arg = &args[index];
+
+		if (def->arg[index]->type == iocshArgPdbbase)
+		{
+			void* pdb = iocshPpdbbase ? *iocshPpdbbase : NULL;
+			void* given = lua_touserdata(state, stack_index);
+
+			if (! pdb || ! (lua_isnoneornil(state, stack_index) || given == pdb))    { return -1; }
+
+			arg->vval = pdb;
+			continue;
+		}
+
+		if (def->arg[index]->type == iocshArgArgv)
+		{
+			/*
+			 * iocsh passes its argv + index, so av[0] is the
+			 * command name only for a leading Argv argument and
+			 * the token before it otherwise.
+			 */
+			if (index == 0)
+			{
+				argv.push_back(def->name);
+			}
+			else
+			{
+				const char* previous = argString(state, stack_index - 1, &valid);
+
+				if (! valid || ! previous)    { return -1; }
+
+				argv.push_back(previous);
+			}
+
+			for (int extra = stack_index; extra <= given_args + 1; extra += 1)
+			{
+				const char* text = argString(state, extra, &valid);
+
+				if (! valid || (text && strchr(text, '$')))    { return -1; }
+
+				argv.push_back(text ? text : "");
+			}
+
+			argv.push_back(NULL);
+
+			arg->aval.ac = (int) argv.size() - 1;
+			arg->aval.av = (char**) &argv[0];
+			break;
+		}
+
+		/* Numbers need no parsing */
+		if (def->arg[index]->type == iocshArgInt && lua_isinteger(state, stack_index))
+		{
+			arg->ival = (int) lua_tointeger(state, stack_index);
+			continue;
+		}
+
+		if (def->arg[index]->type == iocshArgDouble && lua_type(state, stack_index) == LUA_TNUMBER)
+		{
+			arg->dval = lua_tonumber(state, stack_index);
+			continue;
+		}
+
+		const char* text = argString(state, stack_index, &valid);
+
+		if (! valid || (text && strchr(text, '$')))    { return -1; }
+
+		switch (def->arg[index]->type)
+		{
+			case iocshArgInt:
+			{
+				char* end = NULL;
+				arg->ival = text ? (int) strtol(text, &end, 0) : 0;
+
+				if (end && *end)    { return -1; }
+				break;
+			}
+
+			case iocshArgDouble:
+			{
+				char* end = NULL;
+				arg->dval = text ? epicsStrtod(text, &end) : 0.0;
+
+				if (end && *end)    { return -1; }
+				break;
+			}
+
+			case iocshArgString:
+#if EPICS_VERSION_INT >= VERSION_INT(7, 0, 7, 0)
+			case iocshArgStringRecord:
+			case iocshArgStringPath:
+#endif
+				arg->sval = (char*) text;
+				break;
+
+			case iocshArgPersistentString:
+				arg->sval = (char*) text;
+				persistent.push_back(index);
+				break;
+
+			default:
+				return -1;
+		}
+	}
+
+	/* Like iocsh, persistent strings are copied and never freed */
+	for (size_t index = 0; index < persistent.size(); index += 1)
+	{
+		iocshArgBuf* arg = &args[persistent[index]];
+
+		if (arg->sval)    { arg->sval = epicsStrDup(arg->sval); }
+	}
+
+	command->func(&args[0]);
+
+	return 0;
+}
+
+
 /*
  * Function to be run when an ioc shell object is called.
- * Constructs a line of iocsh code and then uses iocshCmd
- * to run the line. Necessary due to epics base removal of
- * access to the ioc function registrar.
+ * Commands found in the iocsh registry are called directly,
+ * otherwise this constructs a line of iocsh code and then
+ * uses iocshCmd to run the line.
  */
 static int l_call(lua_State* state)
 {
@@ -453,6 +883,12 @@ static int l_call(lua_State* state)
 	const char* function_name = lua_tostring(state, lua_gettop(state));
 	lua_pop(state, 1);
 
+	lua_getfield(state, 1, "command");
+	const iocshCmdDef* command = (const iocshCmdDef*) lua_touserdata(state, -1);
+	lua_pop(state, 1);
+
+	if (command && callDirect(state, command) == 0)    { return 0; }
+
 	int given_args = lua_gettop(state) - 1;
 
     std::stringstream parameters;
@@ -514,73 +950,28 @@ static int l_call(lua_State* state)
 
 
 /*
- * Parses the output of the iocsh help command to try
- * and find a given function name. Necessary due to the
- * removal of epics base access to the ioc function registrar.
- * Returns true/false if it finds a matching name.
+ * Looks up an unknown global name, first as an environment
+ * variable, then in the ioc shell's command registry. Both
+ * are direct lookups, commands registered at any time are
+ * found. Returns 1 for an environment variable (pushed on
+ * the stack), 2 for a command (stored in *command), or 0 if
+ * the name is unknown.
  */
-static bool parseHelp(const char* func_name)
+static int findIocName(lua_State* state, const char* symbol_name, const iocshCmdDef** command)
 {
-	// If there was an issue with initial tmpfile, attempt retry
-	if (temp_help == NULL)
-	{
-		temp_help = tmpfile();
-
-		/*
-		 * If things still don't work, then default to assuming
-		 * everything is a potential iocsh function
-		 */
-		if (temp_help == NULL) { return true; }
-	}
-
-	FILE* prev = epicsGetThreadStdout();
-
-	epicsSetThreadStdout(temp_help);
-	iocshCmd("help()");
-	epicsSetThreadStdout(prev);
-
-	long size = ftell(temp_help);
-
-	if (size <= 0)    { rewind(temp_help); return false; }
-
-	rewind(temp_help);
-	char* buffer = (char*) malloc(sizeof(char) * (size + 1));
-
-	fread(buffer, 1, size, temp_help);
-	buffer[size] = '\0';
-	std::stringstream help_str;
-
-	help_str.str(buffer);
-	free(buffer);
-
-	rewind(temp_help);
+	const char* env_value = std::getenv(symbol_name);
 
-	std::string line;
-	std::string element;
-
-	int skipped_first_line = 0;
-
-	while (std::getline(help_str, line, '\n'))
+	if (env_value)
 	{
-		if (! skipped_first_line)
-		{
-			skipped_first_line = 1;
-			continue;
-		}
+		lua_pushstring(state, env_value);
+		return 1;
+	}
 
-		std::stringstream check_line;
-		check_line.str(line);
+	*command = iocshFindCommand(symbol_name);
 
-		while (std::getline(check_line, element, ' '))
-		{
-			if(! element.empty() && element == func_name)
-			{
-				return true;
-			}
-		}
-	}
+	if (*command)    { return 2; }
 
-	return false;
+	return 0;
 }
 
 
@@ -595,25 +986,34 @@ static int l_iocindex(lua_State* state)
 {
 	const char* symbol_name = lua_tostring(state, 2);
 
+	if (! symbol_name)    { return 0; }
+
 	if (std::string(symbol_name) == "exit")
 	{
 		lua_pushlightuserdata(state, NULL);
 		return lua_error(state);
 	}
 
-	std::stringstream environ_check;
+	epicsTimeStamp start, end;
+	epicsTimeGetCurrent(&start);
 
-	environ_check << "return (os.getenv('";
-	environ_check << symbol_name;
-	environ_check << "'))";
+	const iocshCmdDef* command = NULL;
+	int found = findIocName(state, symbol_name, &command);
 
-	luaL_dostring(state, environ_check.str().c_str());
+	epicsTimeGetCurrent(&end);
 
-	if (! lua_isnil(state, -1)) { return 1; }
+	{
+		epicsGuard<epicsMutex> guard(iocshStatsMutex);
 
-	lua_pop(state, 1);
+		iocsh_lookups++;
+		iocsh_lookup_seconds += epicsTimeDiffInSeconds(&end, &start);
+
+		if (found == 1)         { iocsh_env_hits++; }
+		else if (found == 2)    { iocsh_command_hits++; }
+	}
 
-	if (! parseHelp(symbol_name)) { return 0; }
+	if (found == 1)    { return 1; }
+	if (found == 0)    { return 0; }
 
 	static const luaL_Reg func_meta[] = {
 		{"__call", l_call},
@@ -630,10 +1030,30 @@ static int l_iocindex(lua_State* state)
 	lua_pushstring(state, symbol_name);
 	lua_setfield(state, -2, "function_name");
 
+	/* Cached so calls skip the registry lookup */
+	lua_pushlightuserdata(state, (void*) command);
+	lua_setfield(state, -2, "command");
+
 	return 1;
 }
 
 
+/*
+ * Reports the names resolved by the iocsh library so far and the
+ * total time spent resolving them, for comparing IOC boot costs.
+ */
+epicsShareFunc void luaIocshLookupStats(unsigned long* lookups, unsigned long* env_hits,
+                                        unsigned long* command_hits, double* seconds)
+{
+	epicsGuard<epicsMutex> guard(iocshStatsMutex);
+
+	if (lookups)         { *lookups = iocsh_lookups; }
+	if (env_hits)        { *env_hits = iocsh_env_hits; }
+	if (command_hits)    { *command_hits = iocsh_command_hits; }
+	if (seconds)         { *seconds = iocsh_lookup_seconds; }
+}
+
+
 /*
  * Put as a size-of function to trick lua into allowing
  * #ENABLE_HASH_COMMENTS, adds a global variable that
@@ -874,13 +1294,87 @@ epicsShareFunc void luaStateUnref(lua_State* state)
 
 
 /*
- * Generates a new lua state for the caller,
- * binds in the defined epics libraries and
- * functions. The state starts with a reference count of 1.
+ * Reference counts and registered names, copied before the states are
+ * walked so that no state lock is held while taking the pool lock.
  */
-epicsShareFunc lua_State* luaCreateState()
+typedef struct
+{
+	std::map<lua_State*, int>         refcounts;
+	std::map<lua_State*, std::string> names;
+	unsigned long                     states;
+	unsigned long                     calls;
+	double                            call_seconds;
+} state_report;
+
+static void reportState(lua_State* state, const lua_state_stats* stats, const char* owner, void* arg)
+{
+	state_report* report = (state_report*) arg;
+
+	char refs[16] = "-";
+
+	std::map<lua_State*, int>::iterator ref = report->refcounts.find(state);
+	if (ref != report->refcounts.end())    { epicsSnprintf(refs, sizeof(refs), "%d", ref->second); }
+
+	std::map<lua_State*, std::string>::iterator name = report->names.find(state);
+
+	printf("%-18p %4s %-16s %10lu %8lu %10lu %12.3f  %s\n",
+	       (void*) state,
+	       refs,
+	       (name != report->names.end()) ? name->second.c_str() : "-",
+	       (unsigned long) (stats->bytes / 1024),
+	       stats->gc_cycles,
+	       stats->calls,
+	       stats->call_seconds * 1000.0,
+	       (owner && owner[0]) ? owner : "-");
+
+	report->states++;
+	report->calls += stats->calls;
+	report->call_seconds += stats->call_seconds;
+}
+
+/*
+ * Lists every open state with its reference count, registered name,
+ * owner, memory in use (the LUA_GCCOUNT value), collection cycles,
+ * and the combined count and time of calls made into it by records,
+ * device support, and port drivers.
+ */
+epicsShareFunc void luaStateReport(void)
+{
+	state_report report;
+
+	report.states = 0;
+	report.calls = 0;
+	report.call_seconds = 0.0;
+
+	{
+		epicsGuard<epicsMutex> guard(refcountMutex);
+		report.refcounts = state_refcounts;
+	}
+
+	{
+		epicsGuard<epicsMutex> guard(namedStatesMutex);
+
+		for (std::map<std::string, lua_State*>::iterator it = named_states.begin(); it != named_states.end(); it++)
+		{
+			std::string& names = report.names[it->second];
+
+			if (! names.empty())    { names += ","; }
+			names += it->first;
+		}
+	}
+
+	printf("%-18s %4s %-16s %10s %8s %10s %12s  %s\n",
+	       "State", "Refs", "Name", "KB", "GC", "Calls", "Call ms", "Owner");
+
+	luaForEachState(reportState, &report);
+
+	printf("%lu states, %lu calls, %.3f ms in Lua\n", report.states, report.calls, report.call_seconds * 1000.0);
+}
+
+
+/* Loads the libraries of a new state, run protected by luaCreateState */
+static int setupState(lua_State* output)
 {
-	lua_State* output = luaL_newstate();
 	luaL_openlibs(output);
 	luaLoadRegistered(output);
 
@@ -903,6 +1397,35 @@ epicsShareFunc lua_State* luaCreateState()
 	luaL_requiref(output, "iocsh", luaopen_iocsh, 1);
 	lua_pop(output, 1);
 
+	luaProfileSync(output);
+
+	return 0;
+}
+
+/*
+ * Generates a new lua state for the caller,
+ * binds in the defined epics libraries and
+ * functions. The state starts with a reference count of 1.
+ * Returns NULL if there isn't enough memory to set it up.
+ */
+epicsShareFunc lua_State* luaCreateState()
+{
+	lua_State* output = luaNewState();
+
+	if (! output)    { return NULL; }
+
+	lua_pushcfunction(output, setupState);
+
+	if (lua_pcall(output, 0, 0, 0) != LUA_OK)
+	{
+		errlogPrintf("luaCreateState: %s\n", lua_isstring(output, -1) ? lua_tostring(output, -1) : "setup failed");
+		lua_close(output);
+		return NULL;
+	}
+
+	/* Only once the libraries are loaded, so they can't run into it */
+	luaApplyMemoryLimit(output);
+
 	/* Initial reference count of 1 (owned by the caller) */
 	luaStateRef(output);
 
@@ -932,6 +1455,8 @@ epicsShareFunc lua_State* luaNamedState(const char* name)
 
 	lua_State* output = luaCreateState();
 
+	if (! output)    { return NULL; }
+
 	named_states[state_name] = output;
 	luaStateRef(output);  /* named state registration holds a reference */
 
@@ -1133,6 +1658,7 @@ epicsShareFunc void luaAddPath(const char* directory)
 	}
 
 	registered_paths.push_back(dir);
+	path_generation++;
 }
 
 
@@ -1206,3 +1732,9 @@ int l_luaAddModule(lua_State* state)
 
 	return 0;
 }
+
+
+extern "C"
+{
+	epicsExportAddress(int, luaBytecodeCache);
+}
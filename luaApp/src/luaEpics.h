@@ -53,9 +53,47 @@ epicsShareFunc int  luaStateIsRegistered(lua_State* state);
 epicsShareFunc void luaAddPath(const char* directory);
 epicsShareFunc void luaAddModule(const char* module_top);
 
+typedef struct lua_state_stats
+{
+	size_t        bytes;
+	size_t        peak;
+	size_t        blocks;
+	size_t        slab_bytes;
+	size_t        limit;
+	unsigned long failures;
+	unsigned long gc_cycles;
+	unsigned long calls;
+	double        call_seconds;
+} lua_state_stats;
+
+typedef void (*LUA_STATE_VISITOR)(lua_State* state, const lua_state_stats* stats, const char* owner, void* arg);
+
+epicsShareFunc lua_State* luaNewState();
+epicsShareFunc int  luaStateStats(lua_State* state, lua_state_stats* stats);
+epicsShareFunc int  luaSetMemoryLimit(lua_State* state, size_t bytes);
+epicsShareFunc void luaApplyMemoryLimit(lua_State* state);
+epicsShareFunc void luaSetStateOwner(lua_State* state, const char* owner);
+epicsShareFunc int  luaTimedCall(lua_State* state, int nargs, int nresults, int msgh);
+epicsShareFunc int  luaBudgetCall(lua_State* state, int nargs, int nresults, int msgh, long instructions);
+epicsShareFunc void luaForEachState(LUA_STATE_VISITOR visit, void* arg);
+epicsShareFunc void luaMemoryReport(void);
+epicsShareFunc void luaStateReport(void);
+
+epicsShareFunc void luaProfileSync(lua_State* state);
+epicsShareFunc void luaProfileStart(int rate);
+epicsShareFunc void luaProfileStop(void);
+epicsShareFunc int  luaProfileDump(const char* filename);
+epicsShareFunc void luaProfileReport(int count);
+
 epicsShareFunc void luaStateRef(lua_State* state);
 epicsShareFunc void luaStateUnref(lua_State* state);
 
+epicsShareFunc void luaLocateFileStats(unsigned long* entries, unsigned long* hits, unsigned long* misses);
+epicsShareFunc void luaBytecodeCacheStats(unsigned long* entries, unsigned long* bytes);
+
+epicsShareFunc void luaIocshLookupStats(unsigned long* lookups, unsigned long* env_hits,
+                                        unsigned long* command_hits, double* seconds);
+
 #ifdef __cplusplus
 }
 
@@ -0,0 +1,362 @@
+#include <cstdio>
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <errlog.h>
+#include <epicsStdio.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsExport.h>
+
+#define epicsExportSharedSymbols
+#include "luaEpics.h"
+
+/*
+ * Sampling profiler
+ *
+ * While the profiler runs, every state created by luaCreateState has a
+ * count hook that fires once per luaProfileRate VM instructions. Each
+ * firing walks the Lua stack and adds one sample to the folded stack
+ * ("outer;inner;leaf"), to the leaf function, and to the current line.
+ *
+ * lua_sethook may only be called by the thread running the state, so
+ * starting and stopping the profiler just sets profile_rate. Each state
+ * picks the change up itself, through luaProfileSync, at its next call
+ * from luaTimedCall, coroutine resume, epics.poll, or osi.sleep. States
+ * run without any hook, and with the stock coroutine functions, when
+ * the profiler isn't in use.
+ */
+
+#define PROFILE_MAX_DEPTH  64
+
+/* VM instructions between samples, used when luaProfileStart is given 0 */
+int luaProfileRate = 1000;
+
+static std::map<std::string, unsigned long> folded_samples;
+static std::map<std::string, unsigned long> function_samples;
+static std::map<std::string, unsigned long> line_samples;
+static unsigned long total_samples = 0;
+static epicsMutex profileMutex;
+
+/* Instructions between samples while running, 0 when stopped */
+static int profile_rate = 0;
+
+
+static std::string frameName(lua_Debug* ar)
+{
+	char location[64];
+
+	const char* name = ar->name ? ar->name : "?";
+
+	if (*ar->what == 'm')    { name = "main"; }
+
+	if (*ar->what == 'C')    { return std::string(name) + " [C]"; }
+
+	epicsSnprintf(location, sizeof(location), ":%d", ar->linedefined);
+
+	return std::string(name) + " " + ar->short_src + location;
+}
+
+static void profileHook(lua_State* state, lua_Debug* ar)
+{
+	lua_Debug frame;
+	std::vector<std::string> frames;
+	std::string line;
+
+	/* Stopped, but this state hasn't been synced yet */
+	if (! profile_rate)
+	{
+		if (lua_gethook(state) == profileHook)    { lua_sethook(state, NULL, 0, 0); }
+		return;
+	}
+
+	for (int level = 0; level < PROFILE_MAX_DEPTH && lua_getstack(state, level, &frame); level++)
+	{
+		lua_getinfo(state, "Sln", &frame);
+
+		if (level == 0)
+		{
+			char number[16];
+			epicsSnprintf(number, sizeof(number), ":%d", frame.currentline);
+			line = std::string(frame.short_src) + number;
+		}
+
+		frames.push_back(frameName(&frame));
+	}
+
+	if (frames.empty())    { return; }
+
+	std::string folded;
+
+	for (size_t i = frames.size(); i > 0; i--)
+	{
+		if (! folded.empty())    { folded += ";"; }
+		folded += frames[i - 1];
+	}
+
+	epicsGuard<epicsMutex> guard(profileMutex);
+
+	folded_samples[folded]++;
+	function_samples[frames[0]]++;
+	line_samples[line]++;
+	total_samples++;
+}
+
+static int profileResume(lua_State* state);
+static int profileWrap(lua_State* state);
+
+/*
+ * Replaces coroutine.resume and coroutine.wrap with the versions below,
+ * which keep the originals as their two upvalues. Run protected, as
+ * creating the closures can fail.
+ */
+static int l_wrapCoroutines(lua_State* state)
+{
+	lua_getglobal(state, "coroutine");
+
+	if (! lua_istable(state, 1))    { return 0; }
+
+	lua_getfield(state, 1, "resume");
+	lua_getfield(state, 1, "wrap");
+
+	if (lua_tocfunction(state, 2) == profileResume)    { return 0; }
+
+	lua_pushvalue(state, 2);
+	lua_pushvalue(state, 3);
+	lua_pushcclosure(state, profileResume, 2);
+	lua_setfield(state, 1, "resume");
+
+	lua_pushvalue(state, 2);
+	lua_pushvalue(state, 3);
+	lua_pushcclosure(state, profileWrap, 2);
+	lua_setfield(state, 1, "wrap");
+
+	return 0;
+}
+
+/* Puts back the originals, called from a wrapper once the profiler stops */
+static void restoreCoroutines(lua_State* state)
+{
+	lua_getglobal(state, "coroutine");
+
+	if (lua_istable(state, -1))
+	{
+		lua_getfield(state, -1, "resume");
+
+		if (lua_tocfunction(state, -1) == profileResume)
+		{
+			lua_pushvalue(state, lua_upvalueindex(1));
+			lua_setfield(state, -3, "resume");
+		}
+
+		lua_getfield(state, -2, "wrap");
+
+		if (lua_tocfunction(state, -1) == profileWrap)
+		{
+			lua_pushvalue(state, lua_upvalueindex(2));
+			lua_setfield(state, -4, "wrap");
+		}
+
+		lua_pop(state, 2);
+	}
+
+	lua_pop(state, 1);
+}
+
+/*
+ * Installs or removes the sampling hook to match the profiler. Must be
+ * called from the thread running the state. Other hooks (such as the
+ * shell's interrupt handler or an instruction budget) are left alone.
+ *
+ * When the hook goes in, so do the coroutine wrappers, which take
+ * themselves out again at the first resume after the profiler stops.
+ */
+epicsShareFunc void luaProfileSync(lua_State* state)
+{
+	if (! state)    { return; }
+
+	int rate = profile_rate;
+	lua_Hook hook = lua_gethook(state);
+
+	if (rate && (! hook || (hook == profileHook && lua_gethookcount(state) != rate)))
+	{
+		lua_sethook(state, profileHook, LUA_MASKCOUNT, rate);
+
+		/* Nothing can be called on a suspended coroutine, its resumer did this */
+		if (lua_status(state) == LUA_OK)
+		{
+			lua_pushcfunction(state, l_wrapCoroutines);
+			if (lua_pcall(state, 0, 0, 0))    { lua_pop(state, 1); }
+		}
+	}
+	else if (! rate && hook == profileHook)
+	{
+		lua_sethook(state, NULL, 0, 0);
+	}
+}
+
+/*
+ * coroutine.resume, syncing the hooks of the caller and the coroutine
+ * first. A coroutine has its own hook, copied from its creator, so one
+ * created before the profiler started would never be sampled.
+ */
+static int profileResume(lua_State* state)
+{
+	lua_State* co = lua_tothread(state, 1);
+
+	if (! profile_rate)    { restoreCoroutines(state); }
+
+	luaProfileSync(state);
+	if (co)    { luaProfileSync(co); }
+
+	lua_pushvalue(state, lua_upvalueindex(1));
+	lua_insert(state, 1);
+	lua_call(state, lua_gettop(state) - 1, LUA_MULTRET);
+
+	return lua_gettop(state);
+}
+
+/* The function returned by coroutine.wrap, syncing hooks like profileResume */
+static int profileWrapped(lua_State* state)
+{
+	luaProfileSync(state);
+	luaProfileSync(lua_tothread(state, lua_upvalueindex(2)));
+
+	lua_pushvalue(state, lua_upvalueindex(1));
+	lua_insert(state, 1);
+
+	int status = lua_pcall(state, lua_gettop(state) - 1, LUA_MULTRET, 0);
+
+	if (status != LUA_OK)
+	{
+		/* Called from here, the original wrap can't see where it was called from */
+		if (status != LUA_ERRMEM && lua_type(state, -1) == LUA_TSTRING)
+		{
+			luaL_where(state, 1);
+			lua_insert(state, -2);
+			lua_concat(state, 2);
+		}
+
+		return lua_error(state);
+	}
+
+	return lua_gettop(state);
+}
+
+static int profileWrap(lua_State* state)
+{
+	int profiling = profile_rate;
+
+	if (! profiling)    { restoreCoroutines(state); }
+
+	lua_pushvalue(state, lua_upvalueindex(2));
+	lua_insert(state, 1);
+	lua_call(state, lua_gettop(state) - 1, 1);
+
+	/* Stopped, so the plain wrapped function will do */
+	if (! profiling)    { return 1; }
+
+	/* The coroutine is the first upvalue of the wrapping function */
+	lua_getupvalue(state, -1, 1);
+	lua_pushcclosure(state, profileWrapped, 2);
+
+	return 1;
+}
+
+/* Clears any earlier samples and starts sampling every open state */
+epicsShareFunc void luaProfileStart(int rate)
+{
+	if (rate <= 0)    { rate = luaProfileRate; }
+	if (rate <= 0)    { rate = 1000; }
+
+	epicsGuard<epicsMutex> guard(profileMutex);
+
+	folded_samples.clear();
+	function_samples.clear();
+	line_samples.clear();
+	total_samples = 0;
+	profile_rate = rate;
+}
+
+epicsShareFunc void luaProfileStop(void)
+{
+	epicsGuard<epicsMutex> guard(profileMutex);
+	profile_rate = 0;
+}
+
+/*
+ * Writes one line per distinct stack, "outer;inner;leaf count", the
+ * input format of flamegraph.pl. Writes to stdout if no file is given.
+ */
+epicsShareFunc int luaProfileDump(const char* filename)
+{
+	FILE* output = stdout;
+
+	if (filename && filename[0])
+	{
+		output = fopen(filename, "w");
+
+		if (! output)
+		{
+			errlogPrintf("luaProfileDump: unable to open %s\n", filename);
+			return -1;
+		}
+	}
+
+	{
+		epicsGuard<epicsMutex> guard(profileMutex);
+
+		for (std::map<std::string, unsigned long>::iterator it = folded_samples.begin(); it != folded_samples.end(); it++)
+		{
+			fprintf(output, "%s %lu\n", it->first.c_str(), it->second);
+		}
+	}
+
+	if (output != stdout)    { fclose(output); }
+
+	return 0;
+}
+
+static bool moreSamples(const std::pair<std::string, unsigned long>& a, const std::pair<std::string, unsigned long>& b)
+{
+	return a.second > b.second;
+}
+
+static void printTop(const char* title, const std::map<std::string, unsigned long>& samples, unsigned long total, int count)
+{
+	std::vector<std::pair<std::string, unsigned long> > sorted(samples.begin(), samples.end());
+	std::sort(sorted.begin(), sorted.end(), moreSamples);
+
+	printf("%s:\n", title);
+
+	for (size_t i = 0; i < sorted.size() && (int) i < count; i++)
+	{
+		printf("  %8lu %6.2f%%  %s\n",
+		       sorted[i].second,
+		       total ? 100.0 * sorted[i].second / total : 0.0,
+		       sorted[i].first.c_str());
+	}
+}
+
+/* Prints the functions and lines with the most samples */
+epicsShareFunc void luaProfileReport(int count)
+{
+	if (count <= 0)    { count = 10; }
+
+	epicsGuard<epicsMutex> guard(profileMutex);
+
+	printf("Profiler %s, %lu samples", profile_rate ? "running" : "stopped", total_samples);
+	if (profile_rate)    { printf(", every %d instructions", profile_rate); }
+	printf("\n");
+
+	printTop("Functions", function_samples, total_samples, count);
+	printTop("Lines", line_samples, total_samples, count);
+}
+
+
+extern "C"
+{
+	epicsExportAddress(int, luaProfileRate);
+}
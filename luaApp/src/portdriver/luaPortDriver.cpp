@@ -52,13 +52,13 @@ static int l_call(lua_State* state)
 
 	if (direction == "read")
 	{
-		data = "return function(self) " + data + " end";
+		data = "return function(self, addr) " + data + " end";
 		status = luaL_dostring(state, data.c_str());
 		if (!status) { lua_setfield(state, -2, "read_bind"); }
 	}
 	else if (direction == "write")
 	{
-		data = "return function(value, self) " + data + " end";
+		data = "return function(value, self, addr, mask) " + data + " end";
 		status = luaL_dostring(state, data.c_str());
 		if (!status) { lua_setfield(state, -2, "write_bind"); }
 	}
@@ -182,10 +182,17 @@ static int l_index(lua_State* state)
 	lua_newtable(state);
 
 	if      (strcasecmp(param_type, "int32") == 0)         { lua_pushinteger(state, asynParamInt32); }
-	else if (strcasecmp(param_type, "uint32digital") == 0) { lua_pushinteger(state, 2); }
+#ifdef LUA_ASYN_INT64
+	else if (strcasecmp(param_type, "int64") == 0)         { lua_pushinteger(state, asynParamInt64); }
+#endif
+	else if (strcasecmp(param_type, "uint32digital") == 0) { lua_pushinteger(state, asynParamUInt32Digital); }
 	else if (strcasecmp(param_type, "float64") == 0)       { lua_pushinteger(state, asynParamFloat64); }
 	else if (strcasecmp(param_type, "string") == 0)        { lua_pushinteger(state, asynParamOctet); }
 	else if (strcasecmp(param_type, "octet") == 0)         { lua_pushinteger(state, asynParamOctet); }
+	else if (strcasecmp(param_type, "int8array") == 0)     { lua_pushinteger(state, asynParamInt8Array); }
+	else if (strcasecmp(param_type, "int16array") == 0)    { lua_pushinteger(state, asynParamInt16Array); }
+	else if (strcasecmp(param_type, "int32array") == 0)    { lua_pushinteger(state, asynParamInt32Array); }
+	else if (strcasecmp(param_type, "float64array") == 0)  { lua_pushinteger(state, asynParamFloat64Array); }
 	else                                                   { lua_pushinteger(state, 0); }
 
 	lua_setfield(state, -2, "type");
@@ -205,13 +212,44 @@ static int l_index(lua_State* state)
 }
 
 
-luaPortDriver::~luaPortDriver()   { luaStateUnref(this->state); }
+/*
+ * Pops the value on top of the stack and returns a
+ * registry reference to it if it is a function,
+ * otherwise LUA_NOREF.
+ */
+static int refFunction(lua_State* state)
+{
+	if (! lua_isfunction(state, -1))
+	{
+		lua_pop(state, 1);
+		return LUA_NOREF;
+	}
+
+	return luaL_ref(state, LUA_REGISTRYINDEX);
+}
 
-luaPortDriver::luaPortDriver(const char* port_name, const char* lua_filepath, const char* lua_macros)
-	:asynPortDriver(port_name, 1,
-		asynInt32Mask | asynFloat64Mask | asynOctetMask | asynDrvUserMask,
-		asynInt32Mask | asynFloat64Mask | asynOctetMask,
-		0, 1, 0, 0)
+luaPortDriver::~luaPortDriver()
+{
+	for (size_t index = 0; index < this->readRefs.size(); index++)
+	{
+		luaL_unref(this->state, LUA_REGISTRYINDEX, this->readRefs[index]);
+		luaL_unref(this->state, LUA_REGISTRYINDEX, this->writeRefs[index]);
+	}
+
+	luaStateUnref(this->state);
+}
+
+/*
+ * With own_thread set, the port is created with ASYN_CANBLOCK
+ * so that asyn runs it on a thread of its own, queueing requests
+ * from device support, and the Lua functions never run in the
+ * threads of the records that use the port.
+ */
+luaPortDriver::luaPortDriver(const char* port_name, const char* lua_filepath, const char* lua_macros, int max_addr, bool own_thread)
+	:asynPortDriver(port_name, max_addr,
+		LUA_ASYN_INTERFACES | asynDrvUserMask,
+		LUA_ASYN_INTERFACES,
+		(max_addr > 1 ? ASYN_MULTIDEVICE : 0) | (own_thread ? ASYN_CANBLOCK : 0), 1, 0, 0)
 {
 	static const luaL_Reg param_get[] = {
 		{"__index", l_index},
@@ -219,6 +257,15 @@ luaPortDriver::luaPortDriver(const char* port_name, const char* lua_filepath, co
 	};
 
 	this->state = luaCreateState();
+
+	/* Without a state the port has no parameters, so nothing can reach it */
+	if (! this->state)
+	{
+		errlogPrintf("luaPortDriver %s: unable to create a Lua state\n", port_name);
+		return;
+	}
+
+	luaSetStateOwner(this->state, (std::string("luaPortDriver ") + port_name).c_str());
 	luaLoadLibrary(this->state, "asyn");
 
 	lua_pushstring(this->state, port_name);
@@ -249,9 +296,6 @@ luaPortDriver::luaPortDriver(const char* port_name, const char* lua_filepath, co
 	lua_pushnil(this->state);
 	lua_setglobal(this->state, "param");
 
-	lua_newtable(this->state);
-	lua_setfield(this->state, LUA_REGISTRYINDEX, "LPORTDRIVER_FUNCTIONS");
-
 	lua_getfield(this->state, LUA_REGISTRYINDEX, "LPORTDRIVER_PARAMS");
 	lua_pushnil(this->state);
 
@@ -269,17 +313,19 @@ luaPortDriver::luaPortDriver(const char* port_name, const char* lua_filepath, co
 
 		this->createParam(param_name, (asynParamType) param_type, &index);
 
-		lua_getfield(this->state, LUA_REGISTRYINDEX, "LPORTDRIVER_FUNCTIONS");
-		lua_newtable(this->state);
+		if (index >= (int) this->readRefs.size())
+		{
+			this->readRefs.resize(index + 1, LUA_NOREF);
+			this->writeRefs.resize(index + 1, LUA_NOREF);
+		}
 
-		lua_getfield(this->state, -3, "read_bind");
-		lua_setfield(this->state, -2, "read");
+		lua_getfield(this->state, -1, "read_bind");
+		this->readRefs[index] = refFunction(this->state);
 
-		lua_getfield(this->state, -3, "write_bind");
-		lua_setfield(this->state, -2, "write");
+		lua_getfield(this->state, -1, "write_bind");
+		this->writeRefs[index] = refFunction(this->state);
 
-		lua_seti(this->state, -2, index);
-		lua_pop(this->state, 2);
+		lua_pop(this->state, 1);
 	}
 
 	lua_pop(this->state, 1);
@@ -296,24 +342,30 @@ luaPortDriver::luaPortDriver(const char* port_name, const char* lua_filepath, co
  */
 void luaPortDriver::getReadFunction(int index)
 {
-	lua_getfield(this->state, LUA_REGISTRYINDEX, "LPORTDRIVER_FUNCTIONS");
-	lua_geti(this->state, -1, index);
-	lua_remove(this->state, -2);
-	lua_getfield(this->state, -1, "read");
-	lua_remove(this->state, -2);
+	if (index < 0 || index >= (int) this->readRefs.size() || this->readRefs[index] == LUA_NOREF)
+	{
+		lua_pushnil(this->state);
+		return;
+	}
+
+	lua_rawgeti(this->state, LUA_REGISTRYINDEX, this->readRefs[index]);
 }
 
 /*
  * Pushes a lua asyn driver object onto the
- * stack for the parameter 'self'. Then
- * runs the function that's currently on the
- * stack.
+ * stack for the parameter 'self' and the
+ * asyn address for 'addr'. Then runs the
+ * function that's currently on the stack.
  */
-int luaPortDriver::callReadFunction()
+int luaPortDriver::callReadFunction(asynUser* pasynuser)
 {	
+	int addr = 0;
+	this->getAddress(pasynuser, &addr);
+
 	luaGenerateDriver(this->state, this->portName);
+	lua_pushinteger(this->state, addr);
 
-	int status = lua_pcall(this->state, 1, 1, 0);
+	int status = luaTimedCall(this->state, 2, 1, 0);
 
 	if (status)
 	{
@@ -332,27 +384,37 @@ int luaPortDriver::callReadFunction()
  */
 void luaPortDriver::getWriteFunction(int index)
 {
-	lua_getfield(this->state, LUA_REGISTRYINDEX, "LPORTDRIVER_FUNCTIONS");
-	lua_geti(this->state, -1, index);
-	lua_getfield(this->state, -1, "write");
-	lua_remove(this->state, -3);
-	lua_remove(this->state, -2);
+	if (index < 0 || index >= (int) this->writeRefs.size() || this->writeRefs[index] == LUA_NOREF)
+	{
+		lua_pushnil(this->state);
+		return;
+	}
+
+	lua_rawgeti(this->state, LUA_REGISTRYINDEX, this->writeRefs[index]);
 }
 
 
 /*
  * Pushes a lua asyn driver object onto the
- * stack for the parameter 'self'. This function
- * assumes that the caller has already pushed the
- * value coming in from asyn onto the stack to be
- * used for the parameter 'value'. Then, it calls
- * the function on the stack.
+ * stack for the parameter 'self' and the asyn
+ * address for 'addr'. This function assumes
+ * that the caller has already pushed the value
+ * coming in from asyn onto the stack to be
+ * used for the parameter 'value', followed by
+ * extra arguments (the mask of UInt32Digital
+ * writes). Then, it calls the function on the
+ * stack.
  */
-int luaPortDriver::callWriteFunction()
+int luaPortDriver::callWriteFunction(asynUser* pasynuser, int extra)
 {
+	int addr = 0;
+	this->getAddress(pasynuser, &addr);
+
 	luaGenerateDriver(this->state, this->portName);
+	lua_pushinteger(this->state, addr);
+	lua_rotate(this->state, -(extra + 2), 2);
 		
-	int status = lua_pcall(this->state, 2, 0, 0);
+	int status = luaTimedCall(this->state, 3 + extra, 0, 0);
 
 	if (status)
 	{
@@ -380,7 +442,7 @@ asynStatus luaPortDriver::writeOctet(asynUser* pasynuser, const char* value, siz
 		output.erase(maxChars);
 
 		lua_pushstring(this->state, output.c_str());
-		if (this->callWriteFunction())   { return asynError; }
+		if (this->callWriteFunction(pasynuser))   { return asynError; }
 	}
 
 	this->callParamCallbacks();
@@ -400,7 +462,7 @@ asynStatus luaPortDriver::writeFloat64(asynUser* pasynuser, epicsFloat64 value)
 	}
 
 	lua_pushnumber(this->state, value);
-	if (this->callWriteFunction())    { return asynError; }
+	if (this->callWriteFunction(pasynuser))    { return asynError; }
 
 	this->callParamCallbacks();
 	return asynSuccess;
@@ -418,7 +480,7 @@ asynStatus luaPortDriver::writeInt32(asynUser* pasynuser, epicsInt32 value)
 	}
 
 	lua_pushinteger(this->state, value);
-	if (this->callWriteFunction())    { return asynError; }
+	if (this->callWriteFunction(pasynuser))    { return asynError; }
 	
 	this->callParamCallbacks();
 	return asynSuccess;
@@ -435,7 +497,7 @@ asynStatus luaPortDriver::readOctet(asynUser* pasynuser, char* value, size_t max
 		return asynPortDriver::readOctet(pasynuser, value, maxChars, actual, eomReason);
 	}
 
-	if (this->callReadFunction())    { return asynError; }
+	if (this->callReadFunction(pasynuser))    { return asynError; }
 
 	if (! lua_isnil(this->state, -1))
 	{
@@ -467,7 +529,7 @@ asynStatus luaPortDriver::readFloat64(asynUser* pasynuser, epicsFloat64* value)
 		return asynPortDriver::readFloat64(pasynuser, value);
 	}
 
-	if(this->callReadFunction())    { return asynError; }
+	if(this->callReadFunction(pasynuser))    { return asynError; }
 
 	if (! lua_isnil(this->state, -1))
 	{
@@ -492,7 +554,7 @@ asynStatus luaPortDriver::readInt32(asynUser* pasynuser, epicsInt32* value)
 		return asynPortDriver::readInt32(pasynuser, value);
 	}
 
-	if (this->callReadFunction())    { return asynError; }
+	if (this->callReadFunction(pasynuser))    { return asynError; }
 
 	if (! lua_isnil(this->state, -1))
 	{
@@ -505,14 +567,214 @@ asynStatus luaPortDriver::readInt32(asynUser* pasynuser, epicsInt32* value)
 	return asynSuccess;
 }
 
+#ifdef LUA_ASYN_INT64
+asynStatus luaPortDriver::writeInt64(asynUser* pasynuser, epicsInt64 value)
+{	
+	epicsGuard<epicsMutex> guard(this->stateMutex);
+	this->getWriteFunction(pasynuser->reason);
+	
+	if (lua_isnil(this->state, -1))
+	{
+		lua_pop(this->state, 1);
+		return asynPortDriver::writeInt64(pasynuser, value);
+	}
+
+	lua_pushinteger(this->state, value);
+	if (this->callWriteFunction(pasynuser))    { return asynError; }
+	
+	this->callParamCallbacks();
+	return asynSuccess;
+}
+
+asynStatus luaPortDriver::readInt64(asynUser* pasynuser, epicsInt64* value)
+{	
+	epicsGuard<epicsMutex> guard(this->stateMutex);
+	this->getReadFunction(pasynuser->reason);
+
+	if (lua_isnil(this->state, -1))
+	{
+		lua_pop(this->state, 1);
+		return asynPortDriver::readInt64(pasynuser, value);
+	}
+
+	if (this->callReadFunction(pasynuser))    { return asynError; }
+
+	if (! lua_isnil(this->state, -1))    { *value = lua_tointeger(this->state, -1); }
+
+	lua_pop(this->state, 1);
+	return asynSuccess;
+}
+#endif
+
+/*
+ * UInt32Digital writes pass the masked value and
+ * the mask itself as 'mask'. Reads are masked
+ * before they are returned to asyn.
+ */
+asynStatus luaPortDriver::writeUInt32Digital(asynUser* pasynuser, epicsUInt32 value, epicsUInt32 mask)
+{	
+	epicsGuard<epicsMutex> guard(this->stateMutex);
+	this->getWriteFunction(pasynuser->reason);
+	
+	if (lua_isnil(this->state, -1))
+	{
+		lua_pop(this->state, 1);
+		return asynPortDriver::writeUInt32Digital(pasynuser, value, mask);
+	}
+
+	lua_pushinteger(this->state, value & mask);
+	lua_pushinteger(this->state, mask);
+	if (this->callWriteFunction(pasynuser, 1))    { return asynError; }
+	
+	this->callParamCallbacks();
+	return asynSuccess;
+}
+
+asynStatus luaPortDriver::readUInt32Digital(asynUser* pasynuser, epicsUInt32* value, epicsUInt32 mask)
+{	
+	epicsGuard<epicsMutex> guard(this->stateMutex);
+	this->getReadFunction(pasynuser->reason);
+
+	if (lua_isnil(this->state, -1))
+	{
+		lua_pop(this->state, 1);
+		return asynPortDriver::readUInt32Digital(pasynuser, value, mask);
+	}
+
+	if (this->callReadFunction(pasynuser))    { return asynError; }
+
+	if (! lua_isnil(this->state, -1))    { *value = ((epicsUInt32) lua_tointeger(this->state, -1)) & mask; }
+
+	lua_pop(this->state, 1);
+	return asynSuccess;
+}
+
+/*
+ * Array parameters are read by copying the epics.array
+ * (or table) returned by the read function into the
+ * asyn buffer. Writes hand the write function a new
+ * epics.array holding the values. Both return false
+ * if no function is bound, so the caller can fall back
+ * to asynPortDriver.
+ */
+bool luaPortDriver::readArray(asynUser* pasynuser, void* value, lua_array_type type, size_t nElements, size_t* nIn, asynStatus* status)
+{
+	epicsGuard<epicsMutex> guard(this->stateMutex);
+	this->getReadFunction(pasynuser->reason);
+
+	if (lua_isnil(this->state, -1))
+	{
+		lua_pop(this->state, 1);
+		return false;
+	}
+
+	*nIn = 0;
+	*status = asynSuccess;
+
+	if (this->callReadFunction(pasynuser))
+	{
+		lua_pop(this->state, 1);
+		*status = asynError;
+		return true;
+	}
+
+	*nIn = luaAsynPullArray(this->state, -1, value, type, nElements);
+	lua_pop(this->state, 1);
+
+	return true;
+}
+
+bool luaPortDriver::writeArray(asynUser* pasynuser, const void* value, lua_array_type type, size_t nElements, asynStatus* status)
+{
+	epicsGuard<epicsMutex> guard(this->stateMutex);
+	this->getWriteFunction(pasynuser->reason);
+
+	if (lua_isnil(this->state, -1))
+	{
+		lua_pop(this->state, 1);
+		return false;
+	}
+
+	luaAsynPushArray(this->state, value, type, nElements);
+
+	if (this->callWriteFunction(pasynuser))
+	{
+		lua_pop(this->state, 1);
+		*status = asynError;
+		return true;
+	}
+
+	this->callParamCallbacks();
+	*status = asynSuccess;
+	return true;
+}
+
+asynStatus luaPortDriver::readInt8Array(asynUser* pasynuser, epicsInt8* value, size_t nElements, size_t* nIn)
+{
+	asynStatus status;
+	if (this->readArray(pasynuser, value, LUA_ARRAY_INT8, nElements, nIn, &status))    { return status; }
+	return asynPortDriver::readInt8Array(pasynuser, value, nElements, nIn);
+}
+
+asynStatus luaPortDriver::writeInt8Array(asynUser* pasynuser, epicsInt8* value, size_t nElements)
+{
+	asynStatus status;
+	if (this->writeArray(pasynuser, value, LUA_ARRAY_INT8, nElements, &status))    { return status; }
+	return asynPortDriver::writeInt8Array(pasynuser, value, nElements);
+}
+
+asynStatus luaPortDriver::readInt16Array(asynUser* pasynuser, epicsInt16* value, size_t nElements, size_t* nIn)
+{
+	asynStatus status;
+	if (this->readArray(pasynuser, value, LUA_ARRAY_INT16, nElements, nIn, &status))    { return status; }
+	return asynPortDriver::readInt16Array(pasynuser, value, nElements, nIn);
+}
+
+asynStatus luaPortDriver::writeInt16Array(asynUser* pasynuser, epicsInt16* value, size_t nElements)
+{
+	asynStatus status;
+	if (this->writeArray(pasynuser, value, LUA_ARRAY_INT16, nElements, &status))    { return status; }
+	return asynPortDriver::writeInt16Array(pasynuser, value, nElements);
+}
+
+asynStatus luaPortDriver::readInt32Array(asynUser* pasynuser, epicsInt32* value, size_t nElements, size_t* nIn)
+{
+	asynStatus status;
+	if (this->readArray(pasynuser, value, LUA_ARRAY_INT32, nElements, nIn, &status))    { return status; }
+	return asynPortDriver::readInt32Array(pasynuser, value, nElements, nIn);
+}
+
+asynStatus luaPortDriver::writeInt32Array(asynUser* pasynuser, epicsInt32* value, size_t nElements)
+{
+	asynStatus status;
+	if (this->writeArray(pasynuser, value, LUA_ARRAY_INT32, nElements, &status))    { return status; }
+	return asynPortDriver::writeInt32Array(pasynuser, value, nElements);
+}
+
+asynStatus luaPortDriver::readFloat64Array(asynUser* pasynuser, epicsFloat64* value, size_t nElements, size_t* nIn)
+{
+	asynStatus status;
+	if (this->readArray(pasynuser, value, LUA_ARRAY_FLOAT64, nElements, nIn, &status))    { return status; }
+	return asynPortDriver::readFloat64Array(pasynuser, value, nElements, nIn);
+}
+
+asynStatus luaPortDriver::writeFloat64Array(asynUser* pasynuser, epicsFloat64* value, size_t nElements)
+{
+	asynStatus status;
+	if (this->writeArray(pasynuser, value, LUA_ARRAY_FLOAT64, nElements, &status))    { return status; }
+	return asynPortDriver::writeFloat64Array(pasynuser, value, nElements);
+}
+
 int lnewdriver(lua_State* state)
 {
-	lua_settop(state, 3);
+	lua_settop(state, 5);
 	const char* port_name = luaL_checkstring(state, 1);
 	const char* filepath = luaL_checkstring(state, 2);
 	const char* macros = lua_tostring(state, 3);
+	int max_addr = (int) luaL_optinteger(state, 4, 1);
+	bool own_thread = lua_toboolean(state, 5);
 
-	new luaPortDriver(port_name, filepath, macros);
+	new luaPortDriver(port_name, filepath, macros, max_addr > 0 ? max_addr : 1, own_thread);
 
 	return 0;
 }
@@ -520,12 +782,16 @@ int lnewdriver(lua_State* state)
 static const iocshArg newdriverCmdArg0 = { "asyn port name", iocshArgString };
 static const iocshArg newdriverCmdArg1 = { "filename of defintion file", iocshArgString };
 static const iocshArg newdriverCmdArg2 = { "macro definitions", iocshArgString };
-static const iocshArg* newdriverCmdArgs[3] = {&newdriverCmdArg0, &newdriverCmdArg1, &newdriverCmdArg2};
-static const iocshFuncDef newdriverFuncDef = {"luaPortDriver", 3, newdriverCmdArgs};
+static const iocshArg newdriverCmdArg3 = { "max address", iocshArgInt };
+static const iocshArg newdriverCmdArg4 = { "own thread", iocshArgInt };
+static const iocshArg* newdriverCmdArgs[5] = {&newdriverCmdArg0, &newdriverCmdArg1, &newdriverCmdArg2, &newdriverCmdArg3, &newdriverCmdArg4};
+static const iocshFuncDef newdriverFuncDef = {"luaPortDriver", 5, newdriverCmdArgs};
 
 static void newdriverCallFunc(const iocshArgBuf* args)
 {
-	new luaPortDriver(args[0].sval, args[1].sval, args[2].sval);
+	int max_addr = args[3].ival > 0 ? args[3].ival : 1;
+
+	new luaPortDriver(args[0].sval, args[1].sval, args[2].sval, max_addr, args[4].ival != 0);
 }
 
 static void portDriverRegister(void)
@@ -3,35 +3,64 @@
 
 #include "asynPortDriver.h"
 #include "luaEpics.h"
+#include "lasynlib.h"
 #include <epicsMutex.h>
 #include <map>
 #include <string>
+#include <vector>
 #include "epicsTypes.h"
 
 class luaPortDriver : public asynPortDriver
 {
 	public:
-		luaPortDriver(const char* port_name, const char* lua_filepath, const char* lua_macros);
+		luaPortDriver(const char* port_name, const char* lua_filepath, const char* lua_macros, int max_addr = 1, bool own_thread = false);
 		~luaPortDriver();
 				
 		asynStatus writeInt32(asynUser* pasynuser, epicsInt32 value);
 		asynStatus readInt32(asynUser* pasynuser, epicsInt32* value);
 		
+#ifdef LUA_ASYN_INT64
+		asynStatus writeInt64(asynUser* pasynuser, epicsInt64 value);
+		asynStatus readInt64(asynUser* pasynuser, epicsInt64* value);
+#endif
+		
+		asynStatus writeUInt32Digital(asynUser* pasynuser, epicsUInt32 value, epicsUInt32 mask);
+		asynStatus readUInt32Digital(asynUser* pasynuser, epicsUInt32* value, epicsUInt32 mask);
+		
 		asynStatus writeFloat64(asynUser* pasynuser, epicsFloat64 value);
 		asynStatus readFloat64(asynUser* pasynuser, epicsFloat64* value);
 		
 		asynStatus writeOctet(asynUser* pasynuser, const char* value, size_t maxChars, size_t* actual);
 		asynStatus readOctet(asynUser* pasynuser, char* value, size_t maxChars, size_t* actual, int* eomReason);
 		
+		asynStatus writeInt8Array(asynUser* pasynuser, epicsInt8* value, size_t nElements);
+		asynStatus readInt8Array(asynUser* pasynuser, epicsInt8* value, size_t nElements, size_t* nIn);
+		
+		asynStatus writeInt16Array(asynUser* pasynuser, epicsInt16* value, size_t nElements);
+		asynStatus readInt16Array(asynUser* pasynuser, epicsInt16* value, size_t nElements, size_t* nIn);
+		
+		asynStatus writeInt32Array(asynUser* pasynuser, epicsInt32* value, size_t nElements);
+		asynStatus readInt32Array(asynUser* pasynuser, epicsInt32* value, size_t nElements, size_t* nIn);
+		
+		asynStatus writeFloat64Array(asynUser* pasynuser, epicsFloat64* value, size_t nElements);
+		asynStatus readFloat64Array(asynUser* pasynuser, epicsFloat64* value, size_t nElements, size_t* nIn);
+		
 	protected:
 		void getReadFunction(int index);
 		void getWriteFunction(int index);
 		
-		int callReadFunction();
-		int callWriteFunction();
+		int callReadFunction(asynUser* pasynuser);
+		int callWriteFunction(asynUser* pasynuser, int extra = 0);
+		
+		bool readArray(asynUser* pasynuser, void* value, lua_array_type type, size_t nElements, size_t* nIn, asynStatus* status);
+		bool writeArray(asynUser* pasynuser, const void* value, lua_array_type type, size_t nElements, asynStatus* status);
 		
 		lua_State* state;
 		epicsMutex stateMutex;
+		
+		/* Registry references of the read and write functions, by parameter index */
+		std::vector<int> readRefs;
+		std::vector<int> writeRefs;
 };
 
 int lnewdriver(lua_State* state);
@@ -11,6 +11,7 @@
 #include <menuIvoa.h>
 #include <epicsMutex.h>
 #include <epicsGuard.h>
+#include <epicsTime.h>
 
 #include <epicsExport.h>
 
@@ -19,10 +20,12 @@
 #undef  GEN_SIZE_OFFSET
 
 #include "luaEpics.h"
+#include "larraylib.h"
 
 #include <sstream>
 
 #include <cstring>
+#include <cctype>
 #include <cmath>
 #include <vector>
 #include <stdlib.h>
@@ -37,14 +40,13 @@
 #define VAL_CHANGE  1
 #define SVAL_CHANGE 2
 
+/* Weight of the newest run in EAVG */
+#define EAVG_WEIGHT 0.1
+
 #define NO_CA_LINKS     0
 #define CA_LINKS_ALL_OK 1
 #define CA_LINKS_NOT_OK 2
 
-/* mark in error messages for incomplete statements */
-#define EOFMARK		"<eof>"
-#define marklen		(sizeof(EOFMARK)/sizeof(char) - 1)
-
 #include "epicsVersion.h"
 #ifdef VERSION_INT
 
@@ -59,6 +61,10 @@
 #   define dbLinkIsVolatile(lnk) ((lnk)->type == CA_LINK)
 # endif
 
+# if EPICS_VERSION_INT >= VERSION_INT(3,16,1,0)
+#   define HAS_MONOTONIC_TIME
+# endif
+
 #else
 # define RECSUPFUN_CAST (RECSUPFUN)
 # define dbLinkIsConstant(lnk) ((lnk)->type == CONSTANT)
@@ -85,6 +91,7 @@ static long process(dbCommon* common);
 static long special(dbAddr *paddr, int after);
 static void luaExecCallback(CALLBACK* cb);
 static void compilePcal(luascriptRecord* record);
+static int  compileCall(luascriptRecord* record);
 static long get_precision(const dbAddr* paddr, long* precision);
 static long get_units(dbAddr* paddr, char* units);
 static long get_graphic_double(dbAddr* paddr, struct dbr_grDouble* pgd);
@@ -103,6 +110,23 @@ typedef struct ScriptDSET
 	DEVSUPFUN  write;
 } ScriptDSET;
 
+/*
+ * Grow-only buffer reused across process cycles, so array inputs and
+ * outputs stop allocating once they have reached their largest size.
+ */
+typedef struct ArrayBuffer {
+	void*       data;
+	size_t      capacity;
+} ArrayBuffer;
+
+/* The field type behind a string input that isn't a CA link */
+typedef struct InputBinding {
+	bool        resolved;      /* field_type, elements, and status are valid */
+	short       field_type;
+	long        elements;
+	long        status;
+} InputBinding;
+
 typedef struct rpvtStruct {
 	CALLBACK	luaExecCb;
 	CALLBACK	doOutCb;
@@ -114,9 +138,20 @@ typedef struct rpvtStruct {
 	short		luaReturnType; /* LUA_TNUMBER, LUA_TSTRING, LUA_TTABLE, or LUA_TNIL */
 	short		luaCompleted;  /* set by async callback, checked by process() pass 2 */
 	int			pcalRef;       /* luaL_ref key for compiled PCAL chunk */
+	int			callRef;       /* luaL_ref key for compiled CALL chunk */
 	short		stateReloaded; /* force changed flags true after state reload */
 	bool        my_state;
 	epicsMutex* luaStateMutex;
+	ArrayBuffer avalBuffer;    /* storage behind AVAL */
+	ArrayBuffer pavlBuffer;    /* storage behind PAVL, swapped with avalBuffer */
+	ArrayBuffer inputBuffer;   /* staging for array inputs */
+	unsigned long timedRuns;   /* runs in EMIN/EMAX/EAVG, reset by ERST */
+	double      execSeconds;   /* executeLua + handleResults of the last run */
+	double      queuedAt;      /* when the async run was requested */
+	double      queueSeconds;  /* callback queue wait of the last async run */
+	InputBinding strInputs[STR_ARGS];
+	bool        numUsed[NUM_ARGS];  /* CODE or PCAL mentions the input */
+	bool        strUsed[STR_ARGS];
 } rpvtStruct;
 
 extern "C"
@@ -229,12 +264,20 @@ static int getState(luascriptRecord* record, std::string name)
 	{
 		record->state = luaNamedState(name.c_str());
 		((rpvtStruct*) record->rpvt)->my_state = false;
-		return 0;
+		return record->state ? 0 : -1;
 	}
 
 	record->state = luaCreateState();
 	((rpvtStruct*) record->rpvt)->my_state = true;
 
+	if (! record->state)
+	{
+		errlogPrintf("%s: unable to create a Lua state\n", record->name);
+		return -1;
+	}
+
+	luaSetStateOwner((lua_State*) record->state, record->name);
+
 	if (name.empty())    { return 0; }
 
 	long status = luaLoadScript((lua_State*) record->state, name.c_str());
@@ -255,6 +298,20 @@ static int getState(luascriptRecord* record, std::string name)
  */
 static int initState(luascriptRecord* record)
 {
+	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
+
+	/* Compiled chunks are stored in the current state, drop them before it changes */
+	if (record->state != NULL)
+	{
+		lua_State* state = (lua_State*) record->state;
+
+		if (pvt->callRef != LUA_NOREF)    { luaL_unref(state, LUA_REGISTRYINDEX, pvt->callRef); }
+		if (pvt->pcalRef != LUA_NOREF)    { luaL_unref(state, LUA_REGISTRYINDEX, pvt->pcalRef); }
+	}
+
+	pvt->callRef = LUA_NOREF;
+	pvt->pcalRef = LUA_NOREF;
+
 	/* Clear existing errors (only post if there was a previous error) */
 	if (record->err[0] != '\0')
 	{
@@ -313,8 +370,144 @@ static long getFieldInfo(DBLINK* field, short* field_type, long* elements)
 
 
 /*
- * Grabs the new values of every numerical input link and
- * pushes the result to the lua stack.
+ * Field type and element count behind a string input. Only CA links can
+ * change type, when they reconnect, so every other link is looked up
+ * once and again after the link field is changed.
+ */
+static long inputInfo(InputBinding* input, DBLINK* field, short* field_type, long* elements)
+{
+	if (field->type == CA_LINK)    { return getFieldInfo(field, field_type, elements); }
+
+	if (! input->resolved)
+	{
+		input->field_type = 0;
+		input->elements = 1;
+		input->status = getFieldInfo(field, &input->field_type, &input->elements);
+		input->resolved = true;
+	}
+
+	*field_type = input->field_type;
+	*elements   = input->elements;
+
+	return input->status;
+}
+
+/* True if name appears in text as a whole identifier */
+static bool mentions(const std::string& text, const char* name)
+{
+	size_t length = strlen(name);
+
+	for (size_t at = text.find(name); at != std::string::npos; at = text.find(name, at + 1))
+	{
+		bool before = at > 0 && (isalnum((unsigned char) text[at - 1]) || text[at - 1] == '_');
+		bool after  = at + length < text.size() && (isalnum((unsigned char) text[at + length]) || text[at + length] == '_');
+
+		if (! before && ! after)    { return true; }
+	}
+
+	return false;
+}
+
+/*
+ * Finds the inputs that CODE and PCAL refer to, by their value or
+ * changed flag. Code from a file or named state can read any of them
+ * from its functions, so then every input counts as used.
+ */
+static void findUsedInputs(luascriptRecord* record)
+{
+	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
+
+	std::string text = std::string(record->code) + "\n" + record->pcal;
+	bool all = (record->code[0] == '@');
+
+	for (unsigned index = 0; index < NUM_ARGS; index += 1)
+	{
+		pvt->numUsed[index] = all || mentions(text, NUM_NAMES[index]) || mentions(text, CHANGED_NUM_NAMES[index]);
+	}
+
+	for (unsigned index = 0; index < STR_ARGS; index += 1)
+	{
+		pvt->strUsed[index] = all || mentions(text, STR_NAMES[index]) || mentions(text, CHANGED_STR_NAMES[index]);
+	}
+}
+
+/*
+ * Registry table holding the names of the input globals, so setting
+ * one takes a lua_rawgeti of its name rather than interning it.
+ */
+#define INPUT_KEYS "luascript_input_keys"
+
+enum
+{
+	KEY_NUM         = 1,
+	KEY_CHANGED_NUM = KEY_NUM + NUM_ARGS,
+	KEY_STR         = KEY_CHANGED_NUM + NUM_ARGS,
+	KEY_CHANGED_STR = KEY_STR + STR_ARGS,
+	KEY_SELF        = KEY_CHANGED_STR + STR_ARGS
+};
+
+static void pushInputKeys(lua_State* state)
+{
+	if (lua_getfield(state, LUA_REGISTRYINDEX, INPUT_KEYS) == LUA_TTABLE)    { return; }
+
+	lua_pop(state, 1);
+	lua_createtable(state, KEY_SELF, 0);
+
+	for (unsigned index = 0; index < NUM_ARGS; index += 1)
+	{
+		lua_pushstring(state, NUM_NAMES[index]);
+		lua_rawseti(state, -2, KEY_NUM + index);
+		lua_pushstring(state, CHANGED_NUM_NAMES[index]);
+		lua_rawseti(state, -2, KEY_CHANGED_NUM + index);
+	}
+
+	for (unsigned index = 0; index < STR_ARGS; index += 1)
+	{
+		lua_pushstring(state, STR_NAMES[index]);
+		lua_rawseti(state, -2, KEY_STR + index);
+		lua_pushstring(state, CHANGED_STR_NAMES[index]);
+		lua_rawseti(state, -2, KEY_CHANGED_STR + index);
+	}
+
+	lua_pushstring(state, "self");
+	lua_rawseti(state, -2, KEY_SELF);
+
+	lua_pushvalue(state, -1);
+	lua_setfield(state, LUA_REGISTRYINDEX, INPUT_KEYS);
+}
+
+/*
+ * Pushes the globals table and the key table. Globals with a
+ * metatable (such as a strict mode) are set through it.
+ */
+static bool pushInputTables(lua_State* state)
+{
+	lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+
+	bool raw = ! lua_getmetatable(state, -1);
+
+	if (! raw)    { lua_pop(state, 1); }
+
+	pushInputKeys(state);
+
+	return raw;
+}
+
+/* Pops a value and sets the global named by entry key of the key table */
+static void setInput(lua_State* state, int globals, int keys, int key, bool raw)
+{
+	lua_rawgeti(state, keys, key);
+	lua_insert(state, -2);
+
+	if (raw)    { lua_rawset(state, globals); }
+	else        { lua_settable(state, globals); }
+}
+
+/*
+ * Grabs the new values of every numerical input link and sets the
+ * globals of the inputs the code uses. Those are set on each process,
+ * since scripts and other records sharing the state may assign to them.
+ * Unused inputs without a link are skipped entirely.
  */
 static long loadNumbers(luascriptRecord* record)
 {
@@ -327,41 +520,89 @@ static long loadNumbers(luascriptRecord* record)
 
 	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
 
+	bool raw = pushInputTables(state);
+	int keys = lua_gettop(state);
+	int globals = keys - 1;
+
 	for (unsigned index = 0; index < NUM_ARGS; index += 1)
 	{
+		bool used = pvt->numUsed[index];
+
+		if (! used && dbLinkIsConstant(field))
+		{
+			field++;
+			value++;
+			continue;
+		}
+
 		double prev = *value;
 
-		long newStatus = dbGetLink(field, DBR_DOUBLE, value, 0, 0);
+		/* Constant links have nothing to read, the value stays in the field */
+		if (! dbLinkIsConstant(field))
+		{
+			long newStatus = dbGetLink(field, DBR_DOUBLE, value, 0, 0);
 
-		if (!status)    { status = newStatus; }
+			if (!status)    { status = newStatus; }
+		}
 
-		/* Set changed flag (force true after state reload) */
-		lua_pushboolean(state, pvt->stateReloaded || fabs(*value - prev) > 0.0);
-		lua_setglobal(state, CHANGED_NUM_NAMES[index]);
+		if (used)
+		{
+			/* Set changed flag (force true after state reload) */
+			lua_pushboolean(state, pvt->stateReloaded || fabs(*value - prev) > 0.0);
+			setInput(state, globals, keys, KEY_CHANGED_NUM + index, raw);
 
-		lua_pushnumber(state, *value);
-		lua_setglobal(state, NUM_NAMES[index]);
+			lua_pushnumber(state, *value);
+			setInput(state, globals, keys, KEY_NUM + index, raw);
+		}
 
 		field++;
 		value++;
 	}
 
+	lua_pop(state, 2);
+
 	return status;
 }
 
 
+/*
+ * Returns storage for at least bytes bytes, growing the buffer if
+ * needed. Contents are not preserved when the buffer grows.
+ */
+static void* reserveBuffer(ArrayBuffer* buffer, size_t bytes)
+{
+	if (buffer->data && bytes <= buffer->capacity)    { return buffer->data; }
+
+	size_t capacity = buffer->capacity ? buffer->capacity : 64;
+
+	while (capacity < bytes)    { capacity *= 2; }
+
+	void* data = malloc(capacity);
+
+	if (! data)    { return NULL; }
+
+	free(buffer->data);
+	buffer->data = data;
+	buffer->capacity = capacity;
+
+	return data;
+}
+
 /*
  * Pull elements number of values from a multi-element link,
  * put them into a lua table, and then put the table onto
  * the stack.
  */
 template <typename T>
-static int createTable(lua_State* state, DBLINK* field, short field_type, long* elements, TableOutput output_type)
+static int createTable(lua_State* state, ArrayBuffer* buffer, DBLINK* field, short field_type, long* elements, TableOutput output_type)
 {
-	T *data = new T[*elements];
+	T *data = (T*) reserveBuffer(buffer, sizeof(T) * *elements);
+
+	if (! data)    { return -1; }
+
 	int status = dbGetLink(field, field_type, data, 0, elements);
 
-	if (status) { delete[] data; return status; }
+	if (status) { return status; }
 
 	lua_createtable(state, *elements, 0);
 	
@@ -379,7 +620,6 @@ static int createTable(lua_State* state, DBLINK* field, short field_type, long*
 		lua_rawseti(state, -2, elem + 1);
 	}
 
-	delete[] data;
 	return 0;
 }
 
@@ -390,7 +630,7 @@ static int createTable(lua_State* state, DBLINK* field, short field_type, long*
  * returned array is based on the type of the first element of
  * the array in lua.
  */
-static void* convertTable(lua_State* state, int* generated_size, epicsEnum16* arraytype)
+static void* convertTable(lua_State* state, ArrayBuffer* buffer, int* generated_size, epicsEnum16* arraytype)
 {
 	// Get the length of the array
 	lua_len(state, -1);
@@ -409,7 +649,8 @@ static void* convertTable(lua_State* state, int* generated_size, epicsEnum16* ar
 		{
 			if (! is_integer)
 			{
-				double* output = new double[array_size];
+				double* output = (double*) reserveBuffer(buffer, sizeof(double) * array_size);
+				if (! output)    { break; }
 				*generated_size = sizeof(double) * array_size;
 				*arraytype = luascriptAVALType_Double;
 
@@ -428,7 +669,8 @@ static void* convertTable(lua_State* state, int* generated_size, epicsEnum16* ar
 
 		case LUA_TBOOLEAN:
 		{
-			int* output = new int[array_size];
+			int* output = (int*) reserveBuffer(buffer, sizeof(int) * array_size);
+			if (! output)    { break; }
 			*generated_size = sizeof(int) * array_size;
 			*arraytype = luascriptAVALType_Integer;
 
@@ -444,7 +686,8 @@ static void* convertTable(lua_State* state, int* generated_size, epicsEnum16* ar
 
 		case LUA_TSTRING:
 		{
-			char* output = new char[array_size];
+			char* output = (char*) reserveBuffer(buffer, sizeof(char) * array_size);
+			if (! output)    { break; }
 			*generated_size = sizeof(char) * array_size;
 			*arraytype = luascriptAVALType_Char;
 
@@ -459,9 +702,37 @@ static void* convertTable(lua_State* state, int* generated_size, epicsEnum16* ar
 		}
 
 		default:
-			*generated_size = 0;
-			return NULL;
+			break;
+	}
+
+	*generated_size = 0;
+	return NULL;
+}
+
+/*
+ * convertArray -- copy an epics.array result into the AVAL buffer in
+ * one pass. Float arrays are stored as Double, integer arrays as
+ * Integer.
+ */
+static void* convertArray(lua_array* array, ArrayBuffer* buffer, int* generated_size, epicsEnum16* arraytype)
+{
+	bool floating = (array->type == LUA_ARRAY_FLOAT32 || array->type == LUA_ARRAY_FLOAT64);
+	size_t element = floating ? sizeof(double) : sizeof(int);
+
+	void* output = reserveBuffer(buffer, element * array->count);
+
+	if (! output)
+	{
+		*generated_size = 0;
+		return NULL;
 	}
+
+	luaArrayCopyOut(array, output, floating ? DBF_DOUBLE : DBF_LONG, array->count);
+
+	*generated_size = (int) (element * array->count);
+	*arraytype = floating ? luascriptAVALType_Double : luascriptAVALType_Integer;
+
+	return output;
 }
 
 static long loadStrings(luascriptRecord* record)
@@ -476,12 +747,27 @@ static long loadStrings(luascriptRecord* record)
 
 	long status = 0;
 
+	bool raw = pushInputTables(state);
+	int keys = lua_gettop(state);
+	int globals = keys - 1;
+
 	for (unsigned index = 0; index < STR_ARGS; index += 1)
 	{
+		InputBinding* input = &pvt->strInputs[index];
+		bool used = pvt->strUsed[index];
+
+		if (! used && dbLinkIsConstant(field))
+		{
+			field++;
+			prev_str++;
+			strvalue += STRING_SIZE;
+			continue;
+		}
+
 		short field_type = 0;
 		long elements = 1;
 
-		long newStatus = getFieldInfo(field, &field_type, &elements);
+		long newStatus = inputInfo(input, field, &field_type, &elements);
 
 		if (newStatus)
 		{
@@ -503,20 +789,18 @@ static long loadStrings(luascriptRecord* record)
 				// Use AA .. JJ if INAA..INJJ are empty
 				if ( field->type == CONSTANT )
 				{
-					char tempstr[STRING_SIZE] = { '\0' };
-					strncpy(tempstr, strvalue, STRING_SIZE - 1);
-					tempstr[STRING_SIZE - 1] = '\0';
+					strvalue[STRING_SIZE - 1] = '\0';
 					changed = pvt->stateReloaded ? 1 : 0;
- 					lua_pushstring(state, tempstr);
- 					break;
+					lua_pushstring(state, strvalue);
+					break;
 				}
 
 				if (elements > 1)
 				{
 					/* String array: create a Lua table of strings */
 					/* changed stays 1 (always true for table inputs) */
-					char* buf = new char[elements * MAX_STRING_SIZE];
-					linkStatus = dbGetLink(field, DBR_STRING, buf, 0, &elements);
+					char* buf = (char*) reserveBuffer(&pvt->inputBuffer, elements * MAX_STRING_SIZE);
+					linkStatus = buf ? dbGetLink(field, DBR_STRING, buf, 0, &elements) : -1;
 					if (!linkStatus)
 					{
 						lua_createtable(state, elements, 0);
@@ -526,7 +810,6 @@ static long loadStrings(luascriptRecord* record)
 							lua_rawseti(state, -2, i + 1);
 						}
 					}
-					delete[] buf;
 				}
 				else
 				{
@@ -538,7 +821,8 @@ static long loadStrings(luascriptRecord* record)
 					{
 						changed = pvt->stateReloaded || (strcmp(tempstr, strvalue) != 0);
 						memcpy(strvalue, tempstr, STRING_SIZE);
-						lua_pushstring(state, tempstr);
+						strvalue[STRING_SIZE - 1] = '\0';
+						lua_pushstring(state, strvalue);
 					}
 				}
 
@@ -549,8 +833,8 @@ static long loadStrings(luascriptRecord* record)
 			{
 				if (field_type == 1 && elements > 1)  /* DBF_CHAR array: read as string */
 				{
-					char* buf = new char[elements + 1];
-					linkStatus = dbGetLink(field, DBR_CHAR, buf, 0, &elements);
+					char* buf = (char*) reserveBuffer(&pvt->inputBuffer, elements + 1);
+					linkStatus = buf ? dbGetLink(field, DBR_CHAR, buf, 0, &elements) : -1;
 					if (!linkStatus)
 					{
 						buf[elements] = '\0';
@@ -563,42 +847,34 @@ static long loadStrings(luascriptRecord* record)
 						strncpy(strvalue, buf, STRING_SIZE - 1);
 						strvalue[STRING_SIZE - 1] = '\0';
 					}
-					delete[] buf;
 				}
 				else if (field_type == 1)  /* DBF_CHAR scalar */
 				{
 					/* Table output -- changed stays 1 */
-					linkStatus = createTable<epicsInt8>(state, field, DBR_CHAR, &elements, Characters);
+					linkStatus = createTable<epicsInt8>(state, &pvt->inputBuffer, field, DBR_CHAR, &elements, Characters);
 				}
 				else  /* DBF_UCHAR */
 				{
 					/* Table output -- changed stays 1 */
-					linkStatus = createTable<epicsUInt8>(state, field, DBR_CHAR, &elements, Integers);
+					linkStatus = createTable<epicsUInt8>(state, &pvt->inputBuffer, field, DBR_CHAR, &elements, Integers);
 				}
 				break;
 			}
 
 			case DB_LUA_INTEGER:
 			{
-				/* Table output -- changed stays 1 */
-				if (field_type == 3)       /* DBF_SHORT */
-					linkStatus = createTable<epicsInt16>(state, field, DBR_LONG, &elements, Integers);
-				else if (field_type == 4)  /* DBF_USHORT */
-					linkStatus = createTable<epicsUInt16>(state, field, DBR_LONG, &elements, Integers);
-				else if (field_type == 5)  /* DBF_LONG */
-					linkStatus = createTable<epicsInt32>(state, field, DBR_LONG, &elements, Integers);
-				else                       /* DBF_ULONG */
-					linkStatus = createTable<epicsUInt32>(state, field, DBR_LONG, &elements, Integers);
+				/* Table output -- changed stays 1. The element type matches the requested DBR type */
+				if (field_type == 6)       /* DBF_ULONG */
+					linkStatus = createTable<epicsUInt32>(state, &pvt->inputBuffer, field, DBR_ULONG, &elements, Integers);
+				else                       /* DBF_SHORT, DBF_USHORT, DBF_LONG */
+					linkStatus = createTable<epicsInt32>(state, &pvt->inputBuffer, field, DBR_LONG, &elements, Integers);
 				break;
 			}
 
 			case DB_LUA_DOUBLE:
 			{
 				/* Table output -- changed stays 1 */
-				if (field_type == 9)       /* DBF_FLOAT */
-					linkStatus = createTable<epicsFloat32>(state, field, DBR_DOUBLE, &elements, Numbers);
-				else                       /* DBF_DOUBLE, DBF_INT64, DBF_UINT64 */
-					linkStatus = createTable<epicsFloat64>(state, field, DBR_DOUBLE, &elements, Numbers);
+				linkStatus = createTable<epicsFloat64>(state, &pvt->inputBuffer, field, DBR_DOUBLE, &elements, Numbers);
 				break;
 			}
 
@@ -607,11 +883,20 @@ static long loadStrings(luascriptRecord* record)
 				break;
 		}
 
-		/* Set the changed flag global */
-		lua_pushboolean(state, changed);
-		lua_setglobal(state, CHANGED_STR_NAMES[index]);
+		/* Unused inputs with a link are still read, to keep the field current */
+		if (! used)
+		{
+			if (!linkStatus)    { lua_pop(state, 1); }
+		}
+		else
+		{
+			/* Set the changed flag global */
+			lua_pushboolean(state, changed);
+			setInput(state, globals, keys, KEY_CHANGED_STR + index, raw);
+
+			if (!linkStatus)    { setInput(state, globals, keys, KEY_STR + index, raw); }
+		}
 
-		if (!linkStatus)    { lua_setglobal(state, STR_NAMES[index]); }
 		if (!status)        { status = linkStatus; }
 
 		field++;
@@ -620,7 +905,9 @@ static long loadStrings(luascriptRecord* record)
 	}
 
 	lua_pushstring(state, record->name);
-	lua_setglobal(state, "self");
+	setInput(state, globals, keys, KEY_SELF, raw);
+
+	lua_pop(state, 2);
 
 	return status;
 }
@@ -820,6 +1107,7 @@ static long init_record(dbCommon* common, int pass)
 		((rpvtStruct*) record->rpvt)->luaError = 0;
 		((rpvtStruct*) record->rpvt)->luaCompleted = 0;
 		((rpvtStruct*) record->rpvt)->pcalRef = LUA_NOREF;
+		((rpvtStruct*) record->rpvt)->callRef = LUA_NOREF;
 		((rpvtStruct*) record->rpvt)->stateReloaded = 1;
 		callbackSetCallback(luaExecCallback, &((rpvtStruct*) record->rpvt)->luaExecCb);
 		callbackSetUser(record, &((rpvtStruct*) record->rpvt)->luaExecCb);
@@ -961,6 +1249,9 @@ static void compilePcal(luascriptRecord* record)
 	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
 	lua_State* state = (lua_State*) record->state;
 
+	/* CODE and PCAL are both settled whenever PCAL is compiled */
+	findUsedInputs(record);
+
 	/* Free any existing compiled chunk */
 	if (pvt->pcalRef != LUA_NOREF)
 	{
@@ -1008,27 +1299,52 @@ static void writeValue(luascriptRecord* record)
 }
 
 
-static int incomplete(lua_State* L, int status)
+/*
+ * compileCall -- compile the CALL substring and store the compiled
+ * chunk in the Lua registry so that process() only has to push and
+ * run it. The code is first tried as "return <call>" so that bare
+ * expressions produce a value. On failure the error message is left
+ * on the stack for the caller.
+ */
+static int compileCall(luascriptRecord* record)
 {
-	if (status == LUA_ERRSYNTAX)
+	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
+	lua_State* state = (lua_State*) record->state;
+
+	if (pvt->callRef != LUA_NOREF)
 	{
-		size_t lmsg;
-		const char *msg = lua_tolstring(L, -1, &lmsg);
+		luaL_unref(state, LUA_REGISTRYINDEX, pvt->callRef);
+		pvt->callRef = LUA_NOREF;
+	}
 
-		if (lmsg >= marklen && strcmp(msg + lmsg - marklen, EOFMARK) == 0)
-		{
-			lua_pop(L, 1);
-			return 1;
-		}
+	record->ccnt += 1;
+	db_post_events(record, &record->ccnt, DBE_VALUE);
+
+	lua_pushstring(state, (const char*) record->call);
+	int status = addreturn(state);
+
+	if (status != LUA_OK)
+	{
+		size_t len;
+		const char *buffer = lua_tolstring(state, -1, &len);
+		status = luaL_loadbuffer(state, buffer, len, "=stdin");
 	}
 
-	return 0;
+	/* Remove the source line, leaving the chunk or error message */
+	lua_remove(state, -2);
+
+	if (status != LUA_OK)    { return status; }
+
+	pvt->callRef = luaL_ref(state, LUA_REGISTRYINDEX);
+
+	return LUA_OK;
 }
 
 /*
- * executeLua -- compile and execute the Lua code in record->call.
- * Sets pvt->luaError to 1 on failure, 0 on success.
- * On success, the return value is left on the Lua stack.
+ * executeLua -- run the compiled chunk for record->call, compiling
+ * it first if the cache was invalidated. Sets pvt->luaError to 1 on
+ * failure, 0 on success. On success, the return value is left on the
+ * Lua stack.
  */
 static void executeLua(luascriptRecord* record)
 {
@@ -1037,34 +1353,16 @@ static void executeLua(luascriptRecord* record)
 
 	pvt->luaError = 0;
 
-	lua_pushstring(state, (const char*) record->call);
-	int status = addreturn(state);
-
-	if (status != LUA_OK)
+	if (pvt->callRef == LUA_NOREF && compileCall(record) != LUA_OK)
 	{
-		size_t len;
-		const char *buffer = lua_tolstring(state, 1, &len);
-		status = luaL_loadbuffer(state, buffer, len, "=stdin");
-
-		if (incomplete(state, status))
-		{
-			logError(record);
-			recGblSetSevr(record, CALC_ALARM, INVALID_ALARM);
-			pvt->luaError = 1;
-			return;
-		}
-		else if (status != LUA_OK)
-		{
-			logError(record);
-			lua_pop(state, 1);
-			recGblSetSevr(record, CALC_ALARM, INVALID_ALARM);
-			pvt->luaError = 1;
-			return;
-		}
+		logError(record);
+		recGblSetSevr(record, CALC_ALARM, INVALID_ALARM);
+		pvt->luaError = 1;
+		return;
 	}
 
-	lua_remove(state, 1);
-	status = lua_pcall(state, 0, 1, 0);
+	lua_rawgeti(state, LUA_REGISTRYINDEX, pvt->callRef);
+	int status = luaBudgetCall(state, 0, 1, 0, record->ilim);
 
 	if (status)
 	{
@@ -1093,6 +1391,11 @@ static void handleResults(luascriptRecord* record)
 	if (top > 0)
 	{
 		int rettype = lua_type(state, -1);
+		lua_array* array = (rettype == LUA_TUSERDATA) ? luaTestArray(state, -1) : NULL;
+
+		/* An epics.array result is handled like a table */
+		if (array)    { rettype = LUA_TTABLE; }
+
 		pvt->luaReturnType = rettype;
 
 		if (rettype == LUA_TBOOLEAN || rettype == LUA_TNUMBER)
@@ -1111,18 +1414,17 @@ static void handleResults(luascriptRecord* record)
 		}
 		else if (rettype == LUA_TTABLE)
 		{
-			if (record->pavl != NULL)
-			{
-				if (record->patp == luascriptAVALType_Integer)       { delete [] ((int*) record->pavl); }
-				else if (record->patp == luascriptAVALType_Double)   { delete [] ((double*) record->pavl); }
-				else if (record->patp == luascriptAVALType_Char)     { delete [] ((char*) record->pavl); }
-			}
+			/* The current AVAL storage becomes PAVL, the old PAVL storage is reused */
+			ArrayBuffer previous = pvt->pavlBuffer;
+			pvt->pavlBuffer = pvt->avalBuffer;
+			pvt->avalBuffer = previous;
 
 			record->pavl = record->aval;
 			record->pasz = record->asiz;
 			record->patp = record->atyp;
 
-			record->aval = convertTable(state, &record->asiz, &record->atyp);
+			if (array)    { record->aval = convertArray(array, &pvt->avalBuffer, &record->asiz, &record->atyp); }
+			else          { record->aval = convertTable(state, &pvt->avalBuffer, &record->asiz, &record->atyp); }
 			record->udf = FALSE;
 		}
 
@@ -1184,6 +1486,73 @@ static void execOutput(luascriptRecord* record)
 	}
 }
 
+/* Seconds since an arbitrary start, for timing intervals */
+static double nowSeconds(void)
+{
+#ifdef HAS_MONOTONIC_TIME
+	return epicsMonotonicGet() * 1e-9;
+#else
+	epicsTimeStamp now;
+	epicsTimeGetCurrent(&now);
+	return now.secPastEpoch + now.nsec * 1e-9;
+#endif
+}
+
+/*
+ * runLua -- executeLua and handleResults, timed for ETIM.
+ */
+static void runLua(luascriptRecord* record)
+{
+	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
+
+	double start = nowSeconds();
+
+	executeLua(record);
+	handleResults(record);
+
+	pvt->execSeconds = nowSeconds() - start;
+}
+
+/*
+ * updateTimes -- copy the last run's times, in milliseconds, into the
+ * timing fields and post them. Called from process, under the record
+ * lock, since async runs measure on the callback thread.
+ */
+static void updateTimes(luascriptRecord* record)
+{
+	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
+
+	double elapsed = pvt->execSeconds * 1000.0;
+
+	record->etim = elapsed;
+	db_post_events(record, &record->etim, DBE_VALUE | DBE_LOG);
+
+	if (pvt->timedRuns == 0 || elapsed < record->emin)
+	{
+		record->emin = elapsed;
+		db_post_events(record, &record->emin, DBE_VALUE | DBE_LOG);
+	}
+
+	if (pvt->timedRuns == 0 || elapsed > record->emax)
+	{
+		record->emax = elapsed;
+		db_post_events(record, &record->emax, DBE_VALUE | DBE_LOG);
+	}
+
+	if (pvt->timedRuns == 0)    { record->eavg = elapsed; }
+	else                        { record->eavg += EAVG_WEIGHT * (elapsed - record->eavg); }
+
+	db_post_events(record, &record->eavg, DBE_VALUE | DBE_LOG);
+
+	if (record->sync == luascriptSYNC_Asynchronous)
+	{
+		record->qlat = pvt->queueSeconds * 1000.0;
+		db_post_events(record, &record->qlat, DBE_VALUE | DBE_LOG);
+	}
+
+	pvt->timedRuns++;
+}
+
 /*
  * luaExecCallback -- EPICS callback function for async Lua execution.
  * Runs the Lua code under the Lua mutex, then calls dbProcess to
@@ -1196,10 +1565,11 @@ static void luaExecCallback(CALLBACK* cb)
 	luascriptRecord* record = (luascriptRecord*) vrecord;
 	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
 
+	pvt->queueSeconds = nowSeconds() - pvt->queuedAt;
+
 	epicsGuard<epicsMutex> guard(*pvt->luaStateMutex);
 
-	executeLua(record);
-	handleResults(record);
+	runLua(record);
 
 	pvt->luaCompleted = 1;
 
@@ -1250,6 +1620,9 @@ static long process(dbCommon* common)
 			compilePcal(record);
 		}
 
+		/* No state if there wasn't enough memory to create one */
+		if (! record->state)    { record->pact = FALSE; return -1; }
+
 		long status = loadNumbers(record);
 
 		if (status)    { record->pact = FALSE; return status; }
@@ -1282,7 +1655,7 @@ static long process(dbCommon* common)
 
 			/* Push and call the compiled PCAL chunk */
 			lua_rawgeti(state, LUA_REGISTRYINDEX, pvt->pcalRef);
-			int pcal_status = lua_pcall(state, 0, 1, 0);
+			int pcal_status = luaBudgetCall(state, 0, 1, 0, record->ilim);
 
 			if (pcal_status != LUA_OK)
 			{
@@ -1314,17 +1687,18 @@ static long process(dbCommon* common)
 		{
 			/* Queue Lua execution to the callback thread */
 			callbackSetPriority(record->prio, &pvt->luaExecCb);
+			pvt->queuedAt = nowSeconds();
 			callbackRequest(&pvt->luaExecCb);
 			return 0;
 		}
 
 		/* Synchronous: execute Lua inline */
-		executeLua(record);
-		handleResults(record);
+		runLua(record);
 	}
 
 	/* ---- PASS 2 (async) or continuation (sync): finish processing ---- */
 
+	updateTimes(record);
 	recGblGetTimeStamp(record);
 	checkAlarms(record);
 	execOutput(record);
@@ -1357,7 +1731,7 @@ static long special(dbAddr* paddr, int after)
 	{
 		epicsGuard<epicsMutex> guard(*pvt->luaStateMutex);
 		initState(record);
-		compilePcal(record);
+		if (record->state)    { compilePcal(record); }
 	}
 	else if (field_index == luascriptRecordPCAL)
 	{
@@ -1369,9 +1743,15 @@ static long special(dbAddr* paddr, int after)
 		epicsGuard<epicsMutex> guard(*pvt->luaStateMutex);
 		memset(record->pcode, 0, 121);
 		initState(record);
-		compilePcal(record);
+		if (record->state)    { compilePcal(record); }
 		record->frld = 0;
 	}
+	else if (field_index == luascriptRecordERST && record->erst)
+	{
+		/* The next run starts EMIN, EMAX, and EAVG over */
+		pvt->timedRuns = 0;
+		record->erst = 0;
+	}
 	else if (isLink(field_index))
 	{
 		int offset = field_index - luascriptRecordINPA;
@@ -1384,10 +1764,14 @@ static long special(dbAddr* paddr, int after)
 		dbAddr address;
 		dbAddr* paddress = &address;
 
-		rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
-
 		if (field_index == luascriptRecordOUT)    { pvt->outlink_field_type = DBF_NOACCESS; }
 
+		/* Look the link up again on the next process */
+		if (offset >= NUM_ARGS && offset < NUM_ARGS + STR_ARGS)
+		{
+			pvt->strInputs[offset - NUM_ARGS].resolved = false;
+		}
+
 		if (field->type == CONSTANT)
 		{
 			if (field_index <= luascriptRecordINPJ)
@@ -1612,6 +1996,16 @@ static void monitor(luascriptRecord* record)
 	if (strcmp(record->sval, record->psvl))
 		db_post_events(record, &record->sval, DBE_VALUE | DBE_LOG);
 
+	/* Array buffer capacity */
+	rpvtStruct* pvt = (rpvtStruct*) record->rpvt;
+	epicsUInt32 capacity = (epicsUInt32) (pvt->avalBuffer.capacity + pvt->pavlBuffer.capacity + pvt->inputBuffer.capacity);
+
+	if (record->acap != capacity)
+	{
+		record->acap = capacity;
+		db_post_events(record, &record->acap, DBE_VALUE | DBE_LOG);
+	}
+
 	/* AVAL changes */
 	if (record->aval && record->pavl &&
 	    (record->asiz != record->pasz || memcmp(record->aval, record->pavl, record->asiz)))
@@ -689,6 +689,10 @@ static int luashBegin(const char* pathname, const char* macros, lua_State* state
 	else
 	{
 		shell_state = luaCreateState();
+
+		if (! shell_state)    { return -1; }
+
+		luaSetStateOwner(shell_state, "luash");
 		initState(shell_state);
 	}
 
@@ -735,6 +739,8 @@ epicsShareFunc int epicsShareAPI luaCmd(lua_State* state, const char* command, c
 	if (state)    { used_environ = state; }
 	else          { used_environ = luaCreateState(); }
 
+	if (! used_environ)    { return -1; }
+
 	luaL_getmetatable(used_environ, "iocsh_meta");
 	luaPushScope(used_environ);
 
@@ -790,6 +796,10 @@ epicsShareFunc int epicsShareAPI luaSpawn(const char* filename, const char* macr
 {
 	lua_State* state = luaCreateState();
 
+	if (! state)    { return -1; }
+
+	luaSetStateOwner(state, (std::string("luaSpawn ") + filename).c_str());
+
 	if (macros)    { luaLoadMacros(state, macros); }
 
 	std::string temp(filename);
@@ -838,6 +848,10 @@ epicsShareFunc int epicsShareAPI luaLoadFile(const char* filename, const char* m
 
 	lua_State* state = luaCreateState();
 
+	if (! state)    { return -1; }
+
+	luaSetStateOwner(state, (std::string("luaLoadFile ") + filename).c_str());
+
 	if (macros)    { luaLoadMacros(state, macros); }
 
 	std::string temp(filename);
@@ -903,6 +917,81 @@ static void addModuleCallFunc(const iocshArgBuf* args)
 	luaAddModule(args[0].sval);
 }
 
+static const iocshFuncDef iocshStatsFuncDef = {"luaIocshStats", 0, NULL};
+
+static void iocshStatsCallFunc(const iocshArgBuf* args)
+{
+	unsigned long lookups, env_hits, command_hits;
+	double seconds;
+
+	luaIocshLookupStats(&lookups, &env_hits, &command_hits, &seconds);
+
+	printf("iocsh library name lookups: %lu (%lu environment, %lu commands, %lu unknown)\n",
+	       lookups, env_hits, command_hits, lookups - env_hits - command_hits);
+	printf("Time spent resolving names: %.3f ms\n", seconds * 1000.0);
+}
+
+static const iocshFuncDef cacheReportFuncDef = {"luaCacheReport", 0, NULL};
+
+static void cacheReportCallFunc(const iocshArgBuf* args)
+{
+	unsigned long entries, hits, misses, bytes;
+
+	luaLocateFileStats(&entries, &hits, &misses);
+	printf("Script locations: %lu cached, %lu hits, %lu misses\n", entries, hits, misses);
+
+	luaBytecodeCacheStats(&entries, &bytes);
+	printf("Compiled scripts: %lu cached, %lu bytes\n", entries, bytes);
+}
+
+static const iocshFuncDef memoryReportFuncDef = {"luaMemoryReport", 0, NULL};
+
+static void memoryReportCallFunc(const iocshArgBuf* args)
+{
+	luaMemoryReport();
+}
+
+static const iocshFuncDef stateReportFuncDef = {"luaStateReport", 0, NULL};
+
+static void stateReportCallFunc(const iocshArgBuf* args)
+{
+	luaStateReport();
+}
+
+static const iocshArg profileStartArg0 = { "instructions per sample", iocshArgInt};
+static const iocshArg *profileStartArgs[1] = {&profileStartArg0};
+static const iocshFuncDef profileStartFuncDef = {"luaProfileStart", 1, profileStartArgs};
+
+static void profileStartCallFunc(const iocshArgBuf* args)
+{
+	luaProfileStart(args[0].ival);
+}
+
+static const iocshFuncDef profileStopFuncDef = {"luaProfileStop", 0, NULL};
+
+static void profileStopCallFunc(const iocshArgBuf* args)
+{
+	luaProfileStop();
+}
+
+static const iocshArg profileDumpArg0 = { "filename", iocshArgString};
+static const iocshArg *profileDumpArgs[1] = {&profileDumpArg0};
+static const iocshFuncDef profileDumpFuncDef = {"luaProfileDump", 1, profileDumpArgs};
+
+static void profileDumpCallFunc(const iocshArgBuf* args)
+{
+	luaProfileDump(args[0].sval);
+}
+
+static const iocshArg profileReportArg0 = { "count", iocshArgInt};
+static const iocshArg *profileReportArgs[1] = {&profileReportArg0};
+static const iocshFuncDef profileReportFuncDef = {"luaProfileReport", 1, profileReportArgs};
+
+static void profileReportCallFunc(const iocshArgBuf* args)
+{
+	luaProfileReport(args[0].ival);
+}
+
 static void luashRegister(void)
 {
 	ensureShellStateId();
@@ -912,6 +1001,14 @@ static void luashRegister(void)
 	iocshRegister(&loadFileFuncDef, loadFileCallFunc);
 	iocshRegister(&addPathFuncDef, addPathCallFunc);
 	iocshRegister(&addModuleFuncDef, addModuleCallFunc);
+	iocshRegister(&iocshStatsFuncDef, iocshStatsCallFunc);
+	iocshRegister(&cacheReportFuncDef, cacheReportCallFunc);
+	iocshRegister(&memoryReportFuncDef, memoryReportCallFunc);
+	iocshRegister(&stateReportFuncDef, stateReportCallFunc);
+	iocshRegister(&profileStartFuncDef, profileStartCallFunc);
+	iocshRegister(&profileStopFuncDef, profileStopCallFunc);
+	iocshRegister(&profileDumpFuncDef, profileDumpCallFunc);
+	iocshRegister(&profileReportFuncDef, profileReportCallFunc);
 }
 
 epicsExportRegistrar(luashRegister);
@@ -16,6 +16,12 @@
 #include <errlog.h>
 #include <envDefs.h>
 #include <alarm.h>
+#include <epicsVersion.h>
+#include <iocsh.h>
+#include <initHooks.h>
+#include <epicsThread.h>
+
+#include "luaEpics.h"
 
 extern "C" {
     void luaTest_registerRecordDeviceDriver(struct dbBase *);
@@ -158,6 +164,125 @@ static void testReadErrorSetsAlarm(void)
     testdbGetFieldEqual("test:ai_err.STAT", DBF_SHORT, (int) READ_ALARM);
 }
 
+static void testSharedState(void)
+{
+    testDiag("===== DTYP lua: records share one state per file and port =====");
+
+    processRecord("test:shared1");
+    processRecord("test:shared2");
+    testdbGetFieldEqual("test:shared1.VAL", DBF_LONG, 1);
+    testdbGetFieldEqual("test:shared2.VAL", DBF_LONG, 2);
+
+    /* A different port gets its own state */
+    processRecord("test:shared_port");
+    testdbGetFieldEqual("test:shared_port.VAL", DBF_LONG, 1);
+}
+
+/*
+ * Requests a scan of the test_trigger list after the scan lists exist
+ * but before interruptAccept, when scanIoRequest queues nothing. This must not
+ * stop later requests on the list from processing its records.
+ */
+static int earlyScanStatus = -1;
+
+static void earlyScanHook(initHookState state)
+{
+    if (state != initHookAfterScanInit)    { return; }
+
+    lua_State* L = luaCreateState();
+    earlyScanStatus = luaL_dostring(L, "require('epics').scan('test_trigger')");
+    lua_close(L);
+}
+
+static void testIoIntrScan(void)
+{
+    testDiag("===== DTYP lua: epics.scan triggers I/O Intr records =====");
+
+    testOk(earlyScanStatus == 0, "epics.scan before interruptAccept ran");
+
+    long value = 0;
+    int i;
+
+    /* The bo's write function calls epics.scan("test_trigger") */
+    testdbPutFieldOk("test:scan_trigger.VAL", DBF_LONG, 1);
+
+    /* I/O Intr processing happens on a callback thread */
+    for (i = 0; i < 50 && value == 0; i++)
+    {
+        epicsThreadSleep(0.1);
+        DBADDR addr;
+        long n = 1;
+        if (dbNameToAddr("test:scan_intr.VAL", &addr) == 0)
+        {
+            dbGetField(&addr, DBR_LONG, &value, NULL, &n, NULL);
+        }
+    }
+
+    testOk(value == 7, "I/O Intr record processed after epics.scan (VAL=%ld)", value);
+}
+
+static void testAsync(void)
+{
+    testDiag("===== DTYP lua: lua:async records complete on a worker =====");
+
+    DBADDR addr;
+    double value = 0.0;
+    int i;
+
+    processRecord("test:ai_async");
+
+    /* Pass 1 only queues the call */
+    testdbGetFieldEqual("test:ai_async.PACT", DBF_UCHAR, 1);
+
+    for (i = 0; i < 50 && value != 3.5; i++)
+    {
+        epicsThreadSleep(0.1);
+        long n = 1;
+        if (dbNameToAddr("test:ai_async.VAL", &addr) == 0)
+        {
+            dbGetField(&addr, DBR_DOUBLE, &value, NULL, &n, NULL);
+        }
+    }
+
+    testOk(value == 3.5, "async ai completed (VAL=%g)", value);
+    testdbGetFieldEqual("test:ai_async.PACT", DBF_UCHAR, 0);
+    testdbGetFieldEqual("test:ai_async.SEVR", DBF_SHORT, 0);
+}
+
+static void testArrays(void)
+{
+    testDiag("===== DTYP lua: waveform, aai, aao and int64in =====");
+
+    processRecord("test:waveform");
+    testdbGetFieldEqual("test:waveform.NORD", DBF_LONG, 3);
+    testdbGetFieldEqual("test:waveform.UDF", DBF_SHORT, 0);
+
+    const epicsFloat64 expected[] = {1.0, 2.0, 3.0};
+    testdbGetArrFieldEqual("test:waveform.VAL", DBF_DOUBLE, 3, 3, expected);
+
+    processRecord("test:waveform_str");
+    testdbGetFieldEqual("test:waveform_str.NORD", DBF_LONG, 10);
+
+    /* Longer tables are truncated to NELM */
+    processRecord("test:aai");
+    testdbGetFieldEqual("test:aai.NORD", DBF_LONG, 2);
+
+    /* aao hands NORD elements of BPTR to the write function */
+    const epicsFloat64 written[] = {1.5, 2.5, 4.0};
+    testdbPutArrFieldOk("test:aao.VAL", DBF_DOUBLE, 3, written);
+
+    processRecord("test:aao_count");
+    testdbGetFieldEqual("test:aao_count.VAL", DBF_LONG, 3);
+
+    processRecord("test:aao_sum");
+    testdbGetFieldEqual("test:aao_sum.VAL", DBF_DOUBLE, 8.0);
+
+#if EPICS_VERSION_INT >= VERSION_INT(3, 16, 1, 0)
+    processRecord("test:int64in");
+    testdbGetFieldEqual("test:int64in.VAL", DBF_INT64, (epicsInt64) 1 << 40);
+#endif
+}
+
 MAIN(luaDtypTest)
 {
     testPlan(0);
@@ -167,8 +292,15 @@ MAIN(luaDtypTest)
     testdbReadDatabase("luaTest.dbd", NULL, NULL);
     luaTest_registerRecordDeviceDriver(pdbbase);
 
+    iocshCmd("var luaDeviceSharedStates 1");
+
     epicsEnvSet("LUA_SCRIPT_PATH", "..");
     testdbReadDatabase("luaDtypTest.db", "..", "P=test:");
+#if EPICS_VERSION_INT >= VERSION_INT(3, 16, 1, 0)
+    testdbReadDatabase("luaDtypInt64Test.db", "..", "P=test:");
+#endif
+
+    initHookRegister(earlyScanHook);
 
     eltc(0);
     testIocInitOk();
@@ -188,6 +320,10 @@ MAIN(luaDtypTest)
     testStringout();
     testUdfClearedOnRead();
     testReadErrorSetsAlarm();
+    testSharedState();
+    testIoIntrScan();
+    testAsync();
+    testArrays();
 
     testIocShutdownOk();
     testdbCleanup();
@@ -27,3 +27,45 @@ end
 function read_error(record)
     error("intentional test error")
 end
+
+call_count = 0
+
+function next_count(record)
+    call_count = call_count + 1
+    return call_count
+end
+
+function trigger_scan(record)
+    local epics = require("epics")
+    epics.scan("test_trigger")
+end
+
+function slow_double(record, val)
+    local osi = require("osi")
+    osi.sleep(0.2)
+    return val
+end
+
+function read_array(record)
+    return {1, 2, 3}
+end
+
+last_count = 0
+last_sum = 0
+
+function write_array(record, values)
+    last_count = #values
+    last_sum = values:sum()
+end
+
+function read_last_count(record)
+    return last_count
+end
+
+function read_last_sum(record)
+    return last_sum
+end
+
+function read_int64(record)
+    return 1 << 40
+end
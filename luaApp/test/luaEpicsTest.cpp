@@ -7,6 +7,7 @@
  */
 
 #include <string.h>
+#include <string>
 
 #include <dbUnitTest.h>
 #include <epicsUnitTest.h>
@@ -14,6 +15,8 @@
 
 #include <dbAccess.h>
 #include <errlog.h>
+#include <iocsh.h>
+#include <epicsThread.h>
 
 #include "luaEpics.h"
 
@@ -140,6 +143,50 @@ static void testGetLocalWaveform(void)
 	lua_close(L);
 }
 
+static void testArrayGetPut(void)
+{
+	testDiag("===== epics library: epics.array get/put =====");
+
+	lua_State* L = luaCreateState();
+	
+	doLua(L, "epics = require('epics')");
+	doLua(L, "data = epics.get('etest:test_dwf', {array=true})");
+	
+	doLua(L, "result = tostring(data)");
+	lua_getglobal(L, "result");
+	testOk(strcmp(lua_tostring(L, -1), "epics.array(float64, 5)") == 0,
+	       "array=true reads a float64 array, got %s", lua_tostring(L, -1));
+	lua_pop(L, 1);
+	
+	doLua(L, "lo, lo_at = data:min(); hi, hi_at = data:max()");
+	doLua(L, "result = data:sum() == 15 and data:mean() == 3 and lo == 1 and lo_at == 1 and hi == 5 and hi_at == 5");
+	lua_getglobal(L, "result");
+	testOk(lua_toboolean(L, -1), "Array reductions match the waveform");
+	lua_pop(L, 1);
+	
+	doLua(L, "for i = 1, #data do data[i] = data[i] * 2 end");
+	int status = doLua(L, "assert(epics.put('etest:test_dwf', data) == nil)");
+	testOk(status == 0, "epics.put accepts an array");
+	
+	doLua(L, "ints = epics.array('int32', 2)");
+	doLua(L, "filled = epics.get('etest:test_dwf', {array=ints})");
+	doLua(L, "result = rawequal(filled, ints) and #ints == 5 and ints[5] == 10 and math.type(ints[5]) == 'integer'");
+	lua_getglobal(L, "result");
+	testOk(lua_toboolean(L, -1), "array=existing fills and resizes the given array");
+	lua_pop(L, 1);
+	
+	doLua(L, "part = ints:slice(2, 3)");
+	doLua(L, "result = #part == 2 and part[1] == 4 and part[2] == 6 and part[3] == nil");
+	lua_getglobal(L, "result");
+	testOk(lua_toboolean(L, -1), "slice copies the requested range");
+	lua_pop(L, 1);
+	
+	status = doLua(L, "ints[6] = 1");
+	testOk(status != 0, "Writing past the end of an array raises an error");
+	
+	lua_close(L);
+}
+
 
 /* ---- PV object tests ---- */
 
@@ -229,6 +276,38 @@ static void testPvTostring(void)
 	lua_close(L);
 }
 
+static void testPvRepeatedFieldAccess(void)
+{
+	testDiag("===== epics library: pv repeated field access =====");
+
+	lua_State* L = luaCreateState();
+	
+	doLua(L, "epics = require('epics')");
+	doLua(L, "pv = epics.pv('etest:test_ao')");
+	doLua(L, "pv.VAL = 1.5");
+	doLua(L, "first = pv.VAL");
+	doLua(L, "pv.VAL = 2.5");
+	doLua(L, "second = pv:get('VAL')");
+	
+	/* Touch more fields than the object caches to cycle its entries */
+	doLua(L, "for _, f in ipairs({'DESC','EGU','PREC','HOPR','LOPR','DRVH','DRVL','SCAN','PINI'}) do local x = pv[f] end");
+	doLua(L, "third = pv.VAL");
+	
+	lua_getglobal(L, "first");
+	testOk(lua_tonumber(L, -1) == 1.5, "first read is 1.5, got %g", lua_tonumber(L, -1));
+	lua_pop(L, 1);
+	
+	lua_getglobal(L, "second");
+	testOk(lua_tonumber(L, -1) == 2.5, "second read is 2.5, got %g", lua_tonumber(L, -1));
+	lua_pop(L, 1);
+	
+	lua_getglobal(L, "third");
+	testOk(lua_tonumber(L, -1) == 2.5, "read after cache cycling is 2.5, got %g", lua_tonumber(L, -1));
+	lua_pop(L, 1);
+	
+	lua_close(L);
+}
+
 
 /* ---- Return convention tests ---- */
 
@@ -285,6 +364,189 @@ static void testGetReturnsNilOnError(void)
 }
 
 
+/* ---- Channel Access tests ---- */
+
+/*
+ * dbNameToAddr doesn't understand channel filters, so a filtered name
+ * skips the local fast path and goes through Channel Access, where the
+ * IOC's own database service answers it without a CA server.
+ */
+#define CA_LONG   "etest:test_li.VAL{\"ts\":{}}"
+#define CA_DOUBLE "etest:test_ai.VAL{\"ts\":{}}"
+
+/* Number of entries in the table returned by epics.channels() */
+static int countChannels(lua_State* L)
+{
+	doLua(L, "count = 0; for _ in pairs(epics.channels()) do count = count + 1 end");
+	lua_getglobal(L, "count");
+	int count = (int) lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	return count;
+}
+
+static void testCaChannelCache(void)
+{
+	testDiag("===== epics library: CA channel cache =====");
+
+	lua_State* L = luaCreateState();
+
+	doLua(L, "epics = require('epics')");
+
+	/* Repeat gets reuse the one cached channel */
+	doLua(L, "first = epics.get('" CA_LONG "', 5.0)");
+	doLua(L, "second = epics.get('" CA_LONG "', 5.0)");
+	doLua(L, "result = first == 100 and second == 100");
+	lua_getglobal(L, "result");
+	testOk(lua_toboolean(L, -1), "Repeat CA gets return the value");
+	lua_pop(L, 1);
+
+	testOk(countChannels(L) == 1, "One channel cached for repeat gets");
+
+	doLua(L, "result = epics.channels()['" CA_LONG "']");
+	lua_getglobal(L, "result");
+	testOk(lua_toboolean(L, -1), "Cached channel is connected");
+	lua_pop(L, 1);
+
+	/* Channels idle for longer than the timeout are swept on the next access */
+	iocshCmd("var luaCaChannelIdleTimeout 1");
+	epicsThreadSleep(2.5);
+
+	doLua(L, "result = epics.get('" CA_DOUBLE "', 5.0)");
+	lua_getglobal(L, "result");
+	testOk(lua_tonumber(L, -1) == 42.5, "CA get of a second PV, got %g", lua_tonumber(L, -1));
+	lua_pop(L, 1);
+
+	doLua(L, "result = epics.channels()['" CA_LONG "'] == nil and epics.channels()['" CA_DOUBLE "'] ~= nil");
+	lua_getglobal(L, "result");
+	testOk(lua_toboolean(L, -1), "Idle channel was swept, the new one is cached");
+	lua_pop(L, 1);
+
+	testOk(countChannels(L) == 1, "One channel left in the cache");
+
+	iocshCmd("var luaCaChannelIdleTimeout 60");
+
+	lua_close(L);
+}
+
+static void testCaSharedContext(void)
+{
+	testDiag("===== epics library: CA context shared between states =====");
+
+	lua_State* first = luaCreateState();
+	lua_State* second = luaCreateState();
+
+	doLua(first, "epics = require('epics')");
+	doLua(second, "epics = require('epics')");
+
+	doLua(first, "result = epics.get('" CA_LONG "', 5.0)");
+	lua_getglobal(first, "result");
+	testOk(lua_tointeger(first, -1) == 100, "First state reads over CA, got %s", lua_tostring(first, -1));
+	lua_pop(first, 1);
+
+	doLua(second, "result = epics.get('" CA_LONG "', 5.0)");
+	lua_getglobal(second, "result");
+	testOk(lua_tointeger(second, -1) == 100, "Second state reads over CA, got %s", lua_tostring(second, -1));
+	lua_pop(second, 1);
+
+	/* The second state's cached channel must survive the first state */
+	lua_close(first);
+
+	doLua(second, "result = epics.get('" CA_LONG "', 5.0)");
+	lua_getglobal(second, "result");
+	testOk(lua_tointeger(second, -1) == 100, "Second state reads after the first closed, got %s", lua_tostring(second, -1));
+	lua_pop(second, 1);
+
+	lua_close(second);
+
+	/* A new state after the last one closed gets a new context */
+	lua_State* third = luaCreateState();
+
+	doLua(third, "epics = require('epics')");
+	doLua(third, "result = epics.get('" CA_LONG "', 5.0)");
+	lua_getglobal(third, "result");
+	testOk(lua_tointeger(third, -1) == 100, "New state reads after all others closed, got %s", lua_tostring(third, -1));
+	lua_pop(third, 1);
+
+	lua_close(third);
+}
+
+
+/* Polls until the Lua expression is true or the timeout expires */
+static int waitFor(lua_State* L, const char* expression, double timeout)
+{
+	std::string code = std::string("result = ") + expression;
+
+	for (double waited = 0.0; waited < timeout; waited += 0.05)
+	{
+		doLua(L, code.c_str());
+		lua_getglobal(L, "result");
+		int done = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+
+		if (done)    { return 1; }
+
+		epicsThreadSleep(0.05);
+	}
+
+	return 0;
+}
+
+static void testMonitorPoll(void)
+{
+	testDiag("===== epics library: monitor and poll =====");
+
+	lua_State* L = luaCreateState();
+
+	doLua(L, "epics = require('epics')");
+	doLua(L, "values = {}");
+	int status = doLua(L, "mon = epics.monitor('etest:test_ao', function(value) values[#values + 1] = value end)");
+	testOk(status == 0, "epics.monitor succeeds");
+
+	/* The first update arrives when the channel connects */
+	doLua(L, "epics.poll(5.0)");
+	testOk(waitFor(L, "mon.connected and #values == 1", 5.0), "Monitor connected and delivered the initial value");
+
+	testdbPutFieldOk("etest:test_ao", DBF_DOUBLE, 7.25);
+	doLua(L, "epics.poll(5.0)");
+	testOk(waitFor(L, "values[#values] == 7.25", 5.0), "Update delivered by epics.poll");
+
+	/* Nothing runs until the state polls */
+	testdbPutFieldOk("etest:test_ao", DBF_DOUBLE, 8.5);
+	testOk(waitFor(L, "mon.pending == 1", 5.0), "Update waits in the queue");
+	testOk(waitFor(L, "values[#values] == 7.25", 0.1), "Callback not run before epics.poll");
+
+	doLua(L, "ran = epics.poll()");
+	testOk(waitFor(L, "ran == 1 and values[#values] == 8.5 and mon.pending == 0", 0.1), "epics.poll ran the queued callback");
+
+	doLua(L, "mon:cancel()");
+	testOk(waitFor(L, "not mon.connected", 0.1), "Cancelled monitor is not connected");
+
+	lua_close(L);
+}
+
+static void testMonitorOverflow(void)
+{
+	testDiag("===== epics library: monitor queue overflow =====");
+
+	lua_State* L = luaCreateState();
+
+	doLua(L, "epics = require('epics')");
+	doLua(L, "mon = epics.monitor('etest:test_ao', function(value) end, {queue = 2})");
+	testOk(waitFor(L, "mon.connected and mon.pending == 1", 5.0), "Initial update queued");
+
+	for (int i = 1; i <= 5; i++)    { testdbPutFieldOk("etest:test_ao", DBF_DOUBLE, 100.0 + i); }
+
+	testOk(waitFor(L, "mon.overflows > 0", 5.0), "Updates beyond max_queue are counted as overflows");
+	testOk(waitFor(L, "mon.pending == 2", 0.1), "Queue holds max_queue updates");
+
+	doLua(L, "ran = epics.poll()");
+	testOk(waitFor(L, "ran == 2 and mon.pending == 0", 0.1), "epics.poll drained the queue");
+
+	lua_close(L);
+}
+
+
 /* ---- info() function tests ---- */
 
 static void testInfoNoArgs(void)
@@ -379,6 +641,7 @@ MAIN(luaEpicsTest)
 	testPutLocalDouble();
 	testPutLocalString();
 	testGetLocalWaveform();
+	testArrayGetPut();
 
 	/* PV object */
 	testPvCreate();
@@ -386,12 +649,19 @@ MAIN(luaEpicsTest)
 	testPvReadField();
 	testPvWriteField();
 	testPvTostring();
+	testPvRepeatedFieldAccess();
 
 	/* Return conventions */
 	testPutReturnsNothing();
 	testPutReturnsErrorString();
 	testGetReturnsNilOnError();
 
+	/* Channel Access */
+	testCaSharedContext();
+	testCaChannelCache();
+	testMonitorPoll();
+	testMonitorOverflow();
+
 	/* info() function */
 	testInfoNoArgs();
 	testInfoNil();
@@ -7,6 +7,8 @@ local drv = asyn.driver.new(PORT, {
     Float64 "READBACK" (0.0),
     Int32   "SETPOINT" (0),
     Float64 "COMPUTED" (3.14159),
+    Int32   "BATCHA" (0),
+    Int32   "BATCHB" (0),
 }, function(self)
     self.scale = 2.0
 end)
@@ -22,3 +24,25 @@ end
 drv.COMPUTED.read = function(self)
     return drv.COMPUTED.value
 end
+
+-- Two-address driver with array parameters
+local epics = require("epics")
+local Float64Array = asyn.Float64Array
+
+local mdrv = asyn.driver.new(PORT .. "M", {
+    Int32        "ADDR"  (0),
+    Float64      "SUM"   (0.0),
+    Float64Array "WAVE",
+}, nil, 2)
+
+mdrv.ADDR.read = function(self, addr)
+    return addr * 10
+end
+
+mdrv.WAVE.read = function(self, addr)
+    return epics.array({1 + addr, 2 + addr, 3 + addr})
+end
+
+mdrv.WAVE.write = function(value, self, addr)
+    self.SUM[addr].value = value:sum()
+end
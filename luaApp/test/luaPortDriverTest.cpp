@@ -6,6 +6,7 @@
  */
 
 #include <string.h>
+#include <string>
 
 #include <dbUnitTest.h>
 #include <epicsUnitTest.h>
@@ -14,14 +15,36 @@
 #include <dbAccess.h>
 #include <errlog.h>
 #include <envDefs.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <asynPortDriver.h>
 
 #include "luaEpics.h"
 #include "luaPortDriver.h"
+#include "luaShell.h"
 
 extern "C" {
     void luaTest_registerRecordDeviceDriver(struct dbBase *);
 }
 
+/* Polls a field until it holds value, for updates made by I/O Intr scans */
+static bool waitForValue(const char* pvname, double value, double timeout)
+{
+    DBADDR addr;
+    epicsFloat64 current;
+
+    if (dbNameToAddr(pvname, &addr))    { return false; }
+
+    for (double waited = 0.0; waited < timeout; waited += 0.01)
+    {
+        if (dbGetField(&addr, DBR_DOUBLE, &current, NULL, NULL, NULL) == 0 && current == value)    { return true; }
+
+        epicsThreadSleep(0.01);
+    }
+
+    return false;
+}
+
 /* --- Old API tests (script-based) --- */
 
 static void testReadInt32(void)
@@ -50,6 +73,117 @@ static void testReadFloat64(void)
     testdbGetFieldEqual("test:float_rb.VAL", DBF_DOUBLE, 3.14159);
 }
 
+/* --- asyn octet transfer tests --- */
+
+/* Octet port that hands back whatever was written to it */
+class LoopbackDriver : public asynPortDriver
+{
+public:
+    LoopbackDriver(const char* portName)
+        : asynPortDriver(portName, 1, asynOctetMask | asynDrvUserMask, 0, 0, 1, 0, 0),
+          lastWrite(0)
+    {
+    }
+
+    /* There are no parameters, so any drvInfo will do */
+    virtual asynStatus drvUserCreate(asynUser* pasynUser, const char* drvInfo, const char** pptypeName, size_t* psize)
+    {
+        return asynSuccess;
+    }
+
+    virtual asynStatus writeOctet(asynUser* pasynUser, const char* value, size_t maxChars, size_t* nActual)
+    {
+        pending.append(value, maxChars);
+        lastWrite = maxChars;
+        *nActual = maxChars;
+
+        return asynSuccess;
+    }
+
+    /* Like a device, a read that fills the buffer ends with ASYN_EOM_CNT */
+    virtual asynStatus readOctet(asynUser* pasynUser, char* value, size_t maxChars, size_t* nActual, int* eomReason)
+    {
+        size_t count = pending.size() < maxChars ? pending.size() : maxChars;
+
+        *nActual = count;
+        if (eomReason)    { *eomReason = (count == maxChars) ? ASYN_EOM_CNT : ASYN_EOM_END; }
+
+        if (! count)    { return asynTimeout; }
+
+        memcpy(value, pending.data(), count);
+        pending.erase(0, count);
+
+        return asynSuccess;
+    }
+
+    virtual asynStatus flushOctet(asynUser* pasynUser)
+    {
+        pending.clear();
+        return asynSuccess;
+    }
+
+    std::string pending;
+    size_t lastWrite;
+};
+
+/* Checks the string at index holds exactly the given bytes */
+static bool isBytes(lua_State* state, int index, const char* expected, size_t len)
+{
+    size_t actual;
+    const char* value = lua_tolstring(state, index, &actual);
+
+    return value && actual == len && memcmp(value, expected, len) == 0;
+}
+
+static void testOctetTransfers(void)
+{
+    testDiag("===== asyn: octet reads and writes =====");
+
+    LoopbackDriver* loop = new LoopbackDriver("LOOP");
+
+    lua_State* state = luaCreateState();
+
+    /* Embedded NULs, both ways */
+    int status = luaL_dostring(state, "asyn = require('asyn'); asyn.write('a\\0b\\0c', 'LOOP'); return asyn.read('LOOP')");
+    testOk(loop->lastWrite == 5, "asyn.write sends the whole string, %d bytes", (int) loop->lastWrite);
+    testOk(status == 0 && isBytes(state, -1, "a\0b\0c", 5), "asyn.read returns embedded NULs");
+    lua_settop(state, 0);
+
+    status = luaL_dostring(state, "return asyn.writeread('x\\0y', 'LOOP')");
+    testOk(loop->lastWrite == 3, "asyn.writeread sends the whole string, %d bytes", (int) loop->lastWrite);
+    testOk(status == 0 && isBytes(state, -1, "x\0y", 3), "asyn.writeread returns embedded NULs");
+    lua_settop(state, 0);
+
+    status = luaL_dostring(state, "client = asyn.client('LOOP'); client:write('\\0\\0\\0'); return client:read()");
+    testOk(loop->lastWrite == 3, "client:write sends the whole string, %d bytes", (int) loop->lastWrite);
+    testOk(status == 0 && isBytes(state, -1, "\0\0\0", 3), "client:read returns embedded NULs");
+    lua_settop(state, 0);
+
+    status = luaL_dostring(state, "return client:writeread('p\\0q')");
+    testOk(status == 0 && isBytes(state, -1, "p\0q", 3), "client:writeread returns embedded NULs");
+    lua_settop(state, 0);
+
+    /* MaxReply cuts a reply short, and the rest comes with the next reads */
+    status = luaL_dostring(state, "client.MaxReply = 4; client:write('0123456789'); return client:read(), client:read(), client:read()");
+    testOk(status == 0 && isBytes(state, 1, "0123", 4), "First read stops at MaxReply");
+    testOk(status == 0 && isBytes(state, 2, "4567", 4), "Second read continues where the first stopped");
+    testOk(status == 0 && isBytes(state, 3, "89", 2), "Third read gets the rest");
+    testOk(loop->pending.empty(), "Nothing is left unread");
+    lua_settop(state, 0);
+
+    /* Longer replies grow the buffer, read by read */
+    status = luaL_dostring(state, "client.MaxReply = 4096; client:write(string.rep('z', 1000)); return client:read()");
+    testOk(status == 0 && lua_rawlen(state, -1) == 1000, "Reply longer than the first buffer is read whole");
+    lua_settop(state, 0);
+
+    /* A reply that exactly fills a new client's first buffer */
+    status = luaL_dostring(state, "fresh = asyn.client('LOOP'); fresh:write(string.rep('q', 256)); return fresh:read()");
+    testOk(status == 0 && lua_rawlen(state, -1) == 256, "Reply filling the buffer exactly is returned");
+    lua_settop(state, 0);
+
+    lua_close(state);
+}
+
 /* --- asyn.client tests --- */
 
 static void testClientApi(void)
@@ -58,10 +192,8 @@ static void testClientApi(void)
 
     /*
      * Test the asyn.client table structure and callable interface.
-     * We can't create actual asynOctetClient objects in unit tests
-     * because they require real asyn communication ports (serial, TCP)
-     * and would block on synchronous connect/disconnect. asynPortDriver
-     * ports don't support the asynOctet synchronous interface.
+     * Reads and writes through clients are covered against a loopback
+     * port by testOctetTransfers.
      */
 
     lua_State* state = luaCreateState();
@@ -126,6 +258,159 @@ static void testNewApiInitState(void)
     testdbGetFieldEqual("new:readback.VAL", DBF_DOUBLE, 10.0);
 }
 
+/* Sets a parameter from a thread that has no batch open */
+static void batchOtherThread(void* arg)
+{
+    lua_State* state = luaCreateState();
+
+    luaL_dostring(state, "require('asyn').driver('NEWPORT').BATCHB.value = 8");
+    lua_close(state);
+
+    epicsEventSignal((epicsEventId) arg);
+}
+
+static double fieldValue(const char* pvname)
+{
+    DBADDR addr;
+    epicsFloat64 value = 0.0;
+
+    if (dbNameToAddr(pvname, &addr) == 0)    { dbGetField(&addr, DBR_DOUBLE, &value, NULL, NULL, NULL); }
+
+    return value;
+}
+
+/*
+ * The batch records forward link to counters, so each step waits for
+ * the count it expects and then checks the value that came with it.
+ * I/O Intr updates are processed in order, so once a later update has
+ * arrived an earlier one can't still be on its way.
+ */
+static void testNewApiBatch(void)
+{
+    testDiag("===== asyn.driver.new: batched parameter updates =====");
+
+    double counta = fieldValue("new:batcha_count.VAL");
+    double countb = fieldValue("new:batchb_count.VAL");
+
+    lua_State* state = luaCreateState();
+
+    int status = luaL_dostring(state, "asyn = require('asyn'); drv = asyn.driver('NEWPORT');"
+        "drv:batch(function() drv.BATCHA.value = 2; drv.BATCHA.value = 3; drv.BATCHB.value = 4 end)");
+    testOk(status == 0, "drv:batch ran");
+    testOk(waitForValue("new:batcha_count.VAL", counta + 1, 5.0), "One update for two sets of BATCHA");
+    testdbGetFieldEqual("new:batcha.VAL", DBF_LONG, 3);
+    testOk(waitForValue("new:batchb_count.VAL", countb + 1, 5.0), "One update for BATCHB");
+    testdbGetFieldEqual("new:batchb.VAL", DBF_LONG, 4);
+
+    /* Nothing is sent until the commit, but other threads' sets go right through */
+    status = luaL_dostring(state, "drv:begin(); drv.BATCHA.value = 5; drv.BATCHA.value = 6");
+    testOk(status == 0, "drv:begin ran");
+
+    epicsEventId done = epicsEventMustCreate(epicsEventEmpty);
+    epicsThreadMustCreate("batchOther", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium), batchOtherThread, done);
+    testOk(epicsEventWaitWithTimeout(done, 5.0) == epicsEventWaitOK, "Other thread set its parameter");
+    epicsEventDestroy(done);
+
+    testOk(waitForValue("new:batchb_count.VAL", countb + 2, 5.0), "Other thread's set is sent during the batch");
+    testdbGetFieldEqual("new:batchb.VAL", DBF_LONG, 8);
+    testdbGetFieldEqual("new:batcha_count.VAL", DBF_DOUBLE, counta + 1);
+    testdbGetFieldEqual("new:batcha.VAL", DBF_LONG, 3);
+
+    status = luaL_dostring(state, "drv:commit()");
+    testOk(status == 0, "drv:commit ran");
+    testOk(waitForValue("new:batcha_count.VAL", counta + 2, 5.0), "One update at the commit");
+    testdbGetFieldEqual("new:batcha.VAL", DBF_LONG, 6);
+
+    /* An error still commits, and later sets are sent right away again */
+    status = luaL_dostring(state, "ok = pcall(drv.batch, drv, function() drv.BATCHA.value = 7; error('stop') end)");
+    lua_getglobal(state, "ok");
+    testOk(status == 0 && !lua_toboolean(state, -1), "error in drv:batch is passed on");
+    lua_pop(state, 1);
+    testOk(waitForValue("new:batcha_count.VAL", counta + 3, 5.0), "Batch ended by an error is committed");
+    testdbGetFieldEqual("new:batcha.VAL", DBF_LONG, 7);
+
+    status = luaL_dostring(state, "drv.BATCHA.value = 8");
+    testOk(waitForValue("new:batcha_count.VAL", counta + 4, 5.0), "Sets outside a batch are sent right away");
+    testdbGetFieldEqual("new:batcha.VAL", DBF_LONG, 8);
+
+    status = luaL_dostring(state, "return pcall(drv.commit, drv)");
+    testOk(status == 0 && !lua_toboolean(state, -1), "drv:commit without drv:begin raises an error");
+    lua_settop(state, 0);
+
+    /* Only the outermost commit sends */
+    status = luaL_dostring(state, "drv:begin(); drv:begin(); drv.BATCHA.value = 9; drv:commit(); drv.BATCHA.value = 10; drv:commit()");
+    testOk(status == 0, "Nested batch ran");
+
+    /* Flush with a last BATCHB update, then every BATCHA update has been counted */
+    status = luaL_dostring(state, "drv.BATCHB.value = 11");
+    testOk(waitForValue("new:batchb_count.VAL", countb + 3, 5.0), "Last BATCHB update arrived");
+    testdbGetFieldEqual("new:batcha_count.VAL", DBF_DOUBLE, counta + 5);
+    testdbGetFieldEqual("new:batcha.VAL", DBF_LONG, 10);
+
+    lua_close(state);
+}
+
+static void testNewApiMultiAddress(void)
+{
+    testDiag("===== asyn.driver.new: addresses and arrays =====");
+
+    /* Read callback is given the record's address */
+    testdbPutFieldOk("new:addr1.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("new:addr1.VAL", DBF_LONG, 10);
+
+    /* epics.array returned by a read callback */
+    epicsFloat64 expected[3] = {2.0, 3.0, 4.0};
+    testdbPutFieldOk("new:wave1.PROC", DBF_LONG, 1);
+    testdbGetArrFieldEqual("new:wave1.VAL", DBF_DOUBLE, 3, 3, expected);
+
+    /* Write callback gets an epics.array and sets a param at address 1 */
+    epicsFloat64 values[3] = {1.5, 2.5, 3.0};
+    testdbPutArrFieldOk("new:waveout1.VAL", DBF_DOUBLE, 3, values);
+    testdbPutFieldOk("new:sum1.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("new:sum1.VAL", DBF_DOUBLE, 7.0);
+
+    /* Each doCallbacks*Array method only takes parameters of its type */
+    lua_State* state = luaCreateState();
+
+    int status = luaL_dostring(state, "drv = require('asyn').driver('NEWPORTM');"
+        "return pcall(drv.doCallbacksFloat64Array, drv, 'WAVE', {4, 5, 6}, 1)");
+    testOk(status == 0 && lua_toboolean(state, -1), "doCallbacksFloat64Array sends a Float64Array parameter");
+    lua_settop(state, 0);
+
+    status = luaL_dostring(state, "return pcall(drv.doCallbacksInt32Array, drv, 'WAVE', {4, 5, 6}, 1)");
+    testOk(status == 0 && !lua_toboolean(state, -1), "doCallbacksInt32Array refuses a Float64Array parameter");
+    lua_settop(state, 0);
+
+    /* writeParam doesn't send anything, callParamCallbacks does for the given address */
+    status = luaL_dostring(state, "drv:writeParam('SUM', 12.5, 1); drv:callParamCallbacks(1)");
+    testOk(status == 0, "callParamCallbacks ran for address 1");
+    testOk(waitForValue("new:sum1_intr.VAL", 12.5, 5.0), "I/O Intr record at address 1 was updated");
+
+    lua_close(state);
+}
+
+static void testNewApiThread(void)
+{
+    testDiag("===== asyn.driver.new: driver with its own thread =====");
+
+    /* The read completes asynchronously on the port thread */
+    testdbPutFieldOk("new:threaded.PROC", DBF_LONG, 1);
+
+    DBADDR addr;
+    epicsFloat64 value = 0.0;
+
+    testOk(dbNameToAddr("new:threaded.VAL", &addr) == 0, "Found new:threaded.VAL");
+
+    for (int tries = 0; tries < 50 && value != 42.5; tries++)
+    {
+        epicsThreadSleep(0.1);
+        dbGetField(&addr, DBR_DOUBLE, &value, NULL, NULL, NULL);
+    }
+
+    testdbGetFieldEqual("new:threaded.VAL", DBF_DOUBLE, 42.5);
+}
+
 MAIN(luaPortDriverTest)
 {
     testPlan(0);
@@ -150,6 +435,27 @@ MAIN(luaPortDriverTest)
         {
             testAbort("Failed to load luaNewDriverTest.lua");
         }
+
+        /*
+         * The threaded driver gets a spawned state of its own, which
+         * must stay open after the script returns.
+         */
+        if (luaSpawn("luaThreadDriverTest.lua", "PORT=NEWPORT"))
+        {
+            testAbort("Failed to spawn luaThreadDriverTest.lua");
+        }
+
+        const char* spawned = "luaSpawn:luaThreadDriverTest.lua(PORT=NEWPORT)";
+
+        for (int tries = 0; tries < 50 && epicsThreadGetId(spawned); tries++)
+        {
+            epicsThreadSleep(0.1);
+        }
+
+        if (epicsThreadGetId(spawned) || ! findAsynPortDriver("NEWPORTT"))
+        {
+            testAbort("luaThreadDriverTest.lua did not create its driver");
+        }
     }
     testdbReadDatabase("luaNewDriverTest.db", "..", "P=new:,PORT=NEWPORT");
 
@@ -166,9 +472,13 @@ MAIN(luaPortDriverTest)
     testNewApiDefaults();
     testNewApiWrite();
     testNewApiInitState();
+    testNewApiBatch();
+    testNewApiMultiAddress();
+    testNewApiThread();
 
     /* asyn.client tests */
     testClientApi();
+    testOctetTransfers();
 
     testIocShutdownOk();
     testdbCleanup();
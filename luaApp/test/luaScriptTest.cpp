@@ -52,6 +52,23 @@ static void testTableReturn(void)
     testdbPutFieldOk("test:tbl.PROC", DBF_LONG, 1);
     /* After processing, ASIZ should be non-zero (array was created) */
     testdbGetFieldEqual("test:tbl.ASIZ", DBF_LONG, (int)(3 * sizeof(int)));
+
+    /* Buffers are reused: capacity doesn't change on later processing */
+    DBADDR addr;
+    epicsUInt32 capacity = 0;
+    long n = 1;
+
+    if (dbNameToAddr("test:tbl.ACAP", &addr) == 0)
+    {
+        dbGetField(&addr, DBR_ULONG, &capacity, NULL, &n, NULL);
+    }
+
+    testOk(capacity > 0, "ACAP is non-zero after a table return (%u)", (unsigned) capacity);
+
+    testdbPutFieldOk("test:tbl.PROC", DBF_LONG, 1);
+    testdbPutFieldOk("test:tbl.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:tbl.ACAP", DBF_ULONG, capacity);
+    testdbGetFieldEqual("test:tbl.ASIZ", DBF_LONG, (int)(3 * sizeof(int)));
 }
 
 static void testErrorHandling(void)
@@ -436,6 +453,142 @@ static void testPcalError(void)
     testdbGetFieldEqual("test:popt_err.VAL", DBF_DOUBLE, 0.0);
 }
 
+/* --- CALL compile cache tests --- */
+
+static void testCallCompiledOnce(void)
+{
+    testDiag("===== luascriptRecord: CALL compiled once =====");
+
+    /* Compilation happens lazily on the first process */
+    testdbGetFieldEqual("test:ccnt.CCNT", DBF_LONG, 0);
+
+    testdbPutFieldOk("test:setA", DBF_DOUBLE, 4.0);
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:ccnt.VAL", DBF_DOUBLE, 8.0);
+    testdbGetFieldEqual("test:ccnt.CCNT", DBF_LONG, 1);
+
+    /* Changing CODE invalidates the cached chunk */
+    testdbPutFieldOk("test:ccnt.CODE", DBF_STRING, "return A * 3");
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:ccnt.VAL", DBF_DOUBLE, 12.0);
+    testdbGetFieldEqual("test:ccnt.CCNT", DBF_LONG, 2);
+}
+
+
+static void testInstructionLimit(void)
+{
+    testDiag("===== luascriptRecord: instruction limit =====");
+
+    testdbPutFieldOk("test:setA", DBF_DOUBLE, 1.0);
+    testdbPutFieldOk("test:ilim.PROC", DBF_LONG, 1);
+
+    testdbGetFieldEqual("test:ilim.SEVR", DBF_SHORT, (int) INVALID_ALARM);
+    testdbGetFieldEqual("test:ilim.STAT", DBF_SHORT, (int) CALC_ALARM);
+
+    DBADDR addr;
+    char err_msg[256] = "";
+
+    if (dbNameToAddr("test:ilim.ERR", &addr) == 0)
+    {
+        long nElements = 1;
+        dbGetField(&addr, DBR_STRING, err_msg, NULL, &nElements, NULL);
+    }
+
+    testOk(strstr(err_msg, "instruction budget of 100000 exceeded") != NULL, "ERR names the budget: '%s'", err_msg);
+
+    /* Same record, within the budget */
+    testdbPutFieldOk("test:setA", DBF_DOUBLE, 0.0);
+    testdbPutFieldOk("test:ilim.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:ilim.VAL", DBF_DOUBLE, 7.0);
+    testdbGetFieldEqual("test:ilim.SEVR", DBF_SHORT, (int) NO_ALARM);
+}
+
+static double getDouble(const char* pv)
+{
+    DBADDR addr;
+    double value = -1.0;
+    long nElements = 1;
+
+    if (dbNameToAddr(pv, &addr) == 0)    { dbGetField(&addr, DBR_DOUBLE, &value, NULL, &nElements, NULL); }
+
+    return value;
+}
+
+static void testExecutionTimes(void)
+{
+    testDiag("===== luascriptRecord: execution times =====");
+
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+
+    double etim = getDouble("test:ccnt.ETIM");
+    double emin = getDouble("test:ccnt.EMIN");
+    double emax = getDouble("test:ccnt.EMAX");
+    double eavg = getDouble("test:ccnt.EAVG");
+
+    testOk(etim >= 0.0 && emin <= etim && etim <= emax, "ETIM %g ms between EMIN %g and EMAX %g", etim, emin, emax);
+    testOk(emin <= eavg && eavg <= emax, "EAVG %g ms between EMIN and EMAX", eavg);
+
+    testdbPutFieldOk("test:ccnt.ERST", DBF_SHORT, 1);
+    testdbPutFieldOk("test:ccnt.PROC", DBF_LONG, 1);
+
+    etim = getDouble("test:ccnt.ETIM");
+    testOk(getDouble("test:ccnt.EMIN") == etim && getDouble("test:ccnt.EMAX") == etim, "ERST starts EMIN and EMAX over");
+
+    testdbPutFieldOk("test:async.PROC", DBF_LONG, 1);
+    epicsThreadSleep(0.5);
+
+    testOk(getDouble("test:async.QLAT") >= 0.0 && getDouble("test:async.ETIM") >= 0.0, "Async record reports QLAT");
+}
+
+
+static void testInputGlobals(void)
+{
+    testDiag("===== luascriptRecord: unchanged inputs =====");
+
+    testdbPutFieldOk("test:setA", DBF_DOUBLE, 1.0);
+    testdbPutFieldOk("test:bind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:bind.VAL", DBF_DOUBLE, 103.0);
+
+    /* Nothing changed, so _A goes back to false */
+    testdbPutFieldOk("test:bind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:bind.VAL", DBF_DOUBLE, 3.0);
+    testdbPutFieldOk("test:bind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:bind.VAL", DBF_DOUBLE, 3.0);
+
+    /* Inputs without a link still pick up values written to the field */
+    testdbPutFieldOk("test:bind.B", DBF_DOUBLE, 5.0);
+    testdbPutFieldOk("test:bind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:bind.VAL", DBF_DOUBLE, 6.0);
+
+    testdbPutFieldOk("test:setA", DBF_DOUBLE, 4.0);
+    testdbPutFieldOk("test:bind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:bind.VAL", DBF_DOUBLE, 109.0);
+
+    testdbPutFieldOk("test:setAA", DBF_STRING, "world");
+    testdbPutFieldOk("test:strbind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:strbind.SVAL", DBF_STRING, "world!");
+    testdbPutFieldOk("test:strbind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:strbind.SVAL", DBF_STRING, "world");
+
+    /* Changing the link looks the new target up */
+    testdbPutFieldOk("test:strbind.INAA", DBF_STRING, "test:setBB");
+    testdbPutFieldOk("test:strbind.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:strbind.SVAL", DBF_STRING, "again!");
+
+    /* Inputs the code never names, and that have no link, aren't set */
+    testdbPutFieldOk("test:unused.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:unused.VAL", DBF_DOUBLE, 101.0);
+
+    /* A script assigning its own inputs gets the field values back each time */
+    testdbPutFieldOk("test:selfassign.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:selfassign.SVAL", DBF_STRING, "ax2");
+    testdbPutFieldOk("test:selfassign.PROC", DBF_LONG, 1);
+    testdbGetFieldEqual("test:selfassign.SVAL", DBF_STRING, "ax2");
+}
 
 MAIN(luaScriptTest)
 {
@@ -520,6 +673,18 @@ MAIN(luaScriptTest)
     testPcalChangedFlag();
     testPcalError();
 
+    /* CALL compile cache */
+    testCallCompiledOnce();
+
+    /* Instruction limit */
+    testInstructionLimit();
+
+    /* Execution timing */
+    testExecutionTimes();
+
+    /* Input globals */
+    testInputGlobals();
+
     testIocShutdownOk();
     testdbCleanup();
 
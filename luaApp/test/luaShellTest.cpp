@@ -7,6 +7,8 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 
 #include <dbUnitTest.h>
 #include <epicsUnitTest.h>
@@ -15,6 +17,7 @@
 #include <dbAccess.h>
 #include <errlog.h>
 #include <iocsh.h>
+#include <envDefs.h>
 
 #include "luaEpics.h"
 #include "luaShell.h"
@@ -79,6 +82,323 @@ static void testLuaCmd(void)
     testOk(status == 0, "luaCmd via iocshCmd returns 0");
 }
 
+static void testIocshLookup(void)
+{
+    testDiag("===== Lua shell: iocsh name lookup =====");
+
+    unsigned long lookups, env_hits, command_hits;
+    unsigned long lookups_after, env_after, command_after;
+
+    epicsEnvSet("LUA_LOOKUP_VAR", "found");
+
+    luaIocshLookupStats(&lookups, &env_hits, &command_hits, NULL);
+
+    iocshCmd("luaCmd \"a = LUA_LOOKUP_VAR; b = dbl; c = not_an_iocsh_command\"");
+
+    luaIocshLookupStats(&lookups_after, &env_after, &command_after, NULL);
+
+    testOk(lookups_after - lookups == 3, "Three names looked up, got %lu", lookups_after - lookups);
+    testOk(env_after - env_hits == 1, "Environment variable resolved");
+    testOk(command_after - command_hits == 1, "iocsh command resolved");
+
+    testOk(iocshCmd("luaIocshStats") == 0, "luaIocshStats runs");
+}
+
+static void testIocshDirectCall(void)
+{
+    testDiag("===== Lua shell: iocsh function calls =====");
+
+    /* Called directly, the number is converted to the string argument */
+    luaCmd("epicsEnvSet('LUA_DIRECT_NUM', 42)", NULL);
+    const char* value = getenv("LUA_DIRECT_NUM");
+    testOk(value && strcmp(value, "42") == 0, "Direct call with a number argument, got '%s'", value ? value : "(null)");
+
+    /* Strings with macros still go through the iocsh parser */
+    epicsEnvSet("LUA_DIRECT_SRC", "expanded");
+    luaCmd("epicsEnvSet('LUA_DIRECT_MACRO', '$(LUA_DIRECT_SRC)')", NULL);
+    value = getenv("LUA_DIRECT_MACRO");
+    testOk(value && strcmp(value, "expanded") == 0, "Macro argument is expanded, got '%s'", value ? value : "(null)");
+}
+
+/* Records what an iocsh Argv argument after a string argument receives */
+static char argvFirst[64];
+static int  argvCount;
+
+static const iocshArg argvTestArg0 = { "name", iocshArgString };
+static const iocshArg argvTestArg1 = { "rest", iocshArgArgv };
+static const iocshArg* argvTestArgs[2] = { &argvTestArg0, &argvTestArg1 };
+static const iocshFuncDef argvTestFuncDef = { "luaArgvTest", 2, argvTestArgs };
+
+static void argvTestCallFunc(const iocshArgBuf* args)
+{
+    strncpy(argvFirst, args[1].aval.av[0] ? args[1].aval.av[0] : "", sizeof(argvFirst) - 1);
+    argvCount = args[1].aval.ac;
+}
+
+static void testIocshDirectArgv(void)
+{
+    testDiag("===== Lua shell: Argv argument after another argument =====");
+
+    iocshRegister(&argvTestFuncDef, argvTestCallFunc);
+
+    /* What iocsh itself passes */
+    iocshCmd("luaArgvTest first a b");
+    char parsed_first[64];
+    strcpy(parsed_first, argvFirst);
+    int parsed_count = argvCount;
+
+    memset(argvFirst, 0, sizeof(argvFirst));
+    argvCount = -1;
+
+    luaCmd("luaArgvTest('first', 'a', 'b')", NULL);
+    testOk(strcmp(argvFirst, parsed_first) == 0, "av[0] matches iocsh, got '%s', expected '%s'", argvFirst, parsed_first);
+    testOk(argvCount == parsed_count, "ac matches iocsh, got %d, expected %d", argvCount, parsed_count);
+}
+
+static void writeScript(const char* path, const char* code)
+{
+    FILE* script = fopen(path, "w");
+
+    if (script)
+    {
+        fputs(code, script);
+        fclose(script);
+    }
+}
+
+static lua_Integer loadCacheValue(const char* path)
+{
+    lua_State* state = luaCreateState();
+    lua_Integer value = -1;
+
+    if (luaLoadScript(state, path) == 0)
+    {
+        lua_getglobal(state, "cache_value");
+        value = lua_tointeger(state, -1);
+        lua_pop(state, 1);
+    }
+
+    lua_close(state);
+    return value;
+}
+
+static void testScriptCache(void)
+{
+    testDiag("===== Lua shell: compiled script cache =====");
+
+    const char* path = "./luaCacheTest.lua";
+
+    writeScript(path, "cache_value = 1\n");
+
+    testOk(loadCacheValue(path) == 1, "Script loads from source");
+    testOk(loadCacheValue(path) == 1, "Script loads from the compiled cache");
+
+    writeScript(path, "cache_value = 22\n");
+
+    testOk(loadCacheValue(path) == 22, "Changed script is compiled again");
+
+    remove(path);
+}
+
+static void testLocateFile(void)
+{
+    testDiag("===== Lua shell: script location cache =====");
+
+    const char* path = "./luaLocateTest.lua";
+    unsigned long hits, misses, before_hits, before_misses;
+
+    writeScript(path, "return 1\n");
+    luaLocateFileStats(NULL, &before_hits, &before_misses);
+
+    testOk(luaLocateFile("luaLocateTest.lua") == path, "Script found in the current directory");
+    testOk(luaLocateFile("luaLocateTest.lua") == path, "Script found again");
+
+    luaLocateFileStats(NULL, &hits, &misses);
+    testOk(hits == before_hits + 1 && misses == before_misses + 1,
+           "Second lookup served from the cache (%lu hits, %lu misses)", hits - before_hits, misses - before_misses);
+
+    luaAddPath("./luaLocateTestDir");
+    luaLocateFile("luaLocateTest.lua");
+
+    luaLocateFileStats(NULL, &hits, &misses);
+    testOk(misses == before_misses + 2, "Adding a search path invalidates the cache");
+
+    remove(path);
+
+    luaLocateFileStats(NULL, &before_hits, &before_misses);
+
+    testOk(luaLocateFile("luaLocateMissing.lua").empty(), "Missing script isn't found");
+    testOk(luaLocateFile("luaLocateMissing.lua").empty(), "Missing script still isn't found");
+
+    luaLocateFileStats(NULL, &hits, &misses);
+    testOk(hits == before_hits + 1 && misses == before_misses + 1, "Missing scripts are cached too");
+
+    /* Only a new search path makes a script created afterwards visible */
+    writeScript("./luaLocateMissing.lua", "return 1\n");
+    testOk(luaLocateFile("luaLocateMissing.lua").empty(), "Cached miss is not re-checked");
+
+    luaAddPath("./luaLocateTestDir2");
+    testOk(luaLocateFile("luaLocateMissing.lua") == "./luaLocateMissing.lua", "Script found after the search path changes");
+
+    remove("./luaLocateMissing.lua");
+}
+
+static void testMemoryLimit(void)
+{
+    testDiag("===== Lua shell: per-state memory accounting =====");
+
+    lua_State* state = luaCreateState();
+    lua_state_stats stats;
+
+    testOk(luaStateStats(state, &stats) == 0 && stats.bytes > 0 && stats.blocks > 0,
+           "State memory is accounted (%lu bytes)", (unsigned long) stats.bytes);
+
+    luaSetMemoryLimit(state, stats.bytes + 64 * 1024);
+
+    int status = luaL_dostring(state, "local t = {} for i = 1, 1000000 do t[i] = i end");
+    testOk(status == LUA_ERRMEM, "Allocation past the limit fails, got '%s'", lua_tostring(state, -1));
+    lua_pop(state, 1);
+
+    luaStateStats(state, &stats);
+    testOk(stats.failures > 0, "Failed allocations are counted");
+
+    luaSetMemoryLimit(state, 0);
+    testOk(luaL_dostring(state, "x = {} for i = 1, 1000 do x[i] = i end") == 0, "State still usable after the limit");
+
+    /* epics.array elements come from the state's allocator too */
+    luaStateStats(state, &stats);
+    size_t before = stats.bytes;
+
+    testOk(luaL_dostring(state, "big = require('epics').array('float64', 100000)") == 0, "Array created");
+    luaStateStats(state, &stats);
+    testOk(stats.bytes >= before + 100000 * sizeof(double), "Array elements are accounted (%lu bytes more)",
+           (unsigned long) (stats.bytes - before));
+
+    luaSetMemoryLimit(state, stats.bytes + 64 * 1024);
+    status = luaL_dostring(state, "big:resize(400000)");
+    testOk(status != 0, "Growing an array past the limit fails");
+    lua_pop(state, 1);
+    luaSetMemoryLimit(state, 0);
+
+    luaStateUnref(state);
+
+    lua_State* plain = luaL_newstate();
+    testOk(luaStateStats(plain, &stats) == -1, "States not made by luaCreateState have no accounting");
+    lua_close(plain);
+
+    /* A default limit below what the libraries need still gives a state */
+    iocshCmd("var luaStateMemoryLimit 1024");
+
+    lua_State* small = luaCreateState();
+    testOk(small != NULL, "State created with a limit smaller than its libraries");
+
+    if (small)
+    {
+        luaStateStats(small, &stats);
+        testOk(stats.limit == 1024, "Default limit applied after setup");
+
+        status = luaL_dostring(small, "local t = {} for i = 1, 1000 do t[i] = i end");
+        testOk(status == LUA_ERRMEM, "Script past the default limit gets a memory error");
+        luaStateUnref(small);
+    }
+
+    iocshCmd("var luaStateMemoryLimit 0");
+}
+
+static void testStateStats(void)
+{
+    testDiag("===== Lua shell: state statistics =====");
+
+    lua_State* state = luaCreateState();
+    lua_state_stats stats;
+
+    luaSetStateOwner(state, "luaShellTest");
+
+    luaL_loadstring(state, "local t = {} for i = 1, 10000 do t[i] = {} end t = nil collectgarbage() collectgarbage()");
+    testOk(luaTimedCall(state, 0, 0, 0) == LUA_OK, "Timed call runs");
+
+    luaStateStats(state, &stats);
+    testOk(stats.calls == 1, "Timed call is counted (%lu)", stats.calls);
+    testOk(stats.gc_cycles > 0, "Collection cycles are counted (%lu)", stats.gc_cycles);
+    testOk((size_t) lua_gc(state, LUA_GCCOUNT) == stats.bytes / 1024, "Accounted bytes match LUA_GCCOUNT");
+
+    luaStateReport();
+
+    luaStateUnref(state);
+}
+
+/* Looks for a folded stack starting with prefix and containing frame */
+static bool foldedContains(const char* path, const char* prefix, const char* frame)
+{
+    char line[256];
+    bool found = false;
+    FILE* folded = fopen(path, "r");
+
+    if (folded)
+    {
+        while (! found && fgets(line, sizeof(line), folded))
+        {
+            found = (strncmp(line, prefix, strlen(prefix)) == 0 && strstr(line, frame));
+        }
+
+        fclose(folded);
+    }
+
+    return found;
+}
+
+static int timedString(lua_State* state, const char* code)
+{
+    if (luaL_loadstring(state, code))    { return -1; }
+
+    return luaTimedCall(state, 0, 0, 0);
+}
+
+static void testProfiler(void)
+{
+    testDiag("===== Lua shell: sampling profiler =====");
+
+    const char* path = "./luaProfileTest.folded";
+
+    lua_State* early = luaCreateState();
+    timedString(early, "function cobusy() local s = 0 for i = 1, 100000 do s = s + i end return s end "
+                       "co = coroutine.create(function() cobusy() end) "
+                       "wrapped = coroutine.wrap(function() cobusy() end) "
+                       "stock_resume, stock_wrap = coroutine.resume, coroutine.wrap");
+
+    luaProfileStart(100);
+
+    testOk(lua_gethook(early) == NULL, "Existing state is not hooked from another thread");
+
+    lua_State* state = luaCreateState();
+    testOk(lua_gethook(state) != NULL, "New states are sampled while the profiler runs");
+
+    luaL_dostring(state, "function busy() local s = 0 for i = 1, 100000 do s = s + i end return s end busy()");
+
+    testOk(timedString(early, "assert(coroutine.resume(co)) wrapped()") == LUA_OK, "Coroutines resumed");
+    testOk(lua_gethook(early) != NULL, "Existing state is hooked at its next call");
+    testOk(timedString(early, "assert(coroutine.resume ~= stock_resume and coroutine.wrap ~= stock_wrap)") == LUA_OK,
+           "Coroutine functions are wrapped while sampling");
+
+    luaProfileStop();
+    testOk(lua_gethook(state) != NULL, "Hook stays until the state's next call");
+
+    timedString(state, "return");
+    testOk(lua_gethook(state) == NULL, "Hook is removed at the next call after the profiler stops");
+
+    testOk(timedString(early, "coroutine.resume(coroutine.create(function() end)) "
+                              "assert(coroutine.resume == stock_resume and coroutine.wrap == stock_wrap)") == LUA_OK,
+           "Stock coroutine functions are back after the first resume once stopped");
+
+    testOk(luaProfileDump(path) == 0, "Folded stacks written");
+    testOk(foldedContains(path, "main ", ";busy "), "Stack is folded from main to busy");
+    testOk(foldedContains(path, "", ";cobusy "), "Coroutines created before the profiler started are sampled");
+
+    remove(path);
+    luaStateUnref(state);
+    luaStateUnref(early);
+}
+
 static void testLoadParams(void)
 {
     testDiag("===== Lua shell: luaLoadParams =====");
@@ -224,6 +544,14 @@ MAIN(luaShellTest)
     testCreateState();
     testNamedState();
     testLuaCmd();
+    testIocshLookup();
+    testIocshDirectCall();
+    testIocshDirectArgv();
+    testScriptCache();
+    testLocateFile();
+    testMemoryLimit();
+    testStateStats();
+    testProfiler();
     testLoadParams();
     testNullNamedState();
     testRegisterState();
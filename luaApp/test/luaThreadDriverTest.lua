@@ -0,0 +1,12 @@
+-- Test script for a driver running on its own port thread, loaded into a state of its own
+
+local asyn = require("asyn")
+local Float64 = asyn.Float64
+
+local tdrv = asyn.driver.new(PORT .. "T", {
+    Float64 "THREADED" (0.0),
+}, nil, { thread = true })
+
+tdrv.THREADED.read = function(self, addr)
+    return 42.5
+end